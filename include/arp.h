@@ -6,6 +6,7 @@
 #include "config.h"
 #include "net.h"
 #include "utils.h"
+#include "timer.h"
 #define ARP_HW_ETHER 0x1 // 以太网
 #define ARP_REQUEST 0x1  // ARP请求包
 #define ARP_REPLY 0x2    // ARP响应包
@@ -20,17 +21,29 @@ typedef enum arp_state
 typedef struct arp_entry
 {
     arp_state_t state;        //状态
-    time_t timeout;           //超时时间戳
+    time_t timeout;           //超时时间戳(ms，见timer_now())
     uint8_t ip[NET_IP_LEN];   //ip地址
     uint8_t mac[NET_MAC_LEN]; //mac地址
+    uint8_t ref;              //CLOCK淘汰的访问位，发送时命中置1
+    uint8_t hot;              //在保护段中：发送时命中过两次，只在没有试用表项可淘汰时才被淘汰
+    uint8_t retries;          //ARP_PENDING时已发送的arp请求次数，未确认的表项为已发送的单播探测次数
+    uint16_t pending_nr;      //等待解析的数据包数
+    int pending_head;         //等待队列的队首，为arp_buf池的下标，-1表示空
+    int pending_tail;         //等待队列的队尾
+    net_timer_t timer;        //ARP_VALID时为老化定时器，ARP_PENDING时为请求重发定时器
+    uint8_t is_static;        //静态表项：不老化、不被淘汰、不被arp报文修改
+    uint8_t if_index;         //ARP_PENDING时发送arp请求的网卡，未确认的表项为发送单播探测的网卡
+    uint8_t unconfirmed;      //从快照恢复、尚未收到对端arp报文确认的表项
 } arp_entry_t;
 
 typedef struct arp_buf
 {
     int valid;               //有效位
-    buf_t buf;               //数据包
+    buf_t buf;               //数据包，与发送者共享缓冲块
+    buf_t payload;           //数据包是分散/聚集链时的负载段，与发送者共享缓冲块，buf.next指向它
     uint8_t ip[NET_IP_LEN];  //目的ip地址
     net_protocol_t protocol; //上层协议
+    int next;                //同一目的地址等待队列中的下一个，空闲时为空闲链表中的下一个，-1表示结尾
 } arp_buf_t;
 
 #pragma pack(1)
@@ -48,7 +61,65 @@ typedef struct arp_pkt
 #pragma pack()
 
 /**
- * @brief 初始化arp协议
+ * @brief 从静态邻居文件加载永久表项
+ *        文件每行为"ip mac"，如"192.168.127.1 00:11:22:33:44:55"，#开头的行为注释
+ * 
+ * @param path 文件路径
+ * @return int 加载的表项数，文件不存在时为0，失败为-1
+ */
+int arp_load_static(const char *path);
+
+/**
+ * @brief 把arp表中的有效表项保存为快照文件
+ * 
+ * @param path 文件路径
+ * @return int 保存的表项数，失败为-1
+ */
+int arp_save(const char *path);
+
+/**
+ * @brief 从快照文件恢复arp表
+ *        恢复的表项只剩ARP_CONFIRM_SEC的有效时间，期间收到对端的数据包或arp报文才延长，
+ *        否则到期删除；超过ARP_TIMEOUT_SEC的快照直接忽略
+ * 
+ * @param path 文件路径
+ * @return int 恢复的表项数，文件不存在时为0，失败为-1
+ */
+int arp_load(const char *path);
+
+/**
+ * @brief 关闭arp协议，保存快照
+ * 
+ */
+void arp_close();
+
+/**
+ * @brief 设置arp表的容量，需在arp_init()前调用
+ * 
+ * @param nr 表项数
+ * @return int 成功为0，失败为-1
+ */
+int arp_set_size(int nr);
+
+/**
+ * @brief 设置静态邻居文件，需在arp_init()前调用
+ * 
+ * @param path 文件路径，为""时不加载
+ * @return int 成功为0，路径过长为-1
+ */
+int arp_set_static_file(const char *path);
+
+/**
+ * @brief 设置arp表快照文件，需在arp_init()前调用
+ *        启动时恢复，之后每ARP_SNAPSHOT_SEC秒及arp_close()时保存
+ * 
+ * @param path 文件路径，为""时不使用快照
+ * @return int 成功为0，路径过长为-1
+ */
+int arp_set_snapshot_file(const char *path);
+
+/**
+ * @brief 初始化arp协议，加载静态邻居文件与arp表快照
  * 
  */
 void arp_init();
@@ -66,8 +137,18 @@ void arp_in(buf_t *buf);
  * @param buf 要处理的数据包
  * @param ip 目标ip地址
  * @param protocol 上层协议
+ * @return int 已发出或已排入等待队列为0，驱动发送队列已满为DRIVER_TX_BUSY，丢弃为-1
+ */
+int arp_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol);
+
+/**
+ * @brief 收到对端的ip数据包时确认邻居仍然可达
+ *        只在已有的有效表项临近过期时刷新，不新建表项，不接受mac地址的变化
+ * 
+ * @param ip 对端ip地址
+ * @param mac 对端mac地址
  */
-void arp_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol);
+void arp_confirm(const uint8_t *ip, const uint8_t *mac);
 
 /**
  * @brief 更新arp表
@@ -0,0 +1,116 @@
+#ifndef CHECKSUM_H
+#define CHECKSUM_H
+#include <stdint.h>
+
+/**
+ * 互联网校验和（RFC 1071）：
+ *     按16位字做反码求和。求和与字节序无关，直接按本机字节序把内存中的16位字相加，
+ *     折叠取反后的结果按原样写回内存，即为网络字节序的校验和字段。
+ *     csum_partial()返回尚未折叠的32位部分和，多段数据的部分和可以用csum_add()累加，
+ *     最后由csum_fold()折叠取反。
+ */
+
+/**
+ * @brief 累加两个部分和，把进位加回低位
+ * 
+ * @param a 部分和
+ * @param b 部分和
+ * @return uint32_t 累加后的部分和
+ */
+static inline uint32_t csum_add(uint32_t a, uint32_t b)
+{
+    a += b;
+    return a + (a < b);
+}
+
+/**
+ * @brief 把32位部分和折叠为16位并取反，得到可以直接写入报头的校验和
+ * 
+ * @param sum 部分和
+ * @return uint16_t 校验和，与内存中的字节序一致
+ */
+static inline uint16_t csum_fold(uint32_t sum)
+{
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)~sum;
+}
+
+/**
+ * @brief 报头中一个16位字段从from改为to时，增量修改校验和（RFC 1624 式3）
+ *        HC' = ~(~HC + ~m + m')，代价与报头、数据长度无关
+ * 
+ * @param check 校验和字段
+ * @param from 字段原来的值，与内存中的字节序一致
+ * @param to 字段新的值，与内存中的字节序一致
+ */
+static inline void csum_replace2(uint16_t *check, uint16_t from, uint16_t to)
+{
+    uint32_t sum = csum_add((uint16_t)~*check, (uint16_t)~from);
+    *check = csum_fold(csum_add(sum, to));
+}
+
+/**
+ * @brief 报头中一个32位字段（如ip地址）从from改为to时，增量修改校验和
+ * 
+ * @param check 校验和字段
+ * @param from 字段原来的值，与内存中的字节序一致
+ * @param to 字段新的值，与内存中的字节序一致
+ */
+static inline void csum_replace4(uint16_t *check, uint32_t from, uint32_t to)
+{
+    uint32_t sum = csum_add((uint16_t)~*check, ~from);
+    *check = csum_fold(csum_add(sum, to));
+}
+
+/**
+ * @brief 计算一段数据的部分和，并累加到sum上
+ *        使用启动时根据CPU特性选出的实现（AVX2、SSE2或64位标量）
+ * 
+ * @param buf 数据
+ * @param len 字节数，可以为奇数，最后一个字节后补0
+ * @param sum 之前的部分和，第一段为0
+ * @return uint32_t 累加后的部分和
+ */
+uint32_t csum_partial(const void *buf, int len, uint32_t sum);
+
+/**
+ * @brief 拷贝一段数据并计算其部分和，累加到sum上
+ *        每个字节只读一次，读入后同时写出与累加，代替先memcpy再csum_partial
+ * 
+ * @param dst 目的内存，不能与src重叠
+ * @param src 数据
+ * @param len 字节数，可以为奇数，最后一个字节后补0
+ * @param sum 之前的部分和，第一段为0
+ * @return uint32_t 累加后的部分和
+ */
+uint32_t csum_partial_copy(void *dst, const void *src, int len, uint32_t sum);
+
+/**
+ * @brief 计算udp/tcp伪首部（源ip、目的ip、协议、长度）的部分和
+ *        按(源ip, 目的ip, 协议)缓存地址与协议部分的和，同一对端只需再加上长度
+ * 
+ * @param src_ip 源ip地址
+ * @param dest_ip 目的ip地址
+ * @param protocol 协议号
+ * @param len 传输层报文长度
+ * @return uint32_t 部分和，与传输层报文的部分和累加后折叠即为校验和
+ */
+uint32_t csum_pseudo_partial(const uint8_t *src_ip, const uint8_t *dest_ip, uint8_t protocol, uint16_t len);
+
+/**
+ * @brief 选择校验和的实现，用于测试与性能对比
+ * 
+ * @param name 实现名："avx2"、"sse2"、"scalar"，为NULL时按CPU特性自动选择
+ * @return int 成功为0，不支持该实现为-1
+ */
+int csum_select(const char *name);
+
+/**
+ * @brief 获取当前使用的校验和实现名
+ * 
+ * @return const char* 实现名
+ */
+const char *csum_impl_name();
+
+#endif
@@ -1,7 +1,9 @@
 #ifndef CONFIG_H
 #define CONFIG_H
 
+#ifndef DRIVER_IF_NAME
 #define DRIVER_IF_NAME "ens33" //使用的物理网卡名称
+#endif
 #define DRIVER_IF_IP      \
     {                     \
         192, 168, 127, 26 \
@@ -10,16 +12,90 @@
     {                                      \
         0x11, 0x22, 0x33, 0x44, 0x55, 0x66 \
     }                     //自定义网卡mac地址
+#define DRIVER_IF_PREFIX_LEN 24 //自定义网卡ip地址的子网前缀长度
 
 
-#define ETHERNET_MTU 1500 //以太网最大传输单元
+#define DRIVER_BACKEND_PCAP 0   //libpcap驱动
+#define DRIVER_BACKEND_PACKET 1 //AF_PACKET TPACKET_V3 mmap环形缓冲区驱动
+#define DRIVER_BACKEND_TAP 2    ///dev/net/tun TAP设备驱动，带virtio-net头卸载
+#ifndef DRIVER_BACKEND
+#define DRIVER_BACKEND DRIVER_BACKEND_PCAP //使用的驱动后端，可在编译时指定
+#endif
 
-#define ARP_MAX_ENTRY 16       //arp表最大长度
+#define DRIVER_RING_BLOCK_SIZE (1 << 18) //TPACKET_V3接收环每个块的大小
+#define DRIVER_RING_BLOCK_NR 64          //TPACKET_V3接收环的块数
+#define DRIVER_RING_BLOCK_TOV 1          //接收块未填满时交还用户态的超时时间(ms)
+#define DRIVER_RING_FRAME_SIZE 2048      //发送环每帧的最小大小，MTU较大时按需加倍以容纳帧头与一个MTU的数据帧
+#define DRIVER_RING_FRAME_NR 512         //发送环的帧数
+
+#define DRIVER_PROFILE_LATENCY 0    //低延迟配置：数据包到达立即交付
+#define DRIVER_PROFILE_THROUGHPUT 1 //高吞吐配置：内核攒批交付，缓冲区更大
+#define DRIVER_PROFILE DRIVER_PROFILE_LATENCY //默认使用的驱动配置，启动时可用driver_set_profile()修改
+#define DRIVER_SNAPLEN 65536                 //每个数据包最多捕获的字节数
+#define DRIVER_LATENCY_BUFFER_SIZE (1 << 21) //低延迟配置下内核接收缓冲区大小
+#define DRIVER_THROUGHPUT_BUFFER_SIZE (1 << 25) //高吞吐配置下内核接收缓冲区大小
+#define DRIVER_THROUGHPUT_TIMEOUT 10         //高吞吐配置下内核攒批的最长等待时间(ms)
+
+#define DRIVER_RX_BURST 32 //一次批量接收最多取出的帧数
+#define DRIVER_RX_ZEROCOPY 1 //接收时buf直接引用驱动的帧内存，不拷贝数据帧
+#define DRIVER_TX_QUEUE_LEN 64 //驱动发送队列长度
+#define DRIVER_TX_BATCH 32     //发送队列积累到该帧数时立即批量发送
+
+#define ETHERNET_MTU 1500     //以太网默认最大传输单元，可在打开网卡前用net_if_set_mtu()修改
+#define ETHERNET_MTU_MIN 68   //最小MTU，ipv4要求链路至少能传输68字节
+#define ETHERNET_MTU_MAX 9000 //最大MTU（巨型帧）
+
+#define BUF_HEADROOM 64          //buffer数据前至少预留的空间，供添加以太网/ip/udp头
+#define BUF_SMALL_SIZE 256       //小缓冲块大小，用于arp、icmp等短报文
+#define BUF_MTU_SIZE 2048        //MTU缓冲块大小，可容纳一个完整的以太网帧
+#define BUF_JFRAME_SIZE (ETHERNET_MTU_MAX + 14 + BUF_HEADROOM) //巨型帧缓冲块大小，可容纳一个最大MTU的以太网帧
+#define BUF_POOL_SMALL_NR 128    //缓冲池中小缓冲块的个数
+#define BUF_POOL_MTU_NR 256      //缓冲池中MTU缓冲块的个数
+#define BUF_POOL_JFRAME_NR 64    //缓冲池中巨型帧缓冲块的个数
+#define BUF_POOL_JUMBO_NR 8      //缓冲池中巨型缓冲块(最大udp包)的个数
+#define BUF_POOL_HUGEPAGE 0      //为1时缓冲池优先使用大页内存，申请失败时退回普通页
+
+#define ARP_MAX_ENTRY 1024     //arp表默认容量，可在arp_init()前用arp_set_size()修改
+#define ARP_HOT_PCT 75         //保护段（发送时命中过两次的表项）最多占arp表容量的百分比，其余留给试用的新表项
 #define ARP_TIMEOUT_SEC 60 * 5 //arp表过期时间
-#define ARP_MIN_INTERVAL 1     //向相同地址发送arp请求的最小间隔
+#define ARP_CONFIRM_SEC 60     //表项剩余有效时间少于该值时，收到对端的ip数据包才刷新表项
+#define ARP_MIN_INTERVAL 1     //向相同地址发送arp请求的最小间隔，之后每次重发间隔加倍
+#define ARP_MAX_RETRY 3        //arp请求最多发送的次数，仍无应答时丢弃等待的数据包
+#define ARP_PENDING_MAX 64     //每个目的地址最多暂存的数据包数，需容纳一个最大udp包的全部分片
+#define ARP_PENDING_NR 256     //所有目的地址共用的暂存数据包数
+#define ARP_TX_RETRY_MS 1      //驱动发送队列已满时，重发等待队列中剩余数据包的间隔(ms)
+#define ARP_STATIC_FILE ""     //静态邻居文件，每行"ip mac"，为""时不加载，可在arp_init()前用arp_set_static_file()修改
+#define ARP_SNAPSHOT_FILE ""   //arp表快照文件，启动时加载，定期及退出时保存，为""时不使用，可在arp_init()前用arp_set_snapshot_file()修改
+#define ARP_SNAPSHOT_SEC 60    //定期保存arp表快照的间隔
+#define ARP_PROBE_GAP_MS 10    //从快照恢复的表项逐个发送单播探测，相邻两个探测的间隔(ms)
 
 #define IP_DEFALUT_TTL 64 //IP默认TTL
+#define IP_FRAG_QUEUE_NR 16       //同时重组的数据报数
+#define IP_FRAG_NR 256            //所有重组中的数据报共用的分片数
+#define IP_FRAG_MEM_MAX (1 << 19) //重组中的分片占用的缓冲块总大小上限(B)
+#define IP_FRAG_PER_SRC 4         //每个源地址同时重组的数据报数
+#define IP_FRAG_HOLE_NR 16        //每个数据报最多的空洞数
+#define IP_FRAG_TIMEOUT_SEC 30    //重组超时时间
+#define IP_PMTU_CACHE_NR 64       //路径MTU缓存的表项数，须为2的幂
+#define IP_PMTU_MIN 552           //路径MTU的下限，更小的"需要分片"报文按该值处理
+#define IP_PMTU_TIMEOUT_SEC 600   //路径MTU的有效时间，过期后恢复为网卡MTU重新探测
+#define IP_FORWARD 0              //为1时默认转发目的地址不是本机的数据报，可在net_init()前用ip_set_forward()修改
+
+#define ROUTE_MAX_NR 32768 //路由表容量(含保留的0号)，须为2的幂且不超过32768
+#define ROUTE_TBL8_NR 4096 //前缀长度超过24的路由使用的二级表组数，每组256项，不超过32768
+
+#define CSUM_PSEUDO_CACHE_NR 16 //伪首部部分和缓存的表项数，须为2的幂
 
 #define UDP_MAX_HANDLER 16 //最多的UDP处理程序数
+#define UDP_FILTER_PASS_CLOSED 0 //为1时内核过滤器也放行发往未打开端口的udp数据包，以便回复ICMP端口不可达
+
+#define NET_IF_MAX_NR 8      //最多的网卡数
+#define NET_IF_NAME_LEN 16   //网卡名称的最大长度(含结尾的0)
+#define NET_IF_ADDR_NR 64    //每块网卡最多的ip地址数
+#define NET_IF_LOCAL_NR 512  //本机地址哈希表的大小，须为2的幂且不小于所有网卡的地址总数
+
+#define NET_POLL_BUDGET 64 //一次协议栈轮询最多处理的帧数
+#define NET_SPIN_US 200     //空闲后继续忙等轮询的时间(us)，超过后阻塞等待网卡
+#define NET_WAIT_MAX_MS 1000 //一次阻塞等待的最长时间(ms)
 
 #endif
\ No newline at end of file
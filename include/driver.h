@@ -1,35 +1,146 @@
 #ifndef DRIVER_H
 #define DRIVER_H
 #include "utils.h"
+#include "netif.h"
 #ifndef PCAP_BUF_SIZE
 #define PCAP_BUF_SIZE 1024
 #endif
+#define DRIVER_TX_FRAME_MAX (ETHERNET_MTU_MAX + 14) //发送队列中单帧的最大长度
+#define DRIVER_TX_BUSY 1                        //发送队列已满，需要等待driver_flush()
+
+#define DRIVER_OFFLOAD_TX_CSUM 0x1 //可以发送只含伪首部校验和的udp数据包，由内核补全校验和
+#define DRIVER_OFFLOAD_TX_UFO 0x2  //可以发送超过MTU的udp数据包，由内核分片
+#define DRIVER_OFFLOAD_RX_CSUM 0x4 //接收时会用BUF_F_CSUM_VALID标记内核已验证的数据包
+
+/**
+ * @brief 一块打开的网卡的驱动实例，各驱动后端自行定义其内容
+ * 
+ */
+typedef struct driver driver_t;
+
+/**
+ * @brief 网卡接收统计
+ * 
+ */
+typedef struct driver_stats
+{
+    uint32_t recv;   //内核收到的数据包数
+    uint32_t drop;   //因缓冲区已满被内核丢弃的数据包数
+    uint32_t ifdrop; //被网卡丢弃的数据包数
+} driver_stats_t;
+
+/**
+ * @brief 选择驱动配置，对之后打开的所有网卡生效，需在driver_open()之前调用
+ * 
+ * @param profile DRIVER_PROFILE_LATENCY或DRIVER_PROFILE_THROUGHPUT
+ * @return int 成功为0，不支持的配置为-1
+ */
+int driver_set_profile(int profile);
+
+/**
+ * @brief 打开网卡，按netif的名称、mac与MTU配置驱动，成功时设置netif->drv
+ * 
+ * @param netif 要打开的网卡
+ * @return int 成功为0，失败为-1
+ */
+int driver_open(net_if_t *netif);
+
 /**
- * @brief 打开网卡
+ * @brief 设置内核中的数据包过滤条件，不满足的数据帧在内核中丢弃，不拷贝到用户态
+ *        驱动始终只接收发往本网卡mac与广播的数据帧，filter_exp在此基础上进一步过滤
  * 
+ * @param drv 驱动实例
+ * @param filter_exp libpcap语法的过滤表达式，为NULL时只按mac过滤
  * @return int 成功为0，失败为-1
  */
-int driver_open();
+int driver_set_filter(driver_t *drv, const char *filter_exp);
 
 /**
  * @brief 试图从网卡接收数据包
  * 
+ * @param drv 驱动实例
  * @param buf 收到的数据包
  * @return int 数据包的长度，未收到为0，错误为-1
  */
-int driver_recv(buf_t *buf);
+int driver_recv(driver_t *drv, buf_t *buf);
+
+/**
+ * @brief 试图从网卡批量接收数据包，一次调用最多取出max个
+ * 
+ * @param drv 驱动实例
+ * @param bufs 接收数据包的buffer数组
+ * @param max 数组长度，即本次最多接收的数据包数
+ * @return int 收到的数据包个数，未收到为0，错误为-1
+ */
+int driver_recv_burst(driver_t *drv, buf_t *bufs, int max);
+
+/**
+ * @brief 零拷贝接收时处理一个数据帧的回调
+ *        buf直接引用驱动的帧内存，只在回调期间有效，
+ *        回调返回后该帧即被交还驱动；需要保留数据的处理程序应自行buf_copy
+ * 
+ */
+typedef void (*driver_handler_t)(buf_t *buf);
+
+/**
+ * @brief 零拷贝地从网卡接收至多max个数据包
+ *        不把数据帧拷贝到buffer，而是让buf直接指向驱动的接收缓冲区/接收环，
+ *        依次交给handler处理，handler返回后再把该帧交还驱动
+ * 
+ * @param drv 驱动实例
+ * @param max 本次最多接收的数据包数
+ * @param handler 处理数据帧的回调
+ * @return int 处理的数据包个数，未收到为0，错误为-1
+ */
+int driver_recv_zerocopy(driver_t *drv, int max, driver_handler_t handler);
 
 /**
  * @brief 使用网卡发送一个数据包
+ *        数据包先放入驱动的发送队列，积累到DRIVER_TX_BATCH帧或调用driver_flush()时批量发出
  * 
+ * @param drv 驱动实例
  * @param buf 要发送的数据包
- * @return int 成功为0，失败为-1
+ * @return int 成功为0，发送队列已满为DRIVER_TX_BUSY，失败为-1
+ */
+int driver_send(driver_t *drv, buf_t *buf);
+
+/**
+ * @brief 把发送队列中的数据包一次批量发出
+ * 
+ * @param drv 驱动实例
+ * @return int 发出的数据包个数，失败为-1
+ */
+int driver_flush(driver_t *drv);
+
+/**
+ * @brief 查询网卡支持的卸载功能
+ * 
+ * @param drv 驱动实例
+ * @return int DRIVER_OFFLOAD_*的组合
+ */
+int driver_offload(driver_t *drv);
+
+/**
+ * @brief 获取网卡的接收统计，包括内核丢包计数
+ * 
+ * @param drv 驱动实例
+ * @param stats 统计结果，自打开网卡起累计
+ * @return int 成功为0，不支持或失败为-1
+ */
+int driver_stats(driver_t *drv, driver_stats_t *stats);
+
+/**
+ * @brief 获取可以用epoll/select等待数据到达的描述符
+ * 
+ * @param drv 驱动实例
+ * @return int 描述符，不支持时为-1
  */
-int driver_send(buf_t *buf);
+int driver_fd(driver_t *drv);
 
 /**
- * @brief 关闭网卡
+ * @brief 关闭网卡，释放驱动实例并清除所属网卡的drv
  * 
+ * @param drv 驱动实例
  */
-void driver_close();
+void driver_close(driver_t *drv);
 #endif
\ No newline at end of file
@@ -34,14 +34,17 @@ void ethernet_in(buf_t *buf);
  * @param buf 要处理的数据包
  * @param mac 目标ip地址
  * @param protocol 上层协议
+ * @return int 成功为0，驱动发送队列已满为DRIVER_TX_BUSY（buf恢复原样，可以重发），失败为-1
  */
-void ethernet_out(buf_t *buf, const uint8_t *mac, net_protocol_t protocol);
+int ethernet_out(buf_t *buf, const uint8_t *mac, net_protocol_t protocol);
 
 /**
- * @brief 一次以太网轮询
+ * @brief 一次以太网轮询，所有网卡共用至多budget个数据帧，批量接收并处理
  * 
+ * @param budget 本次最多处理的帧数
+ * @return int 实际处理的帧数，错误为-1
  */
-void ethernet_poll();
+int ethernet_poll(int budget);
 
 static const uint8_t ether_broadcast_mac[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}; //以太网广播mac地址
 #endif
\ No newline at end of file
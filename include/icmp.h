@@ -15,15 +15,18 @@ typedef struct icmp_hdr
 #pragma pack()
 typedef enum icmp_type
 {
-    ICMP_TYPE_ECHO_REQUEST = 8, // 回显请求
-    ICMP_TYPE_ECHO_REPLY = 0,   // 回显响应
-    ICMP_TYPE_UNREACH = 3,      // 目的不可达
+    ICMP_TYPE_ECHO_REQUEST = 8,   // 回显请求
+    ICMP_TYPE_ECHO_REPLY = 0,     // 回显响应
+    ICMP_TYPE_UNREACH = 3,        // 目的不可达
+    ICMP_TYPE_TIME_EXCEEDED = 11, // 超时
 } icmp_type_t;
 
 typedef enum icmp_code
 {
+    ICMP_CODE_NET_UNREACH = 0,      // 网络不可达
     ICMP_CODE_PROTOCOL_UNREACH = 2, // 协议不可达
-    ICMP_CODE_PORT_UNREACH = 3      // 端口不可达
+    ICMP_CODE_PORT_UNREACH = 3,     // 端口不可达
+    ICMP_CODE_FRAG_NEEDED = 4       // 需要分片但设置了DF位
 } icmp_code_t;
 
 /**
@@ -31,8 +34,9 @@ typedef enum icmp_code
  * 
  * @param buf 要处理的数据包
  * @param src_ip 源ip地址
+ * @param dest_ip 目的ip地址，本机的某个地址
  */
-void icmp_in(buf_t *buf, uint8_t *src_ip);
+void icmp_in(buf_t *buf, uint8_t *src_ip, uint8_t *dest_ip);
 
 /**
  * @brief 发送icmp不可达
@@ -42,4 +46,21 @@ void icmp_in(buf_t *buf, uint8_t *src_ip);
  * @param code icmp code，协议不可达或端口不可达
  */
 void icmp_unreachable(buf_t *recv_buf, uint8_t *src_ip, icmp_code_t code);
+
+/**
+ * @brief 转发时TTL耗尽，发送icmp超时
+ * 
+ * @param recv_buf 收到的ip数据包
+ * @param src_ip 源ip地址
+ */
+void icmp_time_exceeded(buf_t *recv_buf, uint8_t *src_ip);
+
+/**
+ * @brief 转发时数据报超过出口网卡MTU且设置了DF，发送icmp需要分片
+ * 
+ * @param recv_buf 收到的ip数据包
+ * @param src_ip 源ip地址
+ * @param mtu 出口网卡的MTU
+ */
+void icmp_frag_needed(buf_t *recv_buf, uint8_t *src_ip, uint16_t mtu);
 #endif
@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include "net.h"
 #include "utils.h"
+#include "netif.h"
 #pragma pack(1)
 typedef struct ip_hdr
 {
@@ -24,6 +25,14 @@ typedef struct ip_hdr
 #define IP_HDR_OFFSET_PER_BYTE (8) //ip分片偏移长度单位
 #define IP_VERSION_4 (4)           //ipv4
 #define IP_MORE_FRAGMENT 1 << 5    //ip分片mf位
+#define IP_DONT_FRAGMENT 1 << 6    //ip分片df位
+#define IP_OFFSET_MASK 0x1fff      //ip分片偏移字段的掩码(主机字节序)
+
+/**
+ * @brief 初始化ip协议
+ * 
+ */
+void ip_init();
 
 /**
  * @brief 处理一个收到的数据包
@@ -38,6 +47,58 @@ void ip_in(buf_t *buf);
  * @param buf 要处理的包
  * @param ip 目标ip地址
  * @param protocol 上层协议
+ * @return int 已发出或等待arp解析为0，驱动发送队列已满为DRIVER_TX_BUSY，丢弃为-1
+ */
+int ip_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol);
+
+/**
+ * @brief 以指定的源地址发送一个ip数据包
+ * 
+ * @param buf 要处理的包
+ * @param src_ip 源ip地址，为NULL时按出口网卡与下一跳选择
+ * @param ip 目标ip地址
+ * @param protocol 上层协议
+ * @return int 已发出或等待arp解析为0，驱动发送队列已满为DRIVER_TX_BUSY，丢弃为-1
+ */
+int ip_out_from(buf_t *buf, const uint8_t *src_ip, uint8_t *ip, net_protocol_t protocol);
+
+/**
+ * @brief 按路由表选择发往目的地址的出口网卡与下一跳
+ * 
+ * @param dest_ip 目的ip地址
+ * @param next_hop 下一跳，经网关转发时为网关地址，直连或没有路由时为目的地址本身
+ * @return net_if_t* 出口网卡，没有路由时为0号网卡
+ */
+net_if_t *ip_route(const uint8_t *dest_ip, const uint8_t **next_hop);
+
+/**
+ * @brief 获取到目的地址的路径MTU
+ * 
+ * @param ip 目的ip地址
+ * @return int 缓存的路径MTU，没有缓存或已过期时为出口网卡的MTU
+ */
+int ip_pmtu(const uint8_t *ip);
+
+/**
+ * @brief 收到icmp"需要分片"报文时降低到目的地址的路径MTU（RFC 1191）
+ * 
+ * @param ip 原数据报的目的ip地址
+ * @param mtu 报文中的下一跳MTU，为0时（旧路由器不填）按原数据报长度估计
+ * @param len 原数据报的总长度
+ */
+void ip_pmtu_update(const uint8_t *ip, int mtu, int len);
+
+/**
+ * @brief 设置是否转发目的地址不是本机的数据报，需在net_init()之前调用
+ * 
+ * @param on 为1时转发
+ */
+void ip_set_forward(int on);
+
+/**
+ * @brief 查询是否开启了转发
+ * 
+ * @return int 开启为1
  */
-void ip_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol);
+int ip_forward_enabled();
 #endif
\ No newline at end of file
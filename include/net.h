@@ -11,9 +11,6 @@ typedef enum net_protocol
     NET_PROTOCOL_TCP = 6,
 } net_protocol_t;
 
-static uint8_t net_if_mac[] = DRIVER_IF_MAC;
-static uint8_t net_if_ip[] = DRIVER_IF_IP;
-
 #define NET_MAC_LEN (6)                                     //mac地址长度
 #define NET_IP_LEN (4)                                      //ip地址长度
 #define swap16(x) ((((x)&0xFF) << 8) | (((x) >> 8) & 0xFF)) //为16位数据交换大小端
@@ -25,9 +22,41 @@ static uint8_t net_if_ip[] = DRIVER_IF_IP;
 void net_init();
 
 /**
- * @brief 一次协议栈轮询
+ * @brief 关闭协议栈，保存arp表快照并关闭网卡
+ * 
+ */
+void net_close();
+
+/**
+ * @brief 一次协议栈轮询，至多处理NET_POLL_BUDGET个数据帧
+ * 
+ * @return int 本次处理的帧数，所有网卡接收出错为-1
+ */
+int net_poll();
+
+/**
+ * @brief 一次协议栈轮询，至多处理budget个数据帧
+ * 
+ * @param budget 本次最多处理的帧数
+ * @return int 本次处理的帧数，0表示空闲，所有网卡接收出错为-1
+ */
+int net_poll_budget(int budget);
+
+/**
+ * @brief 阻塞等待网卡有数据到达
+ * 
+ * @param timeout_ms 最长等待时间(ms)，-1为一直等待
+ * @return int 有数据到达为1，超时为0，错误为-1
+ */
+int net_wait(int timeout_ms);
+
+/**
+ * @brief 一次轮询没有处理任何数据帧时调用
+ *        刚空闲时继续忙等，保证突发流量下的延迟；
+ *        空闲超过NET_SPIN_US后阻塞在网卡描述符上，避免空转占满CPU，
+ *        阻塞时间不超过下一个定时器到期的时间
  * 
  */
-void net_poll();
+void net_idle();
 
 #endif
\ No newline at end of file
@@ -0,0 +1,146 @@
+#ifndef NETIF_H
+#define NETIF_H
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include "config.h"
+#include "net.h"
+
+/**
+ * 网卡表：
+ *     每块网卡有自己的驱动实例、mac、MTU与一组ip地址，0号网卡为默认网卡。
+ *     所有网卡的地址都放入一个按地址哈希的表（弱主机模型），
+ *     ip_in()判断目的地址是否为本机只需一次哈希查找，与地址总数无关。
+ *     添加地址时同时添加其所在子网的直连路由，发送时按路由选择出口网卡。
+ */
+
+struct driver;
+
+typedef struct net_if_addr
+{
+    uint8_t ip[NET_IP_LEN]; //ip地址
+    uint8_t len;            //子网前缀长度
+} net_if_addr_t;
+
+typedef struct net_if
+{
+    uint8_t index;                       //网卡编号，即在net_ifs中的下标
+    char name[NET_IF_NAME_LEN];          //网卡名称
+    uint8_t mac[NET_MAC_LEN];            //mac地址
+    int mtu;                             //最大传输单元，接收检查、发送分片与缓冲区大小都以它为准
+    int offload;                         //驱动支持的卸载功能，DRIVER_OFFLOAD_*的组合，打开网卡时设置
+    struct driver *drv;                  //驱动实例，未打开时为NULL
+    net_if_addr_t addr[NET_IF_ADDR_NR];  //ip地址，addr[0]为主地址
+    int addr_nr;                         //ip地址个数
+} net_if_t;
+
+/**
+ * @brief 本机地址哈希表中的一项
+ * 
+ */
+typedef struct net_if_local_entry
+{
+    uint32_t ip;      //ip地址，按内存中的字节直接读出，不转换字节序
+    uint8_t if_index; //地址所在的网卡
+    uint16_t next;    //哈希链或空闲链表中的下一项，0为结束
+} net_if_local_entry_t;
+
+extern net_if_t net_ifs[NET_IF_MAX_NR]; //网卡
+extern int net_if_nr;                   //网卡个数
+
+extern net_if_local_entry_t net_if_locals[NET_IF_LOCAL_NR]; //本机地址，0号保留
+extern uint16_t net_if_local_hash[NET_IF_LOCAL_NR];         //本机地址哈希表，存放链表头
+
+/**
+ * @brief 获取网卡
+ * 
+ * @param index 网卡编号
+ * @return net_if_t* 网卡
+ */
+static inline net_if_t *net_if_get(int index)
+{
+    return &net_ifs[index];
+}
+
+/**
+ * @brief 本机地址的哈希值
+ * 
+ * @param ip 按内存中的字节直接读出的ip地址
+ * @return uint32_t 哈希表下标
+ */
+static inline uint32_t net_if_local_hash_of(uint32_t ip)
+{
+    return (ip * 0x9e3779b1u >> 16) & (NET_IF_LOCAL_NR - 1);
+}
+
+/**
+ * @brief 判断ip地址是否为本机地址
+ * 
+ * @param ip ip地址
+ * @return net_if_t* 地址所在的网卡，不是本机地址时为NULL
+ */
+static inline net_if_t *net_if_local(const uint8_t *ip)
+{
+    uint32_t a;
+    memcpy(&a, ip, NET_IP_LEN);
+    for (uint16_t i = net_if_local_hash[net_if_local_hash_of(a)]; i; i = net_if_locals[i].next)
+        if (net_if_locals[i].ip == a)
+            return &net_ifs[net_if_locals[i].if_index];
+    return NULL;
+}
+
+/**
+ * @brief 添加默认网卡(DRIVER_IF_NAME)及其地址，已有网卡时什么也不做
+ * 
+ * @return int 成功为0，失败为-1
+ */
+int net_if_init();
+
+/**
+ * @brief 添加一块网卡，需在net_init()之前调用
+ * 
+ * @param name 网卡名称
+ * @param mac mac地址，为NULL时由DRIVER_IF_MAC的最后一个字节加上网卡编号得到
+ * @param mtu 最大传输单元，ETHERNET_MTU_MIN到ETHERNET_MTU_MAX之间
+ * @return net_if_t* 新的网卡，失败为NULL
+ */
+net_if_t *net_if_add(const char *name, const uint8_t *mac, int mtu);
+
+/**
+ * @brief 设置网卡的MTU，需在net_init()之前调用
+ * 
+ * @param netif 网卡
+ * @param mtu 最大传输单元，ETHERNET_MTU_MIN到ETHERNET_MTU_MAX之间
+ * @return int 成功为0，超出范围为-1
+ */
+int net_if_set_mtu(net_if_t *netif, int mtu);
+
+/**
+ * @brief 为网卡添加一个ip地址，并添加该地址所在子网的直连路由
+ * 
+ * @param netif 网卡
+ * @param ip ip地址
+ * @param len 子网前缀长度，0~32
+ * @return int 成功为0，失败为-1
+ */
+int net_if_addr_add(net_if_t *netif, const uint8_t *ip, int len);
+
+/**
+ * @brief 删除网卡的一个ip地址，网卡上没有其他地址在同一子网时同时删除直连路由
+ * 
+ * @param netif 网卡
+ * @param ip ip地址
+ * @return int 成功为0，网卡没有该地址为-1
+ */
+int net_if_addr_del(net_if_t *netif, const uint8_t *ip);
+
+/**
+ * @brief 为发往目的地址的数据包选择源地址
+ * 
+ * @param netif 出口网卡
+ * @param dest 下一跳地址
+ * @return const uint8_t* 网卡上子网包含dest的地址（前缀最长的），没有时为主地址，网卡没有地址时为0.0.0.0
+ */
+const uint8_t *net_if_src(const net_if_t *netif, const uint8_t *dest);
+
+#endif
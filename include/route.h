@@ -0,0 +1,97 @@
+#ifndef ROUTE_H
+#define ROUTE_H
+#include <stdint.h>
+#include <stddef.h>
+#include "config.h"
+#include "net.h"
+
+/**
+ * 路由表：
+ *     DIR-24-8最长前缀匹配。一级表以目的地址的高24位为下标，共2^24项；
+ *     长度超过24的前缀所在的一级表项改为指向一个256项的二级表组，以低8位为下标。
+ *     表项为16位：0为没有路由，最高位为0时是路由下标，为1时低15位是二级表组号。
+ *     查找最多访问两次大表，再读一次很小的路由数组，与路由条数无关。
+ *     添加/删除时按每条路由的前缀长度决定覆盖哪些表项，只在控制面上遍历。
+ */
+
+#define ROUTE_TBL8_FLAG 0x8000 //一级表项指向二级表组的标志
+
+typedef struct route_entry
+{
+    uint32_t prefix;            //前缀，主机字节序
+    uint8_t len;                //前缀长度
+    uint8_t has_gw;             //是否经网关转发，为0时目的地址直连
+    uint8_t gw[NET_IP_LEN];     //网关ip地址
+    uint8_t if_index;           //出口网卡
+    uint16_t next;              //哈希链或空闲链表中的下一条路由，0为结束
+} route_entry_t;
+
+extern route_entry_t route_table[ROUTE_MAX_NR]; //路由，0号保留
+extern uint16_t *route_tbl24;                   //一级表，未初始化时为NULL
+extern uint16_t *route_tbl8;                    //二级表组
+
+/**
+ * @brief 最长前缀匹配查找路由
+ * 
+ * @param ip 目的ip地址
+ * @return route_entry_t* 路由，没有匹配的路由时为NULL
+ */
+static inline route_entry_t *route_lookup(const uint8_t *ip)
+{
+    if (route_tbl24 == NULL)
+        return NULL;
+    uint32_t addr = (uint32_t)ip[0] << 24 | (uint32_t)ip[1] << 16 | (uint32_t)ip[2] << 8 | ip[3];
+    uint16_t e = route_tbl24[addr >> 8];
+    if (e & ROUTE_TBL8_FLAG)
+        e = route_tbl8[(uint32_t)(e & ~ROUTE_TBL8_FLAG) << 8 | (addr & 0xff)];
+    return e ? &route_table[e] : NULL;
+}
+
+/**
+ * @brief 获取发往目的地址的下一跳
+ * 
+ * @param ip 目的ip地址
+ * @return const uint8_t* 经网关转发时为网关地址，直连或没有路由时为目的地址本身
+ */
+static inline const uint8_t *route_next_hop(const uint8_t *ip)
+{
+    route_entry_t *r = route_lookup(ip);
+    return r && r->has_gw ? r->gw : ip;
+}
+
+/**
+ * @brief 初始化路由表，映射一级表与二级表组的内存
+ *        第一次添加路由时调用
+ * 
+ * @return int 成功为0，失败为-1
+ */
+int route_init();
+
+/**
+ * @brief 添加一条路由，前缀与长度相同的路由已存在时修改其网关与出口网卡
+ * 
+ * @param prefix 前缀，主机位会被清零
+ * @param len 前缀长度，0~32
+ * @param gw 网关ip地址，为NULL或0.0.0.0时目的地址直连
+ * @param if_index 出口网卡，为负数时取到达网关的直连路由的网卡，没有时为0号网卡
+ * @return int 成功为0，失败为-1
+ */
+int route_add(const uint8_t *prefix, int len, const uint8_t *gw, int if_index);
+
+/**
+ * @brief 删除一条路由，原来匹配它的地址改为匹配次长的前缀
+ * 
+ * @param prefix 前缀
+ * @param len 前缀长度
+ * @return int 成功为0，没有该路由为-1
+ */
+int route_del(const uint8_t *prefix, int len);
+
+/**
+ * @brief 获取路由条数
+ * 
+ * @return int 路由条数
+ */
+int route_count();
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef TIMER_H
+#define TIMER_H
+#include <stdint.h>
+
+/**
+ * 协议栈定时器：
+ *     分层时间轮，每层64个槽，最低层每槽1ms，逐层扩大64倍，共4层（约4.6小时）。
+ *     启动、修改、删除定时器与处理一个到期定时器的代价均为O(1)。
+ *     时钟为单调时钟(ms)，每次协议栈轮询时由timer_run()读取一次并缓存，
+ *     数据包处理路径上用timer_now()读取缓存值，不再调用time()等系统调用。
+ */
+
+typedef struct net_timer net_timer_t;
+typedef void (*net_timer_handler_t)(net_timer_t *timer, void *arg);
+struct net_timer
+{
+    net_timer_t *next;           //同一槽中的下一个定时器
+    net_timer_t **pprev;         //指向前一个定时器的next，未启动时为NULL
+    uint64_t expires;            //到期时间(ms)
+    net_timer_handler_t handler; //到期处理函数
+    void *arg;                   //处理函数的参数
+};
+
+extern uint64_t timer_clock; //缓存的单调时钟(ms)
+
+/**
+ * @brief 获取缓存的单调时钟，精度为一次协议栈轮询
+ * 
+ * @return uint64_t 当前时间(ms)
+ */
+static inline uint64_t timer_now()
+{
+    return timer_clock;
+}
+
+/**
+ * @brief 判断定时器是否已启动且尚未到期
+ * 
+ * @param timer 定时器
+ * @return int 已启动为1
+ */
+static inline int timer_pending(const net_timer_t *timer)
+{
+    return timer->pprev != 0;
+}
+
+/**
+ * @brief 初始化定时器子系统，读取一次时钟
+ * 
+ */
+void timer_init();
+
+/**
+ * @brief 设置定时器的处理函数，定时器处于未启动状态
+ * 
+ * @param timer 定时器
+ * @param handler 到期处理函数，调用前定时器已变为未启动，可在其中重新启动
+ * @param arg 处理函数的参数
+ */
+void timer_setup(net_timer_t *timer, net_timer_handler_t handler, void *arg);
+
+/**
+ * @brief 启动定时器，已启动时修改其到期时间
+ * 
+ * @param timer 定时器
+ * @param expires 到期时间(ms)，早于当前时间时在下一次timer_run()中到期
+ */
+void timer_mod(net_timer_t *timer, uint64_t expires);
+
+/**
+ * @brief 停止定时器，未启动时不做任何事
+ * 
+ * @param timer 定时器
+ */
+void timer_del(net_timer_t *timer);
+
+/**
+ * @brief 更新缓存的时钟，并处理所有已到期的定时器
+ *        每次协议栈轮询时调用
+ * 
+ * @return int 本次处理的定时器数
+ */
+int timer_run();
+
+/**
+ * @brief 估计距离下一个定时器到期的时间，用于决定空闲时阻塞等待的时长
+ *        结果不会晚于实际到期时间
+ * 
+ * @return int 距离下一次需要调用timer_run()的时间(ms)，没有定时器时为-1
+ */
+int timer_next();
+
+#endif
@@ -28,6 +28,7 @@ struct udp_entry
     int valid;             //有效位
     int port;              //端口号
     udp_handler_t handler; //处理程序
+    int df;                //为1时发出的数据包置DF位，不分片
 };
 
 /**
@@ -41,8 +42,9 @@ void udp_init();
  * 
  * @param buf 要处理的包
  * @param src_ip 源ip地址
+ * @param dest_ip 目的ip地址，本机的某个地址
  */
-void udp_in(buf_t *buf, uint8_t *src_ip);
+void udp_in(buf_t *buf, uint8_t *src_ip, uint8_t *dest_ip);
 
 /**
  * @brief 处理一个要发送的数据包
@@ -51,8 +53,9 @@ void udp_in(buf_t *buf, uint8_t *src_ip);
  * @param src_port 源端口号
  * @param dest_ip 目的ip地址
  * @param dest_port 目的端口号
+ * @return int 已发出或等待arp解析为0，驱动发送队列已满为DRIVER_TX_BUSY，丢弃为-1
  */
-void udp_out(buf_t *buf, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port);
+int udp_out(buf_t *buf, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port);
 
 /**
  * @brief 发送一个udp包
@@ -62,8 +65,28 @@ void udp_out(buf_t *buf, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port
  * @param src_port 源端口号
  * @param dest_ip 目的ip地址
  * @param dest_port 目的端口号
+ * @return int 成功为0，驱动发送队列已满为DRIVER_TX_BUSY（可在net_poll()后重发），
+ *             端口禁止分片且数据超过udp_max_payload()或数据包被丢弃时为-1
  */
-void udp_send(uint8_t *data, uint16_t len, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port);
+int udp_send(uint8_t *data, uint16_t len, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port);
+
+/**
+ * @brief 获取发往目的地址时不会被分片的最大udp数据长度
+ * 
+ * @param dest_ip 目的ip地址
+ * @return int 路径MTU减去ip与udp首部
+ */
+int udp_max_payload(uint8_t *dest_ip);
+
+/**
+ * @brief 设置从一个已打开的端口发出的数据包是否置DF位
+ *        置DF位后数据包不再分片，由应用按udp_max_payload()控制大小
+ * 
+ * @param port 端口号
+ * @param df 为1时置DF位
+ * @return int 成功为0，端口未打开为-1
+ */
+int udp_set_df(uint16_t port, int df);
 
 /**
  * @brief 打开一个udp端口并注册处理程序
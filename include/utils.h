@@ -4,16 +4,54 @@
 #include "config.h"
 #define BUF_MAX_LEN (UINT16_MAX + 14) //最大udp包 + 以太网帧报头长度
 
+#define BUF_F_CSUM_VALID 0x1   //接收：传输层校验和已由内核验证，协议层无需再验证（不含ip首部校验和）
+#define BUF_F_CSUM_PARTIAL 0x2 //发送：udp校验和字段只含伪首部的和，由内核补全；接收：本机内核产生、尚未补全的数据包
+#define BUF_F_GSO_UDP 0x4      //发送：超过MTU的udp数据包，由内核按gso_size分片
+#define BUF_F_CSUM_SUM 0x8     //发送：csum中已有data全部内容的部分和，添加/去除协议头后失效
+#define BUF_F_DF 0x10          //发送：ip首部置DF位，不在本地分片，超过路径MTU时丢弃
+
+#define BUF_CLASS_SMALL 0 //小缓冲块
+#define BUF_CLASS_MTU 1    //MTU缓冲块
+#define BUF_CLASS_JFRAME 2 //巨型帧缓冲块
+#define BUF_CLASS_JUMBO 3  //巨型缓冲块
+#define BUF_CLASS_NR 4     //缓冲池中的尺寸等级数
+#define BUF_CLASS_HEAP 4   //缓冲池耗尽时从堆上临时分配的块
+
+/**
+ * @brief 缓冲块，即buffer实际存放数据的内存
+ *        多个buffer可以通过引用计数共享同一个缓冲块，引用归零时归还缓冲池
+ * 
+ */
+typedef struct buf_block
+{
+    uint8_t *data;          // 数据区起始地址
+    uint32_t size;          // 数据区大小
+    uint16_t ref;           // 引用计数
+    uint8_t cls;            // 尺寸等级，BUF_CLASS_*
+    struct buf_block *next; // 空闲链表中的下一个块
+} buf_block_t;
+
 typedef struct buf
 {
     uint16_t len;                       // 包中有效数据大小
     uint8_t *data;                      // 包的数据起始地址
-    uint8_t payload[BUF_MAX_LEN];       // 最大负载数据量
+    uint8_t flags;                      // 校验和与分段卸载标志，BUF_F_*
+    uint8_t if_index;                   // 接收时为收到该包的网卡，发送时为发出该包的网卡(net_ifs的下标)
+    uint16_t csum_start;                // BUF_F_CSUM_PARTIAL时，校验和覆盖范围的起始位置(相对data)
+    uint16_t csum_offset;               // BUF_F_CSUM_PARTIAL时，校验和字段相对csum_start的偏移
+    uint16_t gso_size;                  // BUF_F_GSO_UDP时，每个分片的负载长度
+    uint32_t csum;                      // BUF_F_CSUM_SUM时，data全部内容的部分和(见checksum.h)
+    uint8_t *payload;                   // 缓冲块数据区的起始地址
+    buf_block_t *block;                 // 引用的缓冲块，NULL表示未分配或data直接引用驱动的帧内存
+    struct buf *next;                   // 分散/聚集链中的下一段，NULL表示最后一段
 } buf_t;
-static buf_t rxbuf, txbuf;          //一个buf足够单线程使用
+// 一个数据包可以由多段buf链接而成（如协议头段 + 引用原数据包负载的段），
+// 每段的len只是本段长度，协议头只在第一段中添加与去除
+// buf_t本身只有几十字节，使用前需清零（定义为全局/静态变量或用{0}初始化），之后由buf_init分配缓冲块
 
 /**
  * @brief 初始化buffer为给定的长度，用于装载数据包
+ *        从缓冲池中取一个能容纳len字节与BUF_HEADROOM的缓冲块
  * 
  * @param buf 要初始化的buffer
  * @param len 长度
@@ -38,12 +76,58 @@ void buf_remove_header(buf_t *buf, int len);
 
 /**
  * @brief 复制一个buffer到新buffer
+ *        src为分散/聚集链时，各段数据依次拷入dst，dst为一段连续的buffer
  * 
  * @param dst 目的buffer
  * @param src 源buffer
  */
 void buf_copy(buf_t *dst, buf_t *src);
 
+/**
+ * @brief 克隆一个buffer，不复制数据，两个buffer共享同一个缓冲块
+ *        克隆后任何一方都不应再修改数据区中已有的内容，
+ *        之后对其中一方调用buf_init会为其分配新的缓冲块。
+ *        src为分散/聚集链时，后续各段可能随时被其所有者复用，因此退化为buf_copy
+ * 
+ * @param dst 目的buffer
+ * @param src 源buffer
+ */
+void buf_clone(buf_t *dst, buf_t *src);
+
+/**
+ * @brief 引用src中从offset开始的len字节，不复制数据
+ *        dst与src共享缓冲块，只是data与len指向其中的一片，用于拼接分散/聚集链
+ * 
+ * @param dst 目的buffer
+ * @param src 源buffer
+ * @param offset 相对src->data的偏移
+ * @param len 长度
+ */
+void buf_slice(buf_t *dst, buf_t *src, int offset, int len);
+
+/**
+ * @brief 计算分散/聚集链的总长度
+ * 
+ * @param buf 链的第一段
+ * @return int 各段长度之和
+ */
+int buf_chain_len(buf_t *buf);
+
+/**
+ * @brief 把分散/聚集链中各段的数据依次拷贝到一段连续内存
+ * 
+ * @param buf 链的第一段
+ * @param dst 目的内存，长度至少为buf_chain_len(buf)
+ */
+void buf_gather(buf_t *buf, uint8_t *dst);
+
+/**
+ * @brief 释放buffer对缓冲块的引用，引用归零时缓冲块归还缓冲池
+ * 
+ * @param buf 要释放的buffer
+ */
+void buf_free(buf_t *buf);
+
 /**
  * @brief 计算16位校验和
  * 
@@ -1,10 +1,14 @@
 #include "arp.h"
 #include "utils.h"
 #include "ethernet.h"
+#include "driver.h"
+#include "netif.h"
+#include "route.h"
 #include "config.h"
 #include <string.h>
 #include <stdio.h>
 #include<stdlib.h>
+#include <errno.h>
 
 /**
  * @brief 初始的arp包
@@ -20,24 +24,326 @@ static const arp_pkt_t arp_init_pkt = {
     .target_mac = {0}};
 
 /**
- * @brief arp地址转换表
+ * @brief arp地址转换表，表项按分配先后连续存放，容量在运行时确定
  * 
  */
-arp_entry_t arp_table[ARP_MAX_ENTRY];
+arp_entry_t *arp_table;
+int arp_table_size = ARP_MAX_ENTRY;
 
 /**
- * @brief 长度为1的arp分组队列，当等待arp回复时暂存未发送的数据包
+ * @brief arp表的哈希索引，以ip地址为键开放定址（线性探测），
+ *        存放表项下标+1，0为空位；容量为不小于表项数2倍的2的幂
  * 
  */
-arp_buf_t arp_buf;
+static uint32_t *arp_index;
+static int arp_index_bits;
+static int arp_table_used;  //已经分配过的表项数，之后的表项从未使用
+static int arp_clock_hand;  //CLOCK淘汰的指针
+static int arp_hot_nr;      //保护段中的表项数
+
+/**
+ * @brief arp分组队列的缓冲池，等待arp回复时暂存未发送的数据包，
+ *        按目的地址链成先进先出的等待队列，挂在对应的ARP_PENDING表项上
+ * 
+ */
+arp_buf_t arp_buf[ARP_PENDING_NR];
+static int arp_buf_free;      //空闲链表的表头
+
+/**
+ * @brief 最近一次确认的对端，在confirm_until之前再收到它的ip数据包时不需要查表
+ * 
+ */
+static uint8_t arp_confirm_ip[NET_IP_LEN];
+static uint64_t arp_confirm_until;
+
+static int arp_static_nr;              //静态表项数，至少留一个表项给动态地址
+static char arp_static_path[256] = ARP_STATIC_FILE;     //静态邻居文件路径，为空时不加载
+static char arp_snapshot_path[256] = ARP_SNAPSHOT_FILE; //快照文件路径，为空时不使用
+static net_timer_t arp_snapshot_timer; //定期保存快照的定时器
+
+#define ARP_SNAPSHOT_MAGIC 0x31505241 //快照文件标识"ARP1"
+
+/**
+ * @brief 快照文件头，之后紧跟count个表项
+ * 
+ */
+typedef struct arp_snapshot_hdr
+{
+    uint32_t magic; //ARP_SNAPSHOT_MAGIC
+    uint32_t count; //表项数
+    int64_t saved;  //保存时的时间(s，time())
+} arp_snapshot_hdr_t;
+
+#pragma pack(1)
+typedef struct arp_snapshot_entry
+{
+    uint8_t ip[NET_IP_LEN];   //ip地址
+    uint8_t mac[NET_MAC_LEN]; //mac地址
+} arp_snapshot_entry_t;
+#pragma pack()
+
+/**
+ * @brief 发送数据包使用的buffer
+ * 
+ */
+static buf_t txbuf;
+
+/**
+ * @brief 计算ip地址在哈希索引中的起始位置
+ * 
+ * @param ip ip地址
+ * @return uint32_t 索引位置
+ */
+static uint32_t arp_hash(const uint8_t *ip)
+{
+    uint32_t key;
+    memcpy(&key, ip, NET_IP_LEN);
+    return (key * 0x9e3779b1u) >> (32 - arp_index_bits);
+}
+
+/**
+ * @brief 在哈希索引中查找ip地址
+ * 
+ * @param ip ip地址
+ * @return int 索引位置，未找到时为-1
+ */
+static int arp_index_find(const uint8_t *ip)
+{
+    uint32_t mask = (1u << arp_index_bits) - 1;
+    for (uint32_t pos = arp_hash(ip); arp_index[pos]; pos = (pos + 1) & mask)
+        if (memcmp(arp_table[arp_index[pos] - 1].ip, ip, NET_IP_LEN) == 0)
+            return pos;
+    return -1;
+}
+
+/**
+ * @brief 把表项加入哈希索引，调用前表项的ip地址已填好且不在索引中
+ * 
+ * @param slot 表项下标
+ */
+static void arp_index_add(int slot)
+{
+    uint32_t mask = (1u << arp_index_bits) - 1;
+    uint32_t pos = arp_hash(arp_table[slot].ip);
+    while (arp_index[pos])
+        pos = (pos + 1) & mask;
+    arp_index[pos] = slot + 1;
+}
+
+/**
+ * @brief 从哈希索引中删除一个位置，把其后同一探测链上的项前移，不留删除标记
+ * 
+ * @param pos 索引位置
+ */
+static void arp_index_del(uint32_t pos)
+{
+    uint32_t mask = (1u << arp_index_bits) - 1;
+    for (uint32_t next = (pos + 1) & mask; arp_index[next]; next = (next + 1) & mask)
+    {
+        uint32_t home = arp_hash(arp_table[arp_index[next] - 1].ip);
+        //home不在(pos, next]之间时，该项可以前移到pos
+        if (((next - home) & mask) >= ((next - pos) & mask))
+        {
+            arp_index[pos] = arp_index[next];
+            pos = next;
+        }
+    }
+    arp_index[pos] = 0;
+}
+
+/**
+ * @brief 丢弃表项等待队列中的所有数据包
+ * 
+ * @param entry 表项
+ */
+static void arp_pending_drop(arp_entry_t *entry)
+{
+    while (entry->pending_head >= 0)
+    {
+        arp_buf_t *pkt = &arp_buf[entry->pending_head];
+        entry->pending_head = pkt->next;
+        buf_free(&pkt->buf);
+        buf_free(&pkt->payload);
+        pkt->valid = 0;
+        pkt->next = arp_buf_free;
+        arp_buf_free = pkt - arp_buf;
+    }
+    entry->pending_tail = -1;
+    entry->pending_nr = 0;
+}
+
+/**
+ * @brief 按先后顺序发出表项等待队列中的所有数据包
+ *        驱动发送队列已满时停下，剩余的数据包留在队列中，
+ *        ARP_TX_RETRY_MS后由表项的定时器再次发送（见arp_timeout()）
+ * 
+ * @param entry 已解析的表项
+ * @return int 全部发出为0，队列中仍有数据包为DRIVER_TX_BUSY
+ */
+static int arp_pending_flush(arp_entry_t *entry)
+{
+    while (entry->pending_head >= 0)
+    {
+        arp_buf_t *pkt = &arp_buf[entry->pending_head];
+        if (ethernet_out(&pkt->buf, entry->mac, pkt->protocol) == DRIVER_TX_BUSY)
+        {
+            timer_mod(&entry->timer, timer_now() + ARP_TX_RETRY_MS);
+            return DRIVER_TX_BUSY;
+        }
+        entry->pending_head = pkt->next;
+        buf_free(&pkt->buf); //已发出或无法发出，归还缓冲块
+        buf_free(&pkt->payload);
+        pkt->valid = 0;
+        pkt->next = arp_buf_free;
+        arp_buf_free = pkt - arp_buf;
+        entry->pending_nr--;
+    }
+    entry->pending_tail = -1;
+    return 0;
+}
+
+/**
+ * @brief 把数据包放入分组队列的缓冲，不复制数据
+ *        分散/聚集链（协议头段 + 引用负载的段，见ip_fragment_out()）的两段分别共享各自的缓冲块，
+ *        缓冲中的协议头段接到缓冲自己的负载段上，不再引用发送者的链，发送者可以立即重用它的协议头段
+ * 
+ * @param pkt 分组队列的缓冲
+ * @param buf 要暂存的数据包
+ */
+static void arp_buf_hold(arp_buf_t *pkt, buf_t *buf)
+{
+    buf_t *next = buf->next;
+    buf->next = NULL; //只克隆协议头段，否则buf_clone()会把整条链拷贝成一段
+    buf_clone(&pkt->buf, buf);
+    buf->next = next;
+    if (next)
+    {
+        buf_clone(&pkt->payload, next);
+        pkt->buf.next = &pkt->payload;
+    }
+}
+
+/**
+ * @brief 从arp表中删除一个表项，丢弃其等待的数据包
+ * 
+ * @param entry 表项
+ */
+static void arp_remove(arp_entry_t *entry)
+{
+    timer_del(&entry->timer);
+    arp_pending_drop(entry);
+    arp_index_del(arp_index_find(entry->ip));
+    entry->state = ARP_INVALID;
+    if (entry->hot)
+        arp_hot_nr--;
+    entry->hot = 0;
+}
+
+/**
+ * @brief 分配一个表项
+ *        先使用从未用过的表项；表满后按2Q的思路分段淘汰：新表项先在试用段中，
+ *        发送时第二次命中才升入保护段（见arp_lookup()）。
+ *        CLOCK指针扫过的表项若无效则直接复用，试用表项直接淘汰，保护段的表项跳过；
+ *        转过一整圈都没有试用表项时，保护段按CLOCK淘汰：访问位为1则清零并给予第二次机会，否则淘汰。
+ *        因此大量只出现一次的地址（如arp洪泛）只会在试用段中相互淘汰，不会挤出正在使用的下一跳
+ * 
+ * @return int 表项下标，已从哈希索引中移除
+ */
+static int arp_alloc()
+{
+    if (arp_table_used < arp_table_size)
+        return arp_table_used++;
+    for (int n = 0;; n++)
+    {
+        int slot = arp_clock_hand;
+        arp_entry_t *entry = &arp_table[slot];
+        arp_clock_hand = (arp_clock_hand + 1) % arp_table_size;
+        if (entry->state == ARP_INVALID)
+            return slot;
+        if (entry->is_static || (entry->hot && n < arp_table_size))
+            continue;
+        if (entry->hot && entry->ref)
+        {
+            entry->ref = 0;
+            continue;
+        }
+        arp_remove(entry);
+        return slot;
+    }
+}
+
+static void arp_req(net_if_t *netif, uint8_t *target_ip, const uint8_t *target_mac);
+
+/**
+ * @brief 表项的定时器到期
+ *        ARP_PENDING时重发arp请求，第n次请求后等待ARP_MIN_INTERVAL*2^(n-1)秒，
+ *        发送ARP_MAX_RETRY次仍无应答时删除表项并丢弃等待的数据包；
+ *        ARP_VALID且等待队列因驱动发送队列已满而未发完时，继续发送，之后恢复老化定时器；
+ *        从快照恢复的未确认表项到期时向原mac地址发送单播探测，到应答期限仍未应答则删除；
+ *        其他状态下表项已老化，直接删除
+ * 
+ * @param timer 定时器
+ * @param arg 表项
+ */
+static void arp_timeout(net_timer_t *timer, void *arg)
+{
+    arp_entry_t *entry = arg;
+    if (entry->state == ARP_VALID && entry->pending_nr && !entry->unconfirmed && (entry->is_static || timer_now() < (uint64_t)entry->timeout))
+    {
+        if (arp_pending_flush(entry) == 0 && !entry->is_static)
+            timer_mod(timer, entry->timeout);
+        return;
+    }
+    if (entry->state == ARP_VALID && entry->unconfirmed && (entry->retries == 0 || timer_now() < (uint64_t)entry->timeout))
+    {
+        if (entry->retries == 0)
+        {
+            entry->retries = 1;
+            arp_req(net_if_get(entry->if_index), entry->ip, entry->mac);
+        }
+        timer_mod(timer, entry->timeout);
+        return;
+    }
+    if (entry->state != ARP_PENDING || entry->retries >= ARP_MAX_RETRY)
+    {
+        arp_remove(entry);
+        return;
+    }
+    entry->retries++;
+    arp_req(net_if_get(entry->if_index),entry->ip,NULL);
+    timer_mod(timer, timer_now() + ((uint64_t)ARP_MIN_INTERVAL * 1000 << (entry->retries - 1)));
+}
+
+/**
+ * @brief 通过哈希索引找到ip地址对应的表项，不存在时分配一个新表项（状态为ARP_INVALID），
+ *        表满时按CLOCK算法淘汰（见arp_alloc()）
+ * 
+ * @param ip ip地址
+ * @return arp_entry_t* 表项
+ */
+static arp_entry_t *arp_get(const uint8_t *ip)
+{
+    int pos = arp_index_find(ip);
+    if (pos >= 0)
+        return &arp_table[arp_index[pos] - 1];
+    int slot = arp_alloc();
+    arp_entry_t *entry = &arp_table[slot];
+    memcpy(entry->ip, ip, NET_IP_LEN);
+    entry->ref = 0;
+    entry->hot = 0;
+    entry->is_static = 0;
+    entry->unconfirmed = 0;
+    entry->pending_nr = 0;
+    entry->pending_head = entry->pending_tail = -1;
+    timer_setup(&entry->timer, arp_timeout, entry);
+    arp_index_add(slot);
+    return entry;
+}
 
 /**
  * @brief 更新arp表
- *        你首先需要依次轮询检测ARP表中所有的ARP表项是否有超时，如果有超时，则将该表项的状态改为无效。
- *        接着，查看ARP表是否有无效的表项，如果有，则将arp_update()函数传递进来的新的IP、MAC信息插入到表中，
- *        并记录超时时间，更改表项的状态为有效。
- *        如果ARP表中没有无效的表项，则找到超时时间最长的一条表项，
- *        将arp_update()函数传递进来的新的IP、MAC信息替换该表项，并记录超时时间，设置表项的状态为有效。
+ *        通过哈希索引找到ip地址对应的表项并更新，不存在时分配一个新表项（见arp_get()）
+ *        表项变为有效时，按先后顺序发出等待该地址解析的数据包
  * 
  * @param ip ip地址
  * @param mac mac地址
@@ -46,71 +352,70 @@ arp_buf_t arp_buf;
 void arp_update(uint8_t *ip, uint8_t *mac, arp_state_t state)
 {
     // TODO
-    time_t now;
-    //当前时间  单位为s
-    time(&now);
-    // 轮询检测ARP表中所有的ARP表项是否有超时，如果有超时，则将该表项的状态改为无效。
-    for(int i=0;i<ARP_MAX_ENTRY;i++){
-        //timeout记录的是当前时间
-        //如果now - arp_table[i].timeout > ARP_TIMEOUT_SEC
-        //可设为INVALID
-        //即丢弃
-        if(now -arp_table[i].timeout > ARP_TIMEOUT_SEC){
-            arp_table[i].state=ARP_INVALID;
-        }
+    arp_entry_t *entry = arp_get(ip);
+    if (entry->is_static)
+        return;
+    memcpy(entry->mac, mac, NET_MAC_LEN);
+    entry->state = state;
+    entry->unconfirmed = 0;
+    entry->timeout = timer_now() + ARP_TIMEOUT_SEC * 1000;
+    timer_mod(&entry->timer, entry->timeout);
+    if (state == ARP_VALID)
+        arp_pending_flush(entry);
+}
+
+/**
+ * @brief 收到对端的ip数据包时确认邻居仍然可达
+ *        只在已有的有效表项临近过期（剩余时间少于ARP_CONFIRM_SEC）时刷新，不新建表项，不接受mac地址的变化；
+ *        从快照恢复的未确认表项只由单播探测的应答确认（见arp_timeout()）；
+ *        连续收到同一对端的数据包时只比较一次ip地址，稳定接收时不查表
+ * 
+ * @param ip 对端ip地址
+ * @param mac 对端mac地址
+ */
+void arp_confirm(const uint8_t *ip, const uint8_t *mac)
+{
+    uint64_t now = timer_now();
+    if (now < arp_confirm_until && memcmp(ip, arp_confirm_ip, NET_IP_LEN) == 0)
+        return;
+    memcpy(arp_confirm_ip, ip, NET_IP_LEN);
+    int pos = arp_index_find(ip);
+    arp_entry_t *entry = pos >= 0 ? &arp_table[arp_index[pos] - 1] : NULL;
+    if (entry == NULL || entry->state != ARP_VALID || entry->is_static || entry->pending_nr || entry->unconfirmed || memcmp(entry->mac, mac, NET_MAC_LEN))
+    {
+        arp_confirm_until = now + (uint64_t)ARP_MIN_INTERVAL * 1000; //未知的对端，限制查表的频率
+        return;
     }
-    //查看ARP表是否有无效的表项
-    //如果有，则将arp_update()函数传递进来的新的IP、MAC信息插入到表中，
-    //并记录超时时间，更改表项的状态为有效。
-    for(int i=0;i<ARP_MAX_ENTRY;i++){
-        //找到无效表项
-        if(arp_table[i].state == ARP_INVALID){
-            //更新
-            for(int j=0;j<4;j++)
-                arp_table[i].ip[j]=ip[j];
-            for(int j=0;j<6;j++)
-                arp_table[i].mac[j]=mac[j];
-            arp_table[i].state=ARP_VALID;
-            arp_table[i].timeout = now;
-            return;
-        }
+    if ((uint64_t)entry->timeout < now + (uint64_t)ARP_CONFIRM_SEC * 1000)
+    {
+        entry->timeout = now + ARP_TIMEOUT_SEC * 1000;
+        timer_mod(&entry->timer, entry->timeout);
     }
-    // 如果ARP表中没有无效的表项
-    // 则把timeout最小的项目丢弃
-    // 即最早进来的项目
-    int min_index=0;
-    // time_t为64位 
-    time_t min=((long)1<<62);
-    // 找到timeout最小的项目
-    for(int i=0;i<ARP_MAX_ENTRY;i++){
-        if(arp_table[i].timeout<min){
-            min_index=i;
-            min = arp_table[i].timeout;
-        } 
-    }
-    //更新
-    for(int i=0;i<4;i++)
-        arp_table[min_index].ip[i]=ip[i];
-    for(int i=0;i<6;i++)
-        arp_table[min_index].mac[i]=mac[i];
-    arp_table[min_index].state=ARP_VALID;
-    arp_table[min_index].timeout=now;
-    return;
-
+    arp_confirm_until = entry->timeout - (uint64_t)ARP_CONFIRM_SEC * 1000;
 }
 
 /**
- * @brief 从arp表中根据ip地址查找mac地址
+ * @brief 从arp表中根据ip地址查找有效表项，命中时置访问位，
+ *        访问位已为1（第二次命中）且保护段未满ARP_HOT_PCT%时升入保护段
  * 
  * @param ip 欲转换的ip地址
- * @return uint8_t* mac地址，未找到时为NULL
+ * @return arp_entry_t* 表项，未找到时为NULL（超时的表项已由定时器删除）
  */
-static uint8_t *arp_lookup(uint8_t *ip)
+static arp_entry_t *arp_lookup(uint8_t *ip)
 {
-    for (int i = 0; i < ARP_MAX_ENTRY; i++)
-        if (arp_table[i].state == ARP_VALID && memcmp(arp_table[i].ip, ip, NET_IP_LEN) == 0)
-            return arp_table[i].mac;
-    return NULL;
+    int pos = arp_index_find(ip);
+    if (pos < 0)
+        return NULL;
+    arp_entry_t *entry = &arp_table[arp_index[pos] - 1];
+    if (entry->state != ARP_VALID)
+        return NULL;
+    if (entry->ref && !entry->hot && !entry->is_static && arp_hot_nr * 100 < arp_table_size * ARP_HOT_PCT)
+    {
+        entry->hot = 1;
+        arp_hot_nr++;
+    }
+    entry->ref = 1;
+    return entry;
 }
 
 /**
@@ -118,13 +423,19 @@ static uint8_t *arp_lookup(uint8_t *ip)
  *        你需要调用buf_init对txbuf进行初始化
  *        填写ARP报头，将ARP的opcode设置为ARP_REQUEST，注意大小端转换
  *        将ARP数据报发送到ethernet层
+ *        从netif发出，源地址为netif上与目标同一子网的地址
  * 
+ * @param netif 发送请求的网卡
  * @param target_ip 想要知道的目标的ip地址
+ * @param target_mac 单播探测已知的mac地址时为该地址，为NULL时广播
  */
-static void arp_req(uint8_t *target_ip)
+static void arp_req(net_if_t *netif, uint8_t *target_ip, const uint8_t *target_mac)
 {
     // TODO
     buf_init(&txbuf,28);
+    txbuf.if_index = netif->index;
+    //免费arp以目标地址本身为源地址
+    const uint8_t *src_ip = net_if_local(target_ip)==netif ? target_ip : net_if_src(netif,target_ip);
     uint8_t *p = txbuf.data;
     //硬件类型
     p[0]=0x00;
@@ -141,11 +452,11 @@ static void arp_req(uint8_t *target_ip)
     p[7]=0x01;
     //源MAC地址
     for(int i=0;i<6;i++){
-        p[8+i]=net_if_mac[i];
+        p[8+i]=netif->mac[i];
     }
     //源IP地址
     for(int i=0;i<4;i++){
-        p[14+i]=net_if_ip[i];
+        p[14+i]=src_ip[i];
     }
     //目的MAC地址
     for(int i=0;i<6;i++){
@@ -155,7 +466,7 @@ static void arp_req(uint8_t *target_ip)
     for(int i=0;i<4;i++){
         p[24+i]=target_ip[i];
     }
-    ethernet_out(&txbuf,ether_broadcast_mac,NET_PROTOCOL_ARP);
+    ethernet_out(&txbuf,target_mac ? target_mac : ether_broadcast_mac,NET_PROTOCOL_ARP); //发不出时由定时器重发
     
 }
 /**
@@ -163,14 +474,16 @@ static void arp_req(uint8_t *target_ip)
  *        你首先需要做报头检查，查看报文是否完整，
  *        检查项包括：硬件类型，协议类型，硬件地址长度，协议地址长度，操作类型
  *        
- *        接着，调用arp_update更新ARP表项
+ *        接着，按RFC 826的合并规则更新ARP表：发送方已有表项时调用arp_update更新；
+ *        没有表项时，只有询问收到它的网卡上的地址才新建表项，与本机无关的arp报文（如arp洪泛）不占用表项
  *        查看arp_buf是否有效，如果有效，则说明ARP分组队列里面有待发送的数据包。
  *        即上一次调用arp_out()发送来自IP层的数据包时，由于没有找到对应的MAC地址进而先发送的ARP request报文
  *        此时，收到了该request的应答报文。然后，根据IP地址来查找ARM表项，如果能找到该IP地址对应的MAC地址，
  *        则将缓存的数据包arp_buf再发送到ethernet层。
  * 
- *        如果arp_buf无效，还需要判断接收到的报文是否为request请求报文，并且，该请求报文的目的IP正好是本机的IP地址，
- *        则认为是请求本机MAC地址的ARP请求报文，则回应一个响应报文（应答报文）。
+ *        如果arp_buf无效，还需要判断接收到的报文是否为request请求报文，并且，该请求报文的目的IP正好是
+ *        收到它的网卡上的某个IP地址，则认为是请求本机MAC地址的ARP请求报文，则回应一个响应报文（应答报文）。
+ *        其他网卡上的地址不回应，以免一块网卡替另一块网卡的地址应答。
  *        响应报文：需要调用buf_init初始化一个buf，填写ARP报头，目的IP和目的MAC需要填写为收到的ARP报的源IP和源MAC。
  * 
  * @param buf 要处理的数据包
@@ -178,21 +491,9 @@ static void arp_req(uint8_t *target_ip)
 void arp_in(buf_t *buf)
 {
     // TODO
-    // UDP实验新增
-    // 将eth帧头加回来
-    buf_add_header(buf,14);
-    uint8_t *p=buf->data;
-    if(p[12]==0x08 && p[13]==0x00){//p此时指向以太网帧头
-        //为IP
-        //printf("仅供测试使用，表示收到ip也更新了arp_table\n");
-        if(arp_lookup(p+14+12) == NULL)
-            arp_update(p+14+12,p+6,ARP_VALID);
-        buf_remove_header(buf,14);
+    uint8_t *p = buf->data;
+    if(buf->len < 28)
         return;
-    }
-    buf_remove_header(buf,14);
-    //以下为原有
-    p = buf->data;
     //p指向data
     //p[0]~p[7]为ARP报头
     //p[8]~p[13]为源MAC
@@ -211,32 +512,20 @@ void arp_in(buf_t *buf)
     //协议地址长度
     if(!(p[5]==0x04))
         return;    
-    //更新
-    arp_update(p+14,p+8,ARP_VALID);
-    //操作类型    
-    //应答报文
-    if(p[6]==0x00 && p[7]==0x02){
-        //更新ARP表项
-        //查看arp_buf是否有效
-        if(arp_buf.valid==1){
-            //如果有效，则把buf发送，并将valid置为0
-            arp_buf.valid=0;
-            arp_out(&(arp_buf.buf),arp_buf.ip,arp_buf.protocol);
-            return;
-        }
-    }
+    //目标IP是不是收到它的网卡的IP
+    net_if_t *netif = net_if_local(p+24);
+    int for_me = netif!=NULL && netif->index==buf->if_index;
+    //更新，等待该地址解析的数据包随之按顺序发出
+    if(for_me || arp_index_find(p+14) >= 0)
+        arp_update(p+14,p+8,ARP_VALID);
     //request请求报文
     if(p[6]==0x00 && p[7]==0x01){
-        for(int i=0;i<4;i++){
-            //判断请求报文请求IP的是不是本机IP
-            if(!(p[24+i]==net_if_ip[i])){
-                return;
-            }
-                
-        }
+        if(!for_me)
+            return;
         //如果请求报文请求的IP是本机IP
         //则发送响应报文
         buf_init(&txbuf,28);
+        txbuf.if_index = netif->index;
         uint8_t *p2 = txbuf.data;
         //硬件类型
         p2[0]=0x00;
@@ -253,11 +542,11 @@ void arp_in(buf_t *buf)
         p2[7]=0x02;
         //源MAC地址
         for(int i=0;i<6;i++){
-            p2[8+i]=net_if_mac[i];
+            p2[8+i]=netif->mac[i];
         }
-        //源IP地址
+        //源IP地址，即被请求的地址
         for(int i=0;i<4;i++){
-            p2[14+i]=net_if_ip[i];
+            p2[14+i]=p[24+i];
         }
         //目的MAC地址
         for(int i=0;i<6;i++){
@@ -267,7 +556,7 @@ void arp_in(buf_t *buf)
         for(int i=0;i<4;i++){
             p2[24+i]=p[14+i];
         }
-        ethernet_out(&txbuf,p+8,NET_PROTOCOL_ARP);    
+        ethernet_out(&txbuf,p+8,NET_PROTOCOL_ARP); //发不出时由请求方重发
     }
     
 
@@ -277,40 +566,339 @@ void arp_in(buf_t *buf)
  * @brief 处理一个要发送的数据包
  *        你需要根据IP地址来查找ARP表
  *        如果能找到该IP地址对应的MAC地址，则将数据报直接发送给ethernet层
- *        如果没有找到对应的MAC地址，则需要先发一个ARP request报文。
- *        注意，需要将来自IP层的数据包缓存到arp_buf中，等待arp_in()能收到ARP request报文的应答报文
+ *        如果没有找到对应的MAC地址，则把数据包挂到该地址的等待队列上（共享缓冲块，不复制），
+ *        表项进入ARP_PENDING状态并发出第一个arp请求；已在解析中的地址不再重复发送请求，
+ *        由表项的定时器按退避间隔重发（见arp_timeout()）。等待队列已满时丢弃该数据包
+ * 
+ *        已解析的地址还有因驱动发送队列已满而积压的数据包时，先发送积压的；
+ *        仍未发完时把该数据包排在其后，保持发送顺序
  * 
  * @param buf 要处理的数据包
  * @param ip 目标ip地址
  * @param protocol 上层协议
+ * @return int 已发出或已排入等待队列为0，驱动发送队列已满为DRIVER_TX_BUSY，丢弃为-1
  */
-void arp_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol)
+int arp_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol)
 {
     // TODO
     //查找ARP表
-    uint8_t *mac = arp_lookup(ip);
+    arp_entry_t *entry = arp_lookup(ip);
     //找到了IP对于的MAC
-    if(mac){
-        ethernet_out(buf,mac,protocol);
-    }else{//没找到
-        //将该报文放到buf中，并将buf的valid置为1
-        arp_buf.valid=1;
-        arp_buf.protocol=protocol;
-        for(int i=0;i<4;i++)
-            arp_buf.ip[i]=ip[i];
-        arp_buf.buf=*buf;
-        arp_req(ip);
+    if(entry && (entry->pending_nr == 0 || arp_pending_flush(entry) == 0))
+        return ethernet_out(buf,entry->mac,protocol);
+    //没找到
+    if(entry == NULL){
+        entry = arp_get(ip);
+        if(entry->state != ARP_PENDING){
+            entry->state = ARP_PENDING;
+            entry->retries = 0;
+            entry->if_index = buf->if_index; //重发的请求也从这块网卡发出
+        }
+    }
+    //等待队列已满：已解析的地址是在等驱动，否则丢弃
+    int ret = entry->state == ARP_VALID ? DRIVER_TX_BUSY : -1;
+    //挂到等待队列的队尾
+    if(entry->pending_nr < ARP_PENDING_MAX && arp_buf_free >= 0){
+        ret = 0;
+        arp_buf_t *pkt = &arp_buf[arp_buf_free];
+        arp_buf_free = pkt->next;
+        pkt->valid=1;
+        pkt->protocol=protocol;
+        memcpy(pkt->ip,ip,NET_IP_LEN);
+        arp_buf_hold(pkt,buf); //共享缓冲块，不复制数据
+        pkt->next=-1;
+        if(entry->pending_tail >= 0)
+            arp_buf[entry->pending_tail].next = pkt - arp_buf;
+        else
+            entry->pending_head = pkt - arp_buf;
+        entry->pending_tail = pkt - arp_buf;
+        entry->pending_nr++;
+    }
+    //第一个数据包触发arp请求，之后的由定时器限速重发
+    if(entry->state == ARP_PENDING && entry->retries == 0){
+        entry->retries = 1;
+        arp_req(net_if_get(entry->if_index),ip,NULL);
+        timer_mod(&entry->timer, timer_now() + (uint64_t)ARP_MIN_INTERVAL * 1000);
+    }
+    return ret;
+}
+
+/**
+ * @brief 从静态邻居文件加载永久表项
+ *        文件每行为"ip mac"，如"192.168.127.1 00:11:22:33:44:55"，#开头的行为注释
+ * 
+ * @param path 文件路径
+ * @return int 加载的表项数，文件不存在时为0，失败为-1
+ */
+int arp_load_static(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (f == NULL)
+    {
+        if (errno == ENOENT)
+            return 0;
+        fprintf(stderr, "Error in arp_load_static: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    char line[128];
+    int nr = 0, lineno = 0;
+    while (fgets(line, sizeof(line), f))
+    {
+        uint8_t ip[NET_IP_LEN], mac[NET_MAC_LEN];
+        char c;
+        lineno++;
+        if (sscanf(line, " %c", &c) != 1 || c == '#')
+            continue;
+        if (sscanf(line, "%hhu.%hhu.%hhu.%hhu %hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &ip[0], &ip[1], &ip[2], &ip[3],
+                   &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]) != 10)
+        {
+            fprintf(stderr, "Error in arp_load_static: %s:%d: invalid line\n", path, lineno);
+            continue;
+        }
+        arp_entry_t *entry = arp_get(ip);
+        if (!entry->is_static)
+        {
+            if (arp_static_nr >= arp_table_size - 1)
+            {
+                fprintf(stderr, "Error in arp_load_static: %s:%d: arp table full\n", path, lineno);
+                break;
+            }
+            arp_static_nr++;
+        }
+        timer_del(&entry->timer);
+        memcpy(entry->mac, mac, NET_MAC_LEN);
+        entry->state = ARP_VALID;
+        entry->is_static = 1;
+        entry->timeout = 0;
+        arp_pending_flush(entry);
+        nr++;
+    }
+    fclose(f);
+    return nr;
+}
+
+/**
+ * @brief 把arp表中的有效表项保存为快照文件
+ *        先写入临时文件再改名，保存中途退出不会留下不完整的快照
+ * 
+ * @param path 文件路径
+ * @return int 保存的表项数，失败为-1
+ */
+int arp_save(const char *path)
+{
+    char tmp[sizeof(arp_snapshot_path) + 8];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "wb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "Error in arp_save: %s: %s\n", tmp, strerror(errno));
+        return -1;
+    }
+    arp_snapshot_hdr_t hdr = {.magic = ARP_SNAPSHOT_MAGIC, .count = 0, .saved = time(NULL)};
+    fwrite(&hdr, sizeof(hdr), 1, f);
+    for (int i = 0; i < arp_table_used; i++)
+    {
+        //静态表项由静态邻居文件提供，不写入快照
+        if (arp_table[i].state != ARP_VALID || arp_table[i].is_static)
+            continue;
+        arp_snapshot_entry_t e;
+        memcpy(e.ip, arp_table[i].ip, NET_IP_LEN);
+        memcpy(e.mac, arp_table[i].mac, NET_MAC_LEN);
+        fwrite(&e, sizeof(e), 1, f);
+        hdr.count++;
+    }
+    rewind(f);
+    fwrite(&hdr, sizeof(hdr), 1, f);
+    int err = ferror(f);
+    if (fclose(f) != 0 || err || rename(tmp, path) == -1)
+    {
+        fprintf(stderr, "Error in arp_save: %s: %s\n", path, strerror(errno));
+        remove(tmp);
+        return -1;
+    }
+    return hdr.count;
+}
+
+/**
+ * @brief 从快照文件恢复arp表
+ *        恢复的表项立即可用，但在收到对端的arp报文前是未确认的：各表项依次相隔ARP_PROBE_GAP_MS
+ *        向原mac地址发送单播arp请求，之后ARP_MIN_INTERVAL秒内没有应答时删除（见arp_timeout()），
+ *        不会长时间使用已经变化的mac地址；超过ARP_TIMEOUT_SEC的快照直接忽略
+ * 
+ * @param path 文件路径
+ * @return int 恢复的表项数，文件不存在时为0，失败为-1
+ */
+int arp_load(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        if (errno == ENOENT)
+            return 0;
+        fprintf(stderr, "Error in arp_load: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    arp_snapshot_hdr_t hdr;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 || hdr.magic != ARP_SNAPSHOT_MAGIC)
+    {
+        fprintf(stderr, "Error in arp_load: %s: invalid snapshot\n", path);
+        fclose(f);
+        return -1;
+    }
+    int64_t age = (int64_t)time(NULL) - hdr.saved;
+    int nr = 0;
+    arp_snapshot_entry_t e;
+    for (uint32_t i = 0; age >= 0 && age <= ARP_TIMEOUT_SEC && i < hdr.count && fread(&e, sizeof(e), 1, f) == 1; i++)
+    {
+        arp_entry_t *entry = arp_get(e.ip);
+        if (entry->state != ARP_INVALID)
+            continue; //已有的表项（如静态表项）优先
+        route_entry_t *r = route_lookup(e.ip);
+        uint64_t probe = timer_now() + (uint64_t)(nr + 1) * ARP_PROBE_GAP_MS;
+        memcpy(entry->mac, e.mac, NET_MAC_LEN);
+        entry->state = ARP_VALID;
+        entry->unconfirmed = 1;
+        entry->retries = 0;
+        entry->if_index = r ? r->if_index : 0;
+        entry->timeout = probe + ARP_MIN_INTERVAL * 1000; //探测的应答期限
+        timer_mod(&entry->timer, probe);
+        nr++;
     }
+    fclose(f);
+    return nr;
+}
+
+/**
+ * @brief 定期保存快照
+ * 
+ * @param timer 定时器
+ * @param arg 未使用
+ */
+static void arp_snapshot_timeout(net_timer_t *timer, void *arg)
+{
+    (void)arg;
+    arp_save(arp_snapshot_path);
+    timer_mod(timer, timer_now() + ARP_SNAPSHOT_SEC * 1000);
+}
+
+/**
+ * @brief 使用快照文件：启动时恢复，之后每ARP_SNAPSHOT_SEC秒及arp_close()时保存
+ * 
+ */
+static void arp_persist()
+{
+    arp_load(arp_snapshot_path);
+    timer_setup(&arp_snapshot_timer, arp_snapshot_timeout, NULL);
+    timer_mod(&arp_snapshot_timer, timer_now() + ARP_SNAPSHOT_SEC * 1000);
+}
+
+/**
+ * @brief 关闭arp协议，保存快照
+ * 
+ */
+void arp_close()
+{
+    if (arp_snapshot_path[0] == 0)
+        return;
+    timer_del(&arp_snapshot_timer);
+    arp_save(arp_snapshot_path);
 }
 
 /**
- * @brief 初始化arp协议
+ * @brief 设置arp表的容量，需在arp_init()前调用
+ * 
+ * @param nr 表项数
+ * @return int 成功为0，失败为-1
+ */
+int arp_set_size(int nr)
+{
+    if (nr <= 0 || nr > (1 << 24))
+    {
+        fprintf(stderr, "Error in arp_set_size: invalid size %d\n", nr);
+        return -1;
+    }
+    free(arp_table);
+    free(arp_index);
+    arp_table = NULL;
+    arp_index = NULL;
+    arp_table_size = nr;
+    return 0;
+}
+
+/**
+ * @brief 设置静态邻居文件，需在arp_init()前调用
+ * 
+ * @param path 文件路径，为""时不加载
+ * @return int 成功为0，路径过长为-1
+ */
+int arp_set_static_file(const char *path)
+{
+    if (strlen(path) >= sizeof(arp_static_path))
+    {
+        fprintf(stderr, "Error in arp_set_static_file: path too long\n");
+        return -1;
+    }
+    strcpy(arp_static_path, path);
+    return 0;
+}
+
+/**
+ * @brief 设置arp表快照文件，需在arp_init()前调用
+ * 
+ * @param path 文件路径，为""时不使用快照
+ * @return int 成功为0，路径过长为-1
+ */
+int arp_set_snapshot_file(const char *path)
+{
+    if (strlen(path) >= sizeof(arp_snapshot_path))
+    {
+        fprintf(stderr, "Error in arp_set_snapshot_file: path too long\n");
+        return -1;
+    }
+    strcpy(arp_snapshot_path, path);
+    return 0;
+}
+
+/**
+ * @brief 初始化arp协议，加载静态邻居文件与arp表快照
  * 
  */
 void arp_init()
 {
-    for (int i = 0; i < ARP_MAX_ENTRY; i++)
+    if (arp_table == NULL)
+    {
+        for (arp_index_bits = 1; (1 << arp_index_bits) < arp_table_size * 2; arp_index_bits++)
+            ;
+        arp_table = calloc(arp_table_size, sizeof(arp_entry_t));
+        arp_index = calloc(1 << arp_index_bits, sizeof(uint32_t));
+        if (arp_table == NULL || arp_index == NULL)
+        {
+            fprintf(stderr, "Error in arp_init: out of memory\n");
+            exit(1);
+        }
+    }
+    for (int i = 0; i < arp_table_size; i++)
         arp_table[i].state = ARP_INVALID;
-    arp_buf.valid = 0;
-    arp_req(net_if_ip);
+    memset(arp_index, 0, sizeof(uint32_t) << arp_index_bits);
+    arp_table_used = 0;
+    arp_clock_hand = 0;
+    arp_hot_nr = 0;
+    arp_static_nr = 0;
+    for (int i = 0; i < ARP_PENDING_NR; i++)
+    {
+        arp_buf[i].valid = 0;
+        arp_buf[i].next = i + 1 < ARP_PENDING_NR ? i + 1 : -1;
+    }
+    arp_buf_free = 0;
+    //每个地址发送一个免费arp
+    for (int i = 0; i < net_if_nr; i++)
+    {
+        net_if_t *netif = net_if_get(i);
+        for (int j = 0; j < netif->addr_nr; j++)
+            arp_req(netif, netif->addr[j].ip, NULL);
+    }
+    if (arp_static_path[0])
+        arp_load_static(arp_static_path); //静态邻居
+    if (arp_snapshot_path[0])
+        arp_persist(); //恢复上次退出时的arp表，不必重新解析
 }
\ No newline at end of file
@@ -0,0 +1,361 @@
+#include "checksum.h"
+#include "config.h"
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CSUM_X86 1
+#endif
+
+#define CSUM_SIMD_MIN 64           //短于该长度的数据直接用标量实现，避免向量化的固定开销
+#define CSUM_SIMD_BLOCK (1 << 14)  //向量实现每处理该数量的向量，把32位累加器并入64位累加器，防止溢出
+
+/**
+ * @brief 把64位累加结果折叠为32位部分和
+ * 
+ * @param sum 64位累加结果
+ * @return uint32_t 部分和
+ */
+static inline uint32_t csum_fold64(uint64_t sum)
+{
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    sum = (sum & 0xffffffff) + (sum >> 32);
+    return (uint32_t)sum;
+}
+
+/**
+ * @brief 64位标量实现，每次取8字节按两个32位数累加，再处理剩余的4、2、1字节
+ * 
+ * @param p 数据
+ * @param len 字节数
+ * @return uint64_t 按本机字节序累加的结果
+ */
+static uint64_t csum_scalar64(const uint8_t *p, int len)
+{
+    uint64_t sum = 0, w;
+    for (; len >= 8; p += 8, len -= 8)
+    {
+        memcpy(&w, p, 8);
+        sum += (uint32_t)w;
+        sum += w >> 32;
+    }
+    if (len >= 4)
+    {
+        uint32_t w32;
+        memcpy(&w32, p, 4);
+        sum += w32;
+        p += 4;
+        len -= 4;
+    }
+    if (len >= 2)
+    {
+        uint16_t w16;
+        memcpy(&w16, p, 2);
+        sum += w16;
+        p += 2;
+        len -= 2;
+    }
+    if (len)
+    {
+        uint8_t tail[2] = {p[0], 0}; //奇数长度，最后一个字节后补0
+        uint16_t w16;
+        memcpy(&w16, tail, 2);
+        sum += w16;
+    }
+    return sum;
+}
+
+/**
+ * @brief 64位标量的拷贝并求和实现，每次拷贝8字节并累加
+ * 
+ * @param dst 目的内存
+ * @param p 数据
+ * @param len 字节数
+ * @return uint64_t 按本机字节序累加的结果
+ */
+static uint64_t csum_copy_scalar64(uint8_t *dst, const uint8_t *p, int len)
+{
+    uint64_t sum = 0, w;
+    for (; len >= 8; p += 8, dst += 8, len -= 8)
+    {
+        memcpy(&w, p, 8);
+        memcpy(dst, &w, 8);
+        sum += (uint32_t)w;
+        sum += w >> 32;
+    }
+    memcpy(dst, p, len);
+    return sum + csum_scalar64(p, len);
+}
+
+#ifdef CSUM_X86
+/**
+ * @brief SSE2实现，每次取16字节，把8个16位字零扩展后加到4个32位累加器上
+ * 
+ * @param p 数据
+ * @param len 字节数
+ * @return uint64_t 按本机字节序累加的结果
+ */
+__attribute__((target("sse2"))) static uint64_t csum_sse2(const uint8_t *p, int len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc64 = zero;
+    while (len >= 16)
+    {
+        __m128i acc32 = zero;
+        for (int n = 0; len >= 16 && n < CSUM_SIMD_BLOCK; n++, p += 16, len -= 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)p);
+            acc32 = _mm_add_epi32(acc32, _mm_unpacklo_epi16(v, zero));
+            acc32 = _mm_add_epi32(acc32, _mm_unpackhi_epi16(v, zero));
+        }
+        acc64 = _mm_add_epi64(acc64, _mm_unpacklo_epi32(acc32, zero));
+        acc64 = _mm_add_epi64(acc64, _mm_unpackhi_epi32(acc32, zero));
+    }
+    uint64_t lane[2];
+    _mm_storeu_si128((__m128i *)lane, acc64);
+    return lane[0] + lane[1] + csum_scalar64(p, len);
+}
+
+/**
+ * @brief SSE2的拷贝并求和实现，每个向量读入后同时写出与累加
+ * 
+ * @param dst 目的内存
+ * @param p 数据
+ * @param len 字节数
+ * @return uint64_t 按本机字节序累加的结果
+ */
+__attribute__((target("sse2"))) static uint64_t csum_copy_sse2(uint8_t *dst, const uint8_t *p, int len)
+{
+    const __m128i zero = _mm_setzero_si128();
+    __m128i acc64 = zero;
+    while (len >= 16)
+    {
+        __m128i acc32 = zero;
+        for (int n = 0; len >= 16 && n < CSUM_SIMD_BLOCK; n++, p += 16, dst += 16, len -= 16)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)p);
+            _mm_storeu_si128((__m128i *)dst, v);
+            acc32 = _mm_add_epi32(acc32, _mm_unpacklo_epi16(v, zero));
+            acc32 = _mm_add_epi32(acc32, _mm_unpackhi_epi16(v, zero));
+        }
+        acc64 = _mm_add_epi64(acc64, _mm_unpacklo_epi32(acc32, zero));
+        acc64 = _mm_add_epi64(acc64, _mm_unpackhi_epi32(acc32, zero));
+    }
+    uint64_t lane[2];
+    _mm_storeu_si128((__m128i *)lane, acc64);
+    return lane[0] + lane[1] + csum_copy_scalar64(dst, p, len);
+}
+
+/**
+ * @brief AVX2实现，每次取32字节，把16个16位字零扩展后加到8个32位累加器上
+ * 
+ * @param p 数据
+ * @param len 字节数
+ * @return uint64_t 按本机字节序累加的结果
+ */
+__attribute__((target("avx2"))) static uint64_t csum_avx2(const uint8_t *p, int len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc64 = zero;
+    while (len >= 32)
+    {
+        __m256i acc32 = zero;
+        for (int n = 0; len >= 32 && n < CSUM_SIMD_BLOCK; n++, p += 32, len -= 32)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i *)p);
+            acc32 = _mm256_add_epi32(acc32, _mm256_unpacklo_epi16(v, zero));
+            acc32 = _mm256_add_epi32(acc32, _mm256_unpackhi_epi16(v, zero));
+        }
+        acc64 = _mm256_add_epi64(acc64, _mm256_unpacklo_epi32(acc32, zero));
+        acc64 = _mm256_add_epi64(acc64, _mm256_unpackhi_epi32(acc32, zero));
+    }
+    uint64_t lane[4];
+    _mm256_storeu_si256((__m256i *)lane, acc64);
+    return lane[0] + lane[1] + lane[2] + lane[3] + csum_scalar64(p, len);
+}
+
+/**
+ * @brief AVX2的拷贝并求和实现，每个向量读入后同时写出与累加
+ * 
+ * @param dst 目的内存
+ * @param p 数据
+ * @param len 字节数
+ * @return uint64_t 按本机字节序累加的结果
+ */
+__attribute__((target("avx2"))) static uint64_t csum_copy_avx2(uint8_t *dst, const uint8_t *p, int len)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    __m256i acc64 = zero;
+    while (len >= 32)
+    {
+        __m256i acc32 = zero;
+        for (int n = 0; len >= 32 && n < CSUM_SIMD_BLOCK; n++, p += 32, dst += 32, len -= 32)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i *)p);
+            _mm256_storeu_si256((__m256i *)dst, v);
+            acc32 = _mm256_add_epi32(acc32, _mm256_unpacklo_epi16(v, zero));
+            acc32 = _mm256_add_epi32(acc32, _mm256_unpackhi_epi16(v, zero));
+        }
+        acc64 = _mm256_add_epi64(acc64, _mm256_unpacklo_epi32(acc32, zero));
+        acc64 = _mm256_add_epi64(acc64, _mm256_unpackhi_epi32(acc32, zero));
+    }
+    uint64_t lane[4];
+    _mm256_storeu_si256((__m256i *)lane, acc64);
+    return lane[0] + lane[1] + lane[2] + lane[3] + csum_copy_scalar64(dst, p, len);
+}
+#endif
+
+/**
+ * @brief 校验和实现表
+ * 
+ */
+typedef struct csum_impl
+{
+    const char *name;                                        //实现名
+    uint64_t (*func)(const uint8_t *p, int len);               //求和实现
+    uint64_t (*copy)(uint8_t *dst, const uint8_t *p, int len); //拷贝并求和实现
+} csum_impl_t;
+
+static const csum_impl_t csum_impls[] = {
+#ifdef CSUM_X86
+    {"avx2", csum_avx2, csum_copy_avx2},
+    {"sse2", csum_sse2, csum_copy_sse2},
+#endif
+    {"scalar", csum_scalar64, csum_copy_scalar64},
+};
+
+static const csum_impl_t *csum_impl; //当前使用的实现，第一次计算时选择
+
+/**
+ * @brief 判断CPU是否支持某个实现
+ * 
+ * @param impl 实现
+ * @return int 支持为1
+ */
+static int csum_supported(const csum_impl_t *impl)
+{
+#ifdef CSUM_X86
+    __builtin_cpu_init();
+    if (impl->func == csum_avx2)
+        return __builtin_cpu_supports("avx2");
+    if (impl->func == csum_sse2)
+        return __builtin_cpu_supports("sse2");
+#endif
+    return 1;
+}
+
+/**
+ * @brief 选择校验和的实现，用于测试与性能对比
+ * 
+ * @param name 实现名："avx2"、"sse2"、"scalar"，为NULL时按CPU特性自动选择
+ * @return int 成功为0，不支持该实现为-1
+ */
+int csum_select(const char *name)
+{
+    for (int i = 0; i < (int)(sizeof(csum_impls) / sizeof(csum_impls[0])); i++)
+    {
+        if (name && strcmp(name, csum_impls[i].name))
+            continue;
+        if (!csum_supported(&csum_impls[i]))
+        {
+            if (name)
+                return -1;
+            continue;
+        }
+        csum_impl = &csum_impls[i]; //表按性能从高到低排列，自动选择时取第一个支持的
+        return 0;
+    }
+    return -1;
+}
+
+/**
+ * @brief 获取当前使用的校验和实现名
+ * 
+ * @return const char* 实现名
+ */
+const char *csum_impl_name()
+{
+    if (csum_impl == NULL)
+        csum_select(NULL);
+    return csum_impl->name;
+}
+
+/**
+ * @brief 伪首部部分和缓存的表项
+ * 
+ */
+typedef struct csum_pseudo_entry
+{
+    uint8_t src_ip[4];  //源ip地址
+    uint8_t dest_ip[4]; //目的ip地址
+    uint8_t protocol;   //协议号，0表示表项无效
+    uint32_t sum;       //地址与协议部分的部分和，不含长度
+} csum_pseudo_entry_t;
+
+static csum_pseudo_entry_t csum_pseudo_cache[CSUM_PSEUDO_CACHE_NR];
+
+/**
+ * @brief 计算udp/tcp伪首部（源ip、目的ip、协议、长度）的部分和
+ *        按(源ip, 目的ip, 协议)缓存地址与协议部分的和，同一对端只需再加上长度
+ * 
+ * @param src_ip 源ip地址
+ * @param dest_ip 目的ip地址
+ * @param protocol 协议号
+ * @param len 传输层报文长度
+ * @return uint32_t 部分和，与传输层报文的部分和累加后折叠即为校验和
+ */
+uint32_t csum_pseudo_partial(const uint8_t *src_ip, const uint8_t *dest_ip, uint8_t protocol, uint16_t len)
+{
+    //伪首部中的协议与长度按网络字节序各占16位
+    uint8_t proto_word[2] = {0, protocol};
+    uint8_t len_word[2] = {len >> 8, len & 0xff};
+    uint16_t w;
+    int i = (dest_ip[2] ^ dest_ip[3] ^ src_ip[3] ^ protocol) & (CSUM_PSEUDO_CACHE_NR - 1);
+    csum_pseudo_entry_t *entry = &csum_pseudo_cache[i];
+    if (entry->protocol != protocol || memcmp(entry->dest_ip, dest_ip, 4) || memcmp(entry->src_ip, src_ip, 4))
+    {
+        uint32_t sum = csum_partial(src_ip, 4, 0);
+        sum = csum_partial(dest_ip, 4, sum);
+        memcpy(&w, proto_word, 2);
+        memcpy(entry->src_ip, src_ip, 4);
+        memcpy(entry->dest_ip, dest_ip, 4);
+        entry->protocol = protocol;
+        entry->sum = csum_add(sum, w);
+    }
+    memcpy(&w, len_word, 2);
+    return csum_add(entry->sum, w);
+}
+
+/**
+ * @brief 计算一段数据的部分和，并累加到sum上
+ *        使用启动时根据CPU特性选出的实现（AVX2、SSE2或64位标量）
+ * 
+ * @param buf 数据
+ * @param len 字节数，可以为奇数，最后一个字节后补0
+ * @param sum 之前的部分和，第一段为0
+ * @return uint32_t 累加后的部分和
+ */
+uint32_t csum_partial(const void *buf, int len, uint32_t sum)
+{
+    if (csum_impl == NULL)
+        csum_select(NULL);
+    uint64_t s = len < CSUM_SIMD_MIN ? csum_scalar64(buf, len) : csum_impl->func(buf, len);
+    return csum_add(csum_fold64(s), sum);
+}
+
+/**
+ * @brief 拷贝一段数据并计算其部分和，累加到sum上
+ *        每个字节只读一次，读入后同时写出与累加，代替先memcpy再csum_partial
+ * 
+ * @param dst 目的内存，不能与src重叠
+ * @param src 数据
+ * @param len 字节数，可以为奇数，最后一个字节后补0
+ * @param sum 之前的部分和，第一段为0
+ * @return uint32_t 累加后的部分和
+ */
+uint32_t csum_partial_copy(void *dst, const void *src, int len, uint32_t sum)
+{
+    if (csum_impl == NULL)
+        csum_select(NULL);
+    uint64_t s = len < CSUM_SIMD_MIN ? csum_copy_scalar64(dst, src, len) : csum_impl->copy(dst, src, len);
+    return csum_add(csum_fold64(s), sum);
+}
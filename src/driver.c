@@ -1,112 +1,437 @@
+#define _GNU_SOURCE //sendmmsg
+#include "config.h"
+#if DRIVER_BACKEND == DRIVER_BACKEND_PCAP
 #include <pcap.h>
 #include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#ifdef __linux__
+#include <sys/socket.h>
+#endif
 #include "utils.h"
-#include "config.h"
 #include "driver.h"
 
-static pcap_t *pcap;
 static char pcap_errbuf[PCAP_ERRBUF_SIZE];
 
+/**
+ * @brief 发送队列中的一帧
+ * 
+ */
+typedef struct driver_tx_slot
+{
+    uint16_t len;                      //帧长度
+    uint8_t data[DRIVER_TX_FRAME_MAX]; //帧内容
+} driver_tx_slot_t;
+
+/**
+ * @brief 驱动配置对应的libpcap参数
+ * 
+ */
+typedef struct driver_profile
+{
+    int immediate;   //是否开启立即模式
+    int timeout;     //读超时(ms)，非立即模式下内核攒批的最长时间
+    int buffer_size; //内核接收缓冲区大小
+} driver_profile_t;
+
+static const driver_profile_t profiles[] = {
+    [DRIVER_PROFILE_LATENCY] = {.immediate = 1, .timeout = 1, .buffer_size = DRIVER_LATENCY_BUFFER_SIZE},
+    [DRIVER_PROFILE_THROUGHPUT] = {.immediate = 0, .timeout = DRIVER_THROUGHPUT_TIMEOUT, .buffer_size = DRIVER_THROUGHPUT_BUFFER_SIZE},
+};
+static int profile = DRIVER_PROFILE; //当前使用的驱动配置
+
+/**
+ * @brief 一块打开的网卡的驱动实例
+ * 
+ */
+struct driver
+{
+    net_if_t *netif;                                //所属网卡
+    pcap_t *pcap;                                   //libpcap描述符
+    uint32_t netmask;                               //网卡的子网掩码，编译过滤表达式时使用
+    driver_tx_slot_t tx_queue[DRIVER_TX_QUEUE_LEN]; //发送队列
+    int tx_cnt;                                     //发送队列中的帧数
+    buf_t rx_borrow;                                //零拷贝接收时传给回调的buffer，data直接指向libpcap的帧内存
+    driver_handler_t rx_handler;                    //零拷贝接收时上层的处理回调
+};
+
+/**
+ * @brief 选择驱动配置，需在driver_open()之前调用
+ * 
+ * @param prof DRIVER_PROFILE_LATENCY或DRIVER_PROFILE_THROUGHPUT
+ * @return int 成功为0，不支持的配置为-1
+ */
+int driver_set_profile(int prof)
+{
+    if (prof < 0 || prof >= (int)(sizeof(profiles) / sizeof(profiles[0])))
+        return -1;
+    profile = prof;
+    return 0;
+}
+
 /**
  * @brief 打开网卡
+ *        使用pcap_create/pcap_activate打开，按驱动配置设置立即模式、读超时与内核缓冲区大小
  * 
+ * @param netif 要打开的网卡
  * @return int 成功为0，失败为-1
  */
-int driver_open()
+int driver_open(net_if_t *netif)
 {
     uint32_t net, mask;
 
-    // 根据DRIVER_IF_NAME网卡名，获取网卡的网络号net和子网掩码mask
-    if (pcap_lookupnet(DRIVER_IF_NAME, &net, &mask, pcap_errbuf) == -1) //查找网卡
+    // 根据网卡名，获取网卡的网络号net和子网掩码mask
+    if (pcap_lookupnet(netif->name, &net, &mask, pcap_errbuf) == -1) //查找网卡
     {
-        fprintf(stderr, "Error in pcap_lookupnet: %s\n", pcap_geterr(pcap));
+        fprintf(stderr, "Error in pcap_lookupnet: %s\n", pcap_errbuf);
         return -1;
     }
 
-    // 获取一个数据包捕获的描述符，以便用来查看网络上的数据包。
-    // 第二个参数表示捕获的最大字节数，通常来说数据包的大小不会超过65535
-    // 第三个参数表示开启混杂模式，0表示非混杂模式，任何其他值表示混合模式
-    // 第四个参数指定需要等待的毫秒数，0表示一直等待直到有数据包到来
-    if ((pcap = pcap_open_live(DRIVER_IF_NAME, 65536, 1, 10, pcap_errbuf)) == NULL) //混杂模式打开网卡
+    // 获取一个数据包捕获的描述符，先按驱动配置设置各项参数，再激活
+    const driver_profile_t *prof = &profiles[profile];
+    pcap_t *pcap = pcap_create(netif->name, pcap_errbuf);
+    if (pcap == NULL)
+    {
+        fprintf(stderr, "Error in pcap_create: %s\n", pcap_errbuf);
+        return -1;
+    }
+    pcap_set_snaplen(pcap, DRIVER_SNAPLEN); //每个数据包最多捕获的字节数
+    pcap_set_promisc(pcap, 1);              //开启混杂模式
+    pcap_set_timeout(pcap, prof->timeout);  //内核攒批交付的最长等待时间
+    pcap_set_buffer_size(pcap, prof->buffer_size);
+    // 立即模式下数据包到达即交付，不等待内核缓冲区填满或超时
+    if (pcap_set_immediate_mode(pcap, prof->immediate) != 0)
+        fprintf(stderr, "Warning: pcap_set_immediate_mode failed\n");
+    int ret = pcap_activate(pcap);
+    if (ret < 0)
     {
-        fprintf(stderr, "Error in pcap_open_live: %s.\n", pcap_geterr(pcap));
+        fprintf(stderr, "Error in pcap_activate: %s\n", pcap_statustostr(ret));
+        pcap_close(pcap);
         return -1;
     }
+    if (ret > 0)
+        fprintf(stderr, "Warning: pcap_activate: %s\n", pcap_geterr(pcap));
     if (pcap_setnonblock(pcap, 1, pcap_errbuf) != 0) //设置非阻塞模式
     {
         fprintf(stderr, "Error in pcap_setnonblock: %s\n", pcap_geterr(pcap));
+        pcap_close(pcap);
         return -1;
     }
-    char filter_exp[PCAP_BUF_SIZE];
-    struct bpf_program fp;
-    uint8_t mac_addr[6] = DRIVER_IF_MAC;
-    sprintf(filter_exp, //过滤数据包
-            "(ether dst %02x:%02x:%02x:%02x:%02x:%02x or ether broadcast) and (not ether src %02x:%02x:%02x:%02x:%02x:%02x)",
-            mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5],
-            mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
-    
-    // 只捕获发往本网卡接口与广播的数据帧，也就是只处理发往这张网卡的数据包
-    if (pcap_compile(pcap, &fp, filter_exp, 0, net) == -1)
+    driver_t *drv = calloc(1, sizeof(driver_t));
+    if (drv == NULL)
     {
-        fprintf(stderr, "Error in pcap_compile: %s\n", pcap_geterr(pcap));
+        fprintf(stderr, "Error in driver_open: out of memory\n");
+        pcap_close(pcap);
         return -1;
     }
-    if (pcap_setfilter(pcap, &fp) == -1)
+    drv->netif = netif;
+    drv->pcap = pcap;
+    drv->netmask = mask;
+    netif->drv = drv;
+    // 只捕获发往本网卡接口与广播的数据帧，协议层在初始化时再收紧过滤条件
+    if (driver_set_filter(drv, NULL) == -1)
     {
-        fprintf(stderr, "Error in pcap_setfilter: %s\n", pcap_geterr(pcap));
+        driver_close(drv);
         return -1;
     }
     return 0;
 }
 
+/**
+ * @brief 设置内核中的数据包过滤条件
+ *        在只接收发往本网卡mac与广播、且不是本网卡发出的数据帧的基础上，
+ *        再要求满足filter_exp，编译成BPF交给内核过滤，不满足的数据帧不会拷贝到用户态
+ * 
+ * @param drv 驱动实例
+ * @param filter_exp 协议层的过滤表达式，为NULL时只按mac过滤
+ * @return int 成功为0，失败为-1
+ */
+int driver_set_filter(driver_t *drv, const char *filter_exp)
+{
+    char exp[PCAP_BUF_SIZE];
+    struct bpf_program fp;
+    pcap_t *pcap = drv->pcap;
+    const uint8_t *mac_addr = drv->netif->mac;
+    int len = snprintf(exp, sizeof(exp), //过滤数据包
+                       "(ether dst %02x:%02x:%02x:%02x:%02x:%02x or ether broadcast) and (not ether src %02x:%02x:%02x:%02x:%02x:%02x)",
+                       mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5],
+                       mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
+    if (filter_exp)
+        len += snprintf(exp + len, sizeof(exp) - len, " and (%s)", filter_exp);
+    if (len >= (int)sizeof(exp))
+    {
+        fprintf(stderr, "Error in driver_set_filter: filter too long\n");
+        return -1;
+    }
+
+    if (pcap_compile(pcap, &fp, exp, 1, drv->netmask) == -1)
+    {
+        fprintf(stderr, "Error in pcap_compile: %s\n", pcap_geterr(pcap));
+        return -1;
+    }
+    int ret = pcap_setfilter(pcap, &fp);
+    if (ret == -1)
+        fprintf(stderr, "Error in pcap_setfilter: %s\n", pcap_geterr(pcap));
+    pcap_freecode(&fp);
+    return ret;
+}
+
 /**
  * @brief 试图从网卡接收数据包
  * 
+ * @param drv 驱动实例
  * @param buf 收到的数据包
  * @return int 数据包的长度，未收到为0，错误为-1
  */
-int driver_recv(buf_t *buf)
+int driver_recv(driver_t *drv, buf_t *buf)
 {
     struct pcap_pkthdr *pkt_hdr;
     const uint8_t *pkt_data;
 
     // 从本网卡接口获取一个数据报文
-    int ret = pcap_next_ex(pcap, &pkt_hdr, &pkt_data);
+    int ret = pcap_next_ex(drv->pcap, &pkt_hdr, &pkt_data);
     if (ret == 0)
         return 0;
     else if (ret == 1)
     {
         memcpy(buf->data, pkt_data, pkt_hdr->len);
         buf->len = pkt_hdr->len;
+        buf->if_index = drv->netif->index;
         return pkt_hdr->len;
     }
-    fprintf(stderr, "Error in driver_recv: %s\n", pcap_geterr(pcap));
+    fprintf(stderr, "Error in driver_recv: %s\n", pcap_geterr(drv->pcap));
     return -1;
 }
 
+/**
+ * @brief 批量接收时传给pcap_dispatch的上下文
+ * 
+ */
+typedef struct driver_burst
+{
+    driver_t *drv; //驱动实例
+    buf_t *bufs;   //接收数组
+    int cnt;       //已接收的个数
+} driver_burst_t;
+
+/**
+ * @brief pcap_dispatch的回调，把一个数据包拷入下一个空闲的buffer
+ * 
+ * @param user 批量接收上下文
+ * @param pkt_hdr 数据包头
+ * @param pkt_data 数据包内容
+ */
+static void driver_burst_handler(u_char *user, const struct pcap_pkthdr *pkt_hdr, const u_char *pkt_data)
+{
+    driver_burst_t *burst = (driver_burst_t *)user;
+    buf_t *buf = &burst->bufs[burst->cnt++];
+    buf_init(buf, pkt_hdr->caplen);
+    memcpy(buf->data, pkt_data, pkt_hdr->caplen);
+    buf->if_index = burst->drv->netif->index;
+}
+
+/**
+ * @brief 试图从网卡批量接收数据包，一次调用最多取出max个
+ *        使用pcap_dispatch一次取出内核缓冲区中已到达的多个数据包，
+ *        避免每个数据包都调用一次pcap_next_ex
+ * 
+ * @param drv 驱动实例
+ * @param bufs 接收数据包的buffer数组
+ * @param max 数组长度，即本次最多接收的数据包数
+ * @return int 收到的数据包个数，未收到为0，错误为-1
+ */
+int driver_recv_burst(driver_t *drv, buf_t *bufs, int max)
+{
+    driver_burst_t burst = {.drv = drv, .bufs = bufs, .cnt = 0};
+    if (max <= 0)
+        return 0;
+
+    int ret = pcap_dispatch(drv->pcap, max, driver_burst_handler, (u_char *)&burst);
+    if (ret < 0)
+    {
+        fprintf(stderr, "Error in driver_recv_burst: %s\n", pcap_geterr(drv->pcap));
+        return -1;
+    }
+    return burst.cnt;
+}
+
+/**
+ * @brief pcap_dispatch的回调，不拷贝数据帧，直接交给上层处理
+ *        libpcap的帧内存只在回调期间有效，所以必须在这里完成处理，
+ *        回调返回后libpcap即可回收该帧
+ * 
+ * @param user 驱动实例
+ * @param pkt_hdr 数据包头
+ * @param pkt_data 数据包内容
+ */
+static void driver_zerocopy_handler(u_char *user, const struct pcap_pkthdr *pkt_hdr, const u_char *pkt_data)
+{
+    driver_t *drv = (driver_t *)user;
+    drv->rx_borrow.data = (uint8_t *)pkt_data; //帧内存实际可写，协议层会就地修改报头
+    drv->rx_borrow.len = pkt_hdr->caplen;
+    drv->rx_borrow.if_index = drv->netif->index;
+    drv->rx_handler(&drv->rx_borrow);
+}
+
+/**
+ * @brief 零拷贝地从网卡接收至多max个数据包
+ * 
+ * @param drv 驱动实例
+ * @param max 本次最多接收的数据包数
+ * @param handler 处理数据帧的回调
+ * @return int 处理的数据包个数，未收到为0，错误为-1
+ */
+int driver_recv_zerocopy(driver_t *drv, int max, driver_handler_t handler)
+{
+    if (max <= 0)
+        return 0;
+    drv->rx_handler = handler;
+    int ret = pcap_dispatch(drv->pcap, max, driver_zerocopy_handler, (u_char *)drv);
+    if (ret < 0)
+    {
+        fprintf(stderr, "Error in driver_recv_zerocopy: %s\n", pcap_geterr(drv->pcap));
+        return -1;
+    }
+    return ret;
+}
+
+/**
+ * @brief 把发送队列中的数据包一次批量发出
+ *        Linux下libpcap的描述符就是绑定到网卡的AF_PACKET套接字，
+ *        直接对其调用sendmmsg，一次系统调用发出整个队列；其他平台逐个pcap_sendpacket。
+ *        内核暂时无法接收的帧留在队列中等待下次发送
+ * 
+ * @param drv 驱动实例
+ * @return int 发出的数据包个数，失败为-1
+ */
+int driver_flush(driver_t *drv)
+{
+    int sent = 0, ret = 0;
+    int tx_cnt = drv->tx_cnt;
+    driver_tx_slot_t *tx_queue = drv->tx_queue;
+#ifdef __linux__
+    static struct mmsghdr msgs[DRIVER_TX_QUEUE_LEN];
+    static struct iovec iovs[DRIVER_TX_QUEUE_LEN];
+    for (int i = 0; i < tx_cnt; i++)
+    {
+        iovs[i].iov_base = tx_queue[i].data;
+        iovs[i].iov_len = tx_queue[i].len;
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+    while (sent < tx_cnt)
+    {
+        ret = sendmmsg(pcap_get_selectable_fd(drv->pcap), msgs + sent, tx_cnt - sent, 0);
+        if (ret <= 0)
+            break;
+        sent += ret;
+    }
+    if (ret < 0 && errno != EAGAIN && errno != ENOBUFS)
+    {
+        fprintf(stderr, "Error in driver_flush: %s\n", strerror(errno));
+        sent = tx_cnt; //无法恢复的错误，丢弃整个队列
+    }
+#else
+    for (; sent < tx_cnt; sent++)
+        if (pcap_sendpacket(drv->pcap, tx_queue[sent].data, tx_queue[sent].len) == -1)
+        {
+            fprintf(stderr, "Error in driver_flush: %s\n", pcap_geterr(drv->pcap));
+            ret = -1;
+            break;
+        }
+#endif
+    if (sent)
+    {
+        memmove(tx_queue, tx_queue + sent, (tx_cnt - sent) * sizeof(driver_tx_slot_t));
+        drv->tx_cnt -= sent;
+    }
+    return ret < 0 && sent == 0 ? -1 : sent;
+}
+
 /**
  * @brief 使用网卡发送一个数据包
+ *        数据帧拷入发送队列，积累到DRIVER_TX_BATCH帧时立即批量发送，
+ *        队列已满且无法腾出空间时返回DRIVER_TX_BUSY，由上层决定重试或丢弃
  * 
+ * @param drv 驱动实例
  * @param buf 要发送的数据包
- * @return int 成功为0，失败为-1
+ * @return int 成功为0，发送队列已满为DRIVER_TX_BUSY，失败为-1
  */
-int driver_send(buf_t *buf)
+int driver_send(driver_t *drv, buf_t *buf)
 {
-    // 将数据包发往指定的网卡接口
-    if (pcap_sendpacket(pcap, buf->data, buf->len) == -1)
+    int len = buf_chain_len(buf);
+    if (len > DRIVER_TX_FRAME_MAX)
     {
-        fprintf(stderr, "Error in driver_send: %s\n", pcap_geterr(pcap));
+        fprintf(stderr, "Error in driver_send: frame too long (%d)\n", len);
         return -1;
     }
+    if (drv->tx_cnt == DRIVER_TX_QUEUE_LEN)
+        driver_flush(drv);
+    if (drv->tx_cnt == DRIVER_TX_QUEUE_LEN)
+        return DRIVER_TX_BUSY;
+
+    drv->tx_queue[drv->tx_cnt].len = len;
+    buf_gather(buf, drv->tx_queue[drv->tx_cnt].data); //各段直接拷入发送队列，不经过中间buffer
+    if (++drv->tx_cnt >= DRIVER_TX_BATCH)
+        driver_flush(drv);
+    return 0;
+}
 
+/**
+ * @brief 查询网卡支持的卸载功能
+ * 
+ * @param drv 驱动实例
+ * @return int DRIVER_OFFLOAD_*的组合，本驱动不支持卸载
+ */
+int driver_offload(driver_t *drv)
+{
+    (void)drv;
     return 0;
 }
 
 /**
- * @brief 关闭网卡
+ * @brief 获取网卡的接收统计，包括内核丢包计数
+ * 
+ * @param drv 驱动实例
+ * @param stats 统计结果，自打开网卡起累计
+ * @return int 成功为0，失败为-1
+ */
+int driver_stats(driver_t *drv, driver_stats_t *stats)
+{
+    struct pcap_stat ps;
+    if (pcap_stats(drv->pcap, &ps) == -1)
+    {
+        fprintf(stderr, "Error in pcap_stats: %s\n", pcap_geterr(drv->pcap));
+        return -1;
+    }
+    stats->recv = ps.ps_recv;
+    stats->drop = ps.ps_drop;
+    stats->ifdrop = ps.ps_ifdrop;
+    return 0;
+}
+
+/**
+ * @brief 获取可以用epoll/select等待数据到达的描述符
+ * 
+ * @param drv 驱动实例
+ * @return int libpcap的可选择描述符
+ */
+int driver_fd(driver_t *drv)
+{
+    return pcap_get_selectable_fd(drv->pcap);
+}
+
+/**
+ * @brief 关闭网卡，发出队列中剩余的数据包后释放驱动实例
  * 
+ * @param drv 驱动实例
  */
-void driver_close()
+void driver_close(driver_t *drv)
 {
-    pcap_close(pcap);
+    driver_flush(drv);
+    pcap_close(drv->pcap);
+    drv->netif->drv = NULL;
+    free(drv);
 }
+#endif
@@ -0,0 +1,561 @@
+#include "config.h"
+#if DRIVER_BACKEND == DRIVER_BACKEND_PACKET
+#include <pcap.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include <linux/filter.h>
+#include "utils.h"
+#include "driver.h"
+
+/**
+ * AF_PACKET驱动：
+ *     接收使用TPACKET_V3的mmap环形缓冲区，内核按块(block)批量交付数据帧，
+ *     用户态直接在共享内存中读取，不需要每个数据帧一次系统调用；
+ *     发送使用TPACKET_V2的mmap发送环，并开启PACKET_QDISC_BYPASS跳过qdisc。
+ * 
+ *     编译时使用 -DDRIVER_BACKEND=DRIVER_BACKEND_PACKET 选用该驱动，
+ *     需要CAP_NET_RAW权限。可以在一对veth上测试，例如：
+ *         ip netns add peer
+ *         ip link add veth0 type veth peer name veth1 netns peer
+ *         ip link set veth0 up; ip -n peer link set veth1 up
+ *         ip -n peer addr add 192.168.127.1/24 dev veth1
+ *     然后将DRIVER_IF_NAME设为"veth0"，在peer中ping或发送udp。
+ */
+
+#define DRIVER_TX_BLOCK_SIZE (1 << 16)                                         //发送环每个块的大小
+#define DRIVER_TX_DATA_OFFSET (TPACKET2_HDRLEN - sizeof(struct sockaddr_ll)) //发送帧中数据相对帧头的偏移
+
+static int profile = DRIVER_PROFILE; //当前使用的驱动配置
+
+/**
+ * @brief 一块打开的网卡的驱动实例
+ * 
+ */
+struct driver
+{
+    net_if_t *netif;                 //所属网卡
+    int rx_fd;                       //接收套接字
+    int tx_fd;                       //发送套接字
+    uint8_t *rx_ring;                //接收环
+    uint8_t *tx_ring;                //发送环
+    size_t rx_ring_len, tx_ring_len; //环的长度
+    unsigned int rx_block;           //当前接收块的序号
+    unsigned int rx_pkt_left;        //当前接收块中尚未处理的数据帧数
+    struct tpacket3_hdr *rx_pkt;     //当前接收块中下一个数据帧
+    unsigned int tx_frame;           //下一个可用的发送帧序号
+    unsigned int tx_pending;         //已写入发送环但尚未通知内核的帧数
+    unsigned int tx_frame_size;      //发送环每帧的大小，按MTU确定
+    driver_stats_t rx_stats;         //累计的接收统计，内核每次读取后清零
+    buf_t rx_borrow;                 //零拷贝接收时传给回调的buffer，data直接指向接收环中的数据帧
+};
+
+static void driver_rx_release(driver_t *drv);
+
+/**
+ * @brief 取接收环中的一个块
+ * 
+ * @param drv 驱动实例
+ * @param i 块序号
+ * @return struct tpacket_block_desc* 块描述符
+ */
+static inline struct tpacket_block_desc *rx_block_at(driver_t *drv, unsigned int i)
+{
+    return (struct tpacket_block_desc *)(drv->rx_ring + (size_t)i * DRIVER_RING_BLOCK_SIZE);
+}
+
+/**
+ * @brief 取发送环中的一帧
+ * 
+ * @param drv 驱动实例
+ * @param i 帧序号
+ * @return struct tpacket2_hdr* 帧头
+ */
+static inline struct tpacket2_hdr *tx_frame_at(driver_t *drv, unsigned int i)
+{
+    unsigned int per_block = DRIVER_TX_BLOCK_SIZE / drv->tx_frame_size;
+    return (struct tpacket2_hdr *)(drv->tx_ring + (size_t)(i / per_block) * DRIVER_TX_BLOCK_SIZE +
+                                   (size_t)(i % per_block) * drv->tx_frame_size);
+}
+
+/**
+ * @brief 用libpcap把过滤表达式编译成BPF，挂到套接字上由内核过滤
+ * 
+ * @param fd 套接字
+ * @param filter_exp 过滤表达式
+ * @return int 成功为0，失败为-1
+ */
+static int driver_attach_filter(int fd, const char *filter_exp)
+{
+    struct bpf_program fp;
+    pcap_t *dead = pcap_open_dead(DLT_EN10MB, 65535);
+    if (dead == NULL)
+        return -1;
+    if (pcap_compile(dead, &fp, filter_exp, 1, PCAP_NETMASK_UNKNOWN) == -1)
+    {
+        fprintf(stderr, "Error in pcap_compile: %s\n", pcap_geterr(dead));
+        pcap_close(dead);
+        return -1;
+    }
+    struct sock_fprog prog = {.len = fp.bf_len, .filter = (struct sock_filter *)fp.bf_insns};
+    int ret = setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog));
+    if (ret == -1)
+        fprintf(stderr, "Error in SO_ATTACH_FILTER: %s\n", strerror(errno));
+    pcap_freecode(&fp);
+    pcap_close(dead);
+    return ret;
+}
+
+/**
+ * @brief 设置内核中的数据包过滤条件
+ *        在只接收发往本网卡mac与广播、且不是本网卡发出的数据帧的基础上，
+ *        再要求满足filter_exp，挂到接收套接字上替换原有的过滤器
+ * 
+ * @param drv 驱动实例
+ * @param filter_exp 协议层的过滤表达式，为NULL时只按mac过滤
+ * @return int 成功为0，失败为-1
+ */
+int driver_set_filter(driver_t *drv, const char *filter_exp)
+{
+    char exp[PCAP_BUF_SIZE];
+    const uint8_t *mac_addr = drv->netif->mac;
+    int len = snprintf(exp, sizeof(exp), //过滤数据包
+                       "(ether dst %02x:%02x:%02x:%02x:%02x:%02x or ether broadcast) and (not ether src %02x:%02x:%02x:%02x:%02x:%02x)",
+                       mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5],
+                       mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
+    if (filter_exp)
+        len += snprintf(exp + len, sizeof(exp) - len, " and (%s)", filter_exp);
+    if (len >= (int)sizeof(exp))
+    {
+        fprintf(stderr, "Error in driver_set_filter: filter too long\n");
+        return -1;
+    }
+    return driver_attach_filter(drv->rx_fd, exp);
+}
+
+/**
+ * @brief 打开接收套接字并映射TPACKET_V3接收环
+ * 
+ * @param drv 驱动实例
+ * @param ifindex 网卡序号
+ * @return int 成功为0，失败为-1
+ */
+static int driver_open_rx(driver_t *drv, int ifindex)
+{
+    // 先以协议0创建，挂好过滤器再bind，避免收到过滤前的数据帧
+    int rx_fd = drv->rx_fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (rx_fd == -1)
+    {
+        fprintf(stderr, "Error in socket: %s\n", strerror(errno));
+        return -1;
+    }
+    int version = TPACKET_V3;
+    if (setsockopt(rx_fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1)
+    {
+        fprintf(stderr, "Error in PACKET_VERSION: %s\n", strerror(errno));
+        return -1;
+    }
+    struct tpacket_req3 req = {
+        .tp_block_size = DRIVER_RING_BLOCK_SIZE,
+        .tp_block_nr = DRIVER_RING_BLOCK_NR,
+        .tp_frame_size = DRIVER_RING_FRAME_SIZE,
+        .tp_frame_nr = DRIVER_RING_BLOCK_SIZE / DRIVER_RING_FRAME_SIZE * DRIVER_RING_BLOCK_NR,
+        .tp_retire_blk_tov = profile == DRIVER_PROFILE_THROUGHPUT ? DRIVER_THROUGHPUT_TIMEOUT : DRIVER_RING_BLOCK_TOV,
+    };
+    if (setsockopt(rx_fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1)
+    {
+        fprintf(stderr, "Error in PACKET_RX_RING: %s\n", strerror(errno));
+        return -1;
+    }
+    drv->rx_ring_len = (size_t)DRIVER_RING_BLOCK_SIZE * DRIVER_RING_BLOCK_NR;
+    drv->rx_ring = mmap(NULL, drv->rx_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, rx_fd, 0);
+    if (drv->rx_ring == MAP_FAILED)
+    {
+        drv->rx_ring = NULL;
+        fprintf(stderr, "Error in mmap: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // 先只按mac过滤，协议层在初始化时再收紧过滤条件
+    if (driver_set_filter(drv, NULL) == -1)
+        return -1;
+
+    struct sockaddr_ll sll = {
+        .sll_family = AF_PACKET,
+        .sll_protocol = htons(ETH_P_ALL),
+        .sll_ifindex = ifindex,
+    };
+    if (bind(rx_fd, (struct sockaddr *)&sll, sizeof(sll)) == -1)
+    {
+        fprintf(stderr, "Error in bind: %s\n", strerror(errno));
+        return -1;
+    }
+    struct packet_mreq mreq = {.mr_ifindex = ifindex, .mr_type = PACKET_MR_PROMISC}; //混杂模式
+    if (setsockopt(rx_fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1)
+    {
+        fprintf(stderr, "Error in PACKET_ADD_MEMBERSHIP: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 打开发送套接字并映射TPACKET_V2发送环
+ * 
+ * @param drv 驱动实例
+ * @param ifindex 网卡序号
+ * @return int 成功为0，失败为-1
+ */
+static int driver_open_tx(driver_t *drv, int ifindex)
+{
+    // 协议为0的套接字不会收到任何数据帧，只用于发送
+    int tx_fd = drv->tx_fd = socket(AF_PACKET, SOCK_RAW, 0);
+    if (tx_fd == -1)
+    {
+        fprintf(stderr, "Error in socket: %s\n", strerror(errno));
+        return -1;
+    }
+    int version = TPACKET_V2;
+    if (setsockopt(tx_fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1)
+    {
+        fprintf(stderr, "Error in PACKET_VERSION: %s\n", strerror(errno));
+        return -1;
+    }
+    int bypass = 1;
+    if (setsockopt(tx_fd, SOL_PACKET, PACKET_QDISC_BYPASS, &bypass, sizeof(bypass)) == -1)
+        fprintf(stderr, "Warning: PACKET_QDISC_BYPASS unsupported: %s\n", strerror(errno));
+
+    //每帧需容纳帧头与一个MTU的数据帧，取2的幂使块大小是帧大小的整数倍
+    unsigned int tx_frame_size = DRIVER_RING_FRAME_SIZE;
+    while (tx_frame_size < DRIVER_TX_DATA_OFFSET + drv->netif->mtu + 14)
+        tx_frame_size <<= 1;
+    drv->tx_frame_size = tx_frame_size;
+    unsigned int per_block = DRIVER_TX_BLOCK_SIZE / tx_frame_size;
+    struct tpacket_req req = {
+        .tp_block_size = DRIVER_TX_BLOCK_SIZE,
+        .tp_block_nr = DRIVER_RING_FRAME_NR / per_block,
+        .tp_frame_size = tx_frame_size,
+        .tp_frame_nr = DRIVER_RING_FRAME_NR / per_block * per_block,
+    };
+    if (setsockopt(tx_fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) == -1)
+    {
+        fprintf(stderr, "Error in PACKET_TX_RING: %s\n", strerror(errno));
+        return -1;
+    }
+    drv->tx_ring_len = (size_t)req.tp_block_size * req.tp_block_nr;
+    drv->tx_ring = mmap(NULL, drv->tx_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, tx_fd, 0);
+    if (drv->tx_ring == MAP_FAILED)
+    {
+        drv->tx_ring = NULL;
+        fprintf(stderr, "Error in mmap: %s\n", strerror(errno));
+        return -1;
+    }
+    struct sockaddr_ll sll = {
+        .sll_family = AF_PACKET,
+        .sll_ifindex = ifindex,
+    };
+    if (bind(tx_fd, (struct sockaddr *)&sll, sizeof(sll)) == -1)
+    {
+        fprintf(stderr, "Error in bind: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 选择驱动配置，需在driver_open()之前调用
+ *        接收环的大小固定，两种配置只影响未填满的块交还用户态的超时时间
+ * 
+ * @param prof DRIVER_PROFILE_LATENCY或DRIVER_PROFILE_THROUGHPUT
+ * @return int 成功为0，不支持的配置为-1
+ */
+int driver_set_profile(int prof)
+{
+    if (prof != DRIVER_PROFILE_LATENCY && prof != DRIVER_PROFILE_THROUGHPUT)
+        return -1;
+    profile = prof;
+    return 0;
+}
+
+/**
+ * @brief 打开网卡
+ * 
+ * @param netif 要打开的网卡
+ * @return int 成功为0，失败为-1
+ */
+int driver_open(net_if_t *netif)
+{
+    int ifindex = if_nametoindex(netif->name);
+    if (ifindex == 0)
+    {
+        fprintf(stderr, "Error in if_nametoindex: %s\n", strerror(errno));
+        return -1;
+    }
+    driver_t *drv = calloc(1, sizeof(driver_t));
+    if (drv == NULL)
+    {
+        fprintf(stderr, "Error in driver_open: out of memory\n");
+        return -1;
+    }
+    drv->netif = netif;
+    drv->rx_fd = drv->tx_fd = -1;
+    netif->drv = drv;
+    if (driver_open_rx(drv, ifindex) == -1 || driver_open_tx(drv, ifindex) == -1)
+    {
+        driver_close(drv);
+        return -1;
+    }
+    // 与内核共用网卡，超过网卡本身MTU的数据帧发不出去
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, IFNAMSIZ, "%s", netif->name);
+    if (ioctl(drv->tx_fd, SIOCGIFMTU, &ifr) == 0 && ifr.ifr_mtu < netif->mtu)
+        fprintf(stderr, "Warning: mtu %d exceeds the mtu of %s (%d)\n", netif->mtu, netif->name, ifr.ifr_mtu);
+    return 0;
+}
+
+/**
+ * @brief 取出接收环中的下一个数据帧
+ *        当前块没有剩余数据帧时，检查下一个块是否已交给用户态
+ * 
+ * @param drv 驱动实例
+ * @return struct tpacket3_hdr* 数据帧，没有时为NULL
+ */
+static struct tpacket3_hdr *driver_rx_next(driver_t *drv)
+{
+    if (drv->rx_pkt_left == 0)
+    {
+        struct tpacket_block_desc *blk = rx_block_at(drv, drv->rx_block);
+        if ((blk->hdr.bh1.block_status & TP_STATUS_USER) == 0)
+            return NULL;
+        __sync_synchronize();
+        drv->rx_pkt = (struct tpacket3_hdr *)((uint8_t *)blk + blk->hdr.bh1.offset_to_first_pkt);
+        drv->rx_pkt_left = blk->hdr.bh1.num_pkts;
+        if (drv->rx_pkt_left == 0)
+        {
+            driver_rx_release(drv);
+            return NULL;
+        }
+    }
+    struct tpacket3_hdr *pkt = drv->rx_pkt;
+    drv->rx_pkt = (struct tpacket3_hdr *)((uint8_t *)pkt + pkt->tp_next_offset);
+    drv->rx_pkt_left--;
+    return pkt;
+}
+
+/**
+ * @brief 归还已经处理完的数据帧
+ *        当前块的数据帧全部处理完后，把整个块交还内核
+ * 
+ * @param drv 驱动实例
+ */
+static void driver_rx_release(driver_t *drv)
+{
+    if (drv->rx_pkt_left)
+        return;
+    struct tpacket_block_desc *blk = rx_block_at(drv, drv->rx_block);
+    if ((blk->hdr.bh1.block_status & TP_STATUS_USER) == 0)
+        return;
+    __sync_synchronize();
+    blk->hdr.bh1.block_status = TP_STATUS_KERNEL;
+    drv->rx_block = (drv->rx_block + 1) % DRIVER_RING_BLOCK_NR;
+}
+
+/**
+ * @brief 试图从网卡批量接收数据包，一次调用最多取出max个
+ *        依次读取接收环中已交给用户态的块，数据帧拷入buffer后即可归还
+ * 
+ * @param drv 驱动实例
+ * @param bufs 接收数据包的buffer数组
+ * @param max 数组长度，即本次最多接收的数据包数
+ * @return int 收到的数据包个数，未收到为0
+ */
+int driver_recv_burst(driver_t *drv, buf_t *bufs, int max)
+{
+    int cnt = 0;
+    struct tpacket3_hdr *pkt;
+    while (cnt < max && (pkt = driver_rx_next(drv)) != NULL)
+    {
+        uint32_t len = pkt->tp_snaplen;
+        if (len > BUF_MAX_LEN)
+            len = BUF_MAX_LEN;
+        buf_init(&bufs[cnt], len);
+        memcpy(bufs[cnt].data, (uint8_t *)pkt + pkt->tp_mac, len);
+        bufs[cnt].if_index = drv->netif->index;
+        cnt++;
+        driver_rx_release(drv);
+    }
+    return cnt;
+}
+
+/**
+ * @brief 零拷贝地从网卡接收至多max个数据包
+ *        buf直接指向接收环中的数据帧，handler返回后才归还该帧所在的块
+ * 
+ * @param drv 驱动实例
+ * @param max 本次最多接收的数据包数
+ * @param handler 处理数据帧的回调
+ * @return int 处理的数据包个数，未收到为0
+ */
+int driver_recv_zerocopy(driver_t *drv, int max, driver_handler_t handler)
+{
+    int cnt = 0;
+    struct tpacket3_hdr *pkt;
+    while (cnt < max && (pkt = driver_rx_next(drv)) != NULL)
+    {
+        drv->rx_borrow.data = (uint8_t *)pkt + pkt->tp_mac;
+        drv->rx_borrow.len = pkt->tp_snaplen;
+        drv->rx_borrow.if_index = drv->netif->index;
+        handler(&drv->rx_borrow);
+        cnt++;
+        driver_rx_release(drv);
+    }
+    return cnt;
+}
+
+/**
+ * @brief 试图从网卡接收数据包
+ * 
+ * @param drv 驱动实例
+ * @param buf 收到的数据包
+ * @return int 数据包的长度，未收到为0，错误为-1
+ */
+int driver_recv(driver_t *drv, buf_t *buf)
+{
+    return driver_recv_burst(drv, buf, 1) == 1 ? buf->len : 0;
+}
+
+/**
+ * @brief 通知内核把发送环中所有待发送的帧一次发出
+ *        内核暂时发不出(EAGAIN/ENOBUFS)时帧仍留在发送环中，保留tx_pending，
+ *        下次调用时再通知内核，否则发送环占满后不会再有人通知内核
+ * 
+ * @param drv 驱动实例
+ * @return int 发出的数据包个数，暂时发不出为0，失败为-1
+ */
+int driver_flush(driver_t *drv)
+{
+    int cnt = drv->tx_pending;
+    if (cnt == 0)
+        return 0;
+    if (send(drv->tx_fd, NULL, 0, MSG_DONTWAIT) == -1)
+    {
+        if (errno == EAGAIN || errno == ENOBUFS)
+            return 0;
+        fprintf(stderr, "Error in driver_flush: %s\n", strerror(errno));
+        return -1;
+    }
+    drv->tx_pending = 0;
+    return cnt;
+}
+
+/**
+ * @brief 使用网卡发送一个数据包
+ *        把数据帧写入发送环的下一个空闲帧，发送环本身就是发送队列，
+ *        积累到DRIVER_TX_BATCH帧时才通知内核批量发送
+ * 
+ * @param drv 驱动实例
+ * @param buf 要发送的数据包
+ * @return int 成功为0，发送环已满为DRIVER_TX_BUSY，失败为-1
+ */
+int driver_send(driver_t *drv, buf_t *buf)
+{
+    struct tpacket2_hdr *hdr = tx_frame_at(drv, drv->tx_frame);
+    int len = buf_chain_len(buf);
+    if (len > (int)(drv->tx_frame_size - DRIVER_TX_DATA_OFFSET))
+    {
+        fprintf(stderr, "Error in driver_send: frame too long (%d)\n", len);
+        return -1;
+    }
+    if (hdr->tp_status != TP_STATUS_AVAILABLE && hdr->tp_status != TP_STATUS_WRONG_FORMAT)
+    {
+        driver_flush(drv);
+        if (hdr->tp_status != TP_STATUS_AVAILABLE && hdr->tp_status != TP_STATUS_WRONG_FORMAT)
+            return DRIVER_TX_BUSY;
+    }
+    buf_gather(buf, (uint8_t *)hdr + DRIVER_TX_DATA_OFFSET); //各段直接拷入发送环，不经过中间buffer
+    hdr->tp_len = len;
+    __sync_synchronize();
+    hdr->tp_status = TP_STATUS_SEND_REQUEST;
+    drv->tx_frame = (drv->tx_frame + 1) % DRIVER_RING_FRAME_NR;
+
+    if (++drv->tx_pending >= DRIVER_TX_BATCH)
+        driver_flush(drv);
+    return 0;
+}
+
+/**
+ * @brief 查询网卡支持的卸载功能
+ * 
+ * @param drv 驱动实例
+ * @return int DRIVER_OFFLOAD_*的组合，本驱动不支持卸载
+ */
+int driver_offload(driver_t *drv)
+{
+    (void)drv;
+    return 0;
+}
+
+/**
+ * @brief 获取网卡的接收统计，包括内核丢包计数
+ * 
+ * @param drv 驱动实例
+ * @param stats 统计结果，自打开网卡起累计
+ * @return int 成功为0，失败为-1
+ */
+int driver_stats(driver_t *drv, driver_stats_t *stats)
+{
+    struct tpacket_stats_v3 st;
+    socklen_t len = sizeof(st);
+    if (getsockopt(drv->rx_fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) == -1)
+    {
+        fprintf(stderr, "Error in PACKET_STATISTICS: %s\n", strerror(errno));
+        return -1;
+    }
+    drv->rx_stats.recv += st.tp_packets; //内核返回的tp_packets已包含丢弃的数据包
+    drv->rx_stats.drop += st.tp_drops;
+    *stats = drv->rx_stats;
+    return 0;
+}
+
+/**
+ * @brief 获取可以用epoll/select等待数据到达的描述符
+ * 
+ * @param drv 驱动实例
+ * @return int 接收环所在的套接字，块交给用户态时可读
+ */
+int driver_fd(driver_t *drv)
+{
+    return drv->rx_fd;
+}
+
+/**
+ * @brief 关闭网卡，释放驱动实例
+ * 
+ * @param drv 驱动实例
+ */
+void driver_close(driver_t *drv)
+{
+    if (drv->tx_ring)
+        driver_flush(drv);
+    if (drv->rx_ring)
+        munmap(drv->rx_ring, drv->rx_ring_len);
+    if (drv->tx_ring)
+        munmap(drv->tx_ring, drv->tx_ring_len);
+    if (drv->rx_fd != -1)
+        close(drv->rx_fd);
+    if (drv->tx_fd != -1)
+        close(drv->tx_fd);
+    drv->netif->drv = NULL;
+    free(drv);
+}
+#endif
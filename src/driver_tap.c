@@ -0,0 +1,400 @@
+#include "config.h"
+#if DRIVER_BACKEND == DRIVER_BACKEND_TAP
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <net/if.h>
+#include <linux/if_tun.h>
+#include <linux/filter.h>
+#include <pcap.h>
+#include <linux/virtio_net.h>
+#include "net.h"
+#include "utils.h"
+#include "driver.h"
+
+/**
+ * TAP驱动：
+ *     打开/dev/net/tun创建与网卡同名的TAP设备，协议栈作为该设备另一端的主机，
+ *     内核一侧给该设备配置同网段地址后即可在本机通信，不需要物理网卡。
+ *     只有创建设备时需要CAP_NET_ADMIN，可以事先用
+ *         ip tuntap add dev tap0 mode tap user <用户名> vnet_hdr
+ *     创建持久设备，之后以普通用户运行。编译时使用 -DDRIVER_BACKEND=DRIVER_BACKEND_TAP 选用该驱动。
+ * 
+ *     开启IFF_VNET_HDR后每个数据帧前带有virtio_net_hdr：
+ *     发送时可以交给内核只含伪首部校验和的udp数据包，以及超过MTU、由内核分片的udp数据包；
+ *     接收时内核通过该头告知数据包的传输层校验和已经验证过，协议层可以跳过校验；
+ *     本机内核发出的数据包校验和可能尚未计算，转发前由ip层补全。
+ */
+
+#define DRIVER_TX_IOV_MAX 8 //一次发送最多的iovec数，即virtio_net_hdr加上分散/聚集链的段数
+
+/**
+ * @brief 一块打开的网卡的驱动实例
+ * 
+ */
+struct driver
+{
+    net_if_t *netif; //所属网卡
+    int tap_fd;      //TAP设备描述符
+    buf_t rx_borrow; //零拷贝接收时使用的buffer，数据帧由内核直接读入其中
+};
+
+/**
+ * @brief 根据virtio_net_hdr设置收到的数据包的卸载标志
+ * 
+ * @param buf 收到的数据包
+ * @param vnet_hdr 数据帧前的virtio_net_hdr
+ */
+static void driver_rx_offload(buf_t *buf, struct virtio_net_hdr *vnet_hdr)
+{
+    // DATA_VALID为内核已验证传输层校验和
+    if (vnet_hdr->flags & VIRTIO_NET_HDR_F_DATA_VALID)
+        buf->flags |= BUF_F_CSUM_VALID;
+    // NEEDS_CSUM为内核本机产生、校验和尚未计算，保留补全的位置，转发前由ip层补全
+    else if (vnet_hdr->flags & VIRTIO_NET_HDR_F_NEEDS_CSUM)
+    {
+        buf->flags |= BUF_F_CSUM_PARTIAL;
+        buf->csum_start = vnet_hdr->csum_start; //相对帧头，即此时的data
+        buf->csum_offset = vnet_hdr->csum_offset;
+    }
+}
+
+/**
+ * @brief 从TAP设备读取一个数据帧
+ *        TAP设备未开启接收分段卸载，每帧不超过MTU加以太网帧头，按该长度从缓冲池取缓冲块直接读入
+ * 
+ * @param drv 驱动实例
+ * @param buf 收到的数据包，数据帧直接读入其缓冲块
+ * @return int 数据帧的长度，未收到为0，错误为-1
+ */
+static int driver_read(driver_t *drv, buf_t *buf)
+{
+    struct virtio_net_hdr vnet_hdr;
+    buf_init(buf, drv->netif->mtu + 14);
+    buf->if_index = drv->netif->index;
+    struct iovec iov[2] = {
+        {.iov_base = &vnet_hdr, .iov_len = sizeof(vnet_hdr)},
+        {.iov_base = buf->data, .iov_len = buf->len},
+    };
+    ssize_t ret = readv(drv->tap_fd, iov, 2);
+    if (ret < 0)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return 0;
+        fprintf(stderr, "Error in driver_recv: %s\n", strerror(errno));
+        return -1;
+    }
+    if (ret <= (ssize_t)sizeof(vnet_hdr))
+        return 0;
+    buf->len = ret - sizeof(vnet_hdr);
+    driver_rx_offload(buf, &vnet_hdr);
+    return buf->len;
+}
+
+/**
+ * @brief 设置内核中的数据包过滤条件
+ *        发往本网卡mac与广播的过滤已由TUNSETTXFILTER完成，
+ *        这里用libpcap把filter_exp编译成BPF，用TUNATTACHFILTER交给内核过滤
+ * 
+ * @param drv 驱动实例
+ * @param filter_exp 协议层的过滤表达式，为NULL时不再额外过滤
+ * @return int 成功为0，失败为-1
+ */
+int driver_set_filter(driver_t *drv, const char *filter_exp)
+{
+    struct sock_fprog prog;
+    ioctl(drv->tap_fd, TUNDETACHFILTER, &prog); //没有挂过滤器时失败，忽略
+    if (filter_exp == NULL)
+        return 0;
+
+    struct bpf_program fp;
+    pcap_t *dead = pcap_open_dead(DLT_EN10MB, 65535);
+    if (dead == NULL)
+        return -1;
+    if (pcap_compile(dead, &fp, filter_exp, 1, PCAP_NETMASK_UNKNOWN) == -1)
+    {
+        fprintf(stderr, "Error in pcap_compile: %s\n", pcap_geterr(dead));
+        pcap_close(dead);
+        return -1;
+    }
+    prog.len = fp.bf_len;
+    prog.filter = (struct sock_filter *)fp.bf_insns;
+    int ret = ioctl(drv->tap_fd, TUNATTACHFILTER, &prog);
+    if (ret == -1)
+        fprintf(stderr, "Error in TUNATTACHFILTER: %s\n", strerror(errno));
+    pcap_freecode(&fp);
+    pcap_close(dead);
+    return ret;
+}
+
+/**
+ * @brief 选择驱动配置，需在driver_open()之前调用
+ *        TAP设备每次read只交付一帧，没有可调的攒批与缓冲区，两种配置行为相同
+ * 
+ * @param prof DRIVER_PROFILE_LATENCY或DRIVER_PROFILE_THROUGHPUT
+ * @return int 成功为0，不支持的配置为-1
+ */
+int driver_set_profile(int prof)
+{
+    return prof == DRIVER_PROFILE_LATENCY || prof == DRIVER_PROFILE_THROUGHPUT ? 0 : -1;
+}
+
+/**
+ * @brief 打开网卡
+ *        创建TAP设备，开启virtio_net_hdr与卸载功能，只接收发往本机mac与广播的数据帧
+ * 
+ * @param netif 要打开的网卡
+ * @return int 成功为0，失败为-1
+ */
+int driver_open(net_if_t *netif)
+{
+    int tap_fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK);
+    if (tap_fd == -1)
+    {
+        fprintf(stderr, "Error in open /dev/net/tun: %s\n", strerror(errno));
+        return -1;
+    }
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_VNET_HDR;
+    snprintf(ifr.ifr_name, IFNAMSIZ, "%s", netif->name);
+    if (ioctl(tap_fd, TUNSETIFF, &ifr) == -1)
+    {
+        fprintf(stderr, "Error in TUNSETIFF: %s\n", strerror(errno));
+        goto err;
+    }
+    int hdr_size = sizeof(struct virtio_net_hdr);
+    if (ioctl(tap_fd, TUNSETVNETHDRSZ, &hdr_size) == -1)
+    {
+        fprintf(stderr, "Error in TUNSETVNETHDRSZ: %s\n", strerror(errno));
+        goto err;
+    }
+    // 允许内核交给我们校验和未计算的数据包，由virtio_net_hdr标明
+    if (ioctl(tap_fd, TUNSETOFFLOAD, TUN_F_CSUM) == -1)
+    {
+        fprintf(stderr, "Error in TUNSETOFFLOAD: %s\n", strerror(errno));
+        goto err;
+    }
+
+    // 只接收发往本网卡mac与广播的数据帧
+    struct
+    {
+        struct tun_filter filter;
+        uint8_t addr[2][NET_MAC_LEN];
+    } tx_filter = {
+        .filter = {.flags = 0, .count = 2},
+        .addr = {{0}, {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}},
+    };
+    memcpy(tx_filter.addr[0], netif->mac, NET_MAC_LEN);
+    if (ioctl(tap_fd, TUNSETTXFILTER, &tx_filter) == -1)
+        fprintf(stderr, "Warning: TUNSETTXFILTER failed: %s\n", strerror(errno));
+
+    // 启用设备
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock == -1 || ioctl(sock, SIOCGIFFLAGS, &ifr) == -1)
+    {
+        fprintf(stderr, "Error in SIOCGIFFLAGS: %s\n", strerror(errno));
+        if (sock != -1)
+            close(sock);
+        goto err;
+    }
+    ifr.ifr_flags |= IFF_UP;
+    if (ioctl(sock, SIOCSIFFLAGS, &ifr) == -1)
+        fprintf(stderr, "Warning: SIOCSIFFLAGS failed: %s\n", strerror(errno));
+    // 内核一侧的MTU与协议栈一致，才会发来巨型帧
+    ifr.ifr_mtu = netif->mtu;
+    if (ioctl(sock, SIOCSIFMTU, &ifr) == -1)
+        fprintf(stderr, "Warning: SIOCSIFMTU failed: %s\n", strerror(errno));
+    close(sock);
+
+    driver_t *drv = calloc(1, sizeof(driver_t));
+    if (drv == NULL)
+    {
+        fprintf(stderr, "Error in driver_open: out of memory\n");
+        goto err;
+    }
+    drv->netif = netif;
+    drv->tap_fd = tap_fd;
+    netif->drv = drv;
+    return 0;
+
+err:
+    close(tap_fd);
+    return -1;
+}
+
+/**
+ * @brief 试图从网卡接收数据包
+ * 
+ * @param drv 驱动实例
+ * @param buf 收到的数据包
+ * @return int 数据包的长度，未收到为0，错误为-1
+ */
+int driver_recv(driver_t *drv, buf_t *buf)
+{
+    return driver_read(drv, buf);
+}
+
+/**
+ * @brief 试图从网卡批量接收数据包，一次调用最多取出max个
+ *        TAP设备每次read只能取出一帧，数据帧由内核直接读入各个buffer，不再额外拷贝
+ * 
+ * @param drv 驱动实例
+ * @param bufs 接收数据包的buffer数组
+ * @param max 数组长度，即本次最多接收的数据包数
+ * @return int 收到的数据包个数，未收到为0，错误为-1
+ */
+int driver_recv_burst(driver_t *drv, buf_t *bufs, int max)
+{
+    int cnt = 0;
+    while (cnt < max)
+    {
+        int ret = driver_read(drv, &bufs[cnt]);
+        if (ret < 0)
+            return cnt ? cnt : -1;
+        if (ret == 0)
+            break;
+        cnt++;
+    }
+    return cnt;
+}
+
+/**
+ * @brief 零拷贝地从网卡接收至多max个数据包
+ *        数据帧由内核直接读入驱动的接收buffer，交给handler处理后再读下一帧
+ * 
+ * @param drv 驱动实例
+ * @param max 本次最多接收的数据包数
+ * @param handler 处理数据帧的回调
+ * @return int 处理的数据包个数，未收到为0，错误为-1
+ */
+int driver_recv_zerocopy(driver_t *drv, int max, driver_handler_t handler)
+{
+    int cnt = 0;
+    while (cnt < max)
+    {
+        int ret = driver_read(drv, &drv->rx_borrow);
+        if (ret < 0)
+            return cnt ? cnt : -1;
+        if (ret == 0)
+            break;
+        handler(&drv->rx_borrow);
+        cnt++;
+    }
+    return cnt;
+}
+
+/**
+ * @brief 使用网卡发送一个数据包
+ *        根据buf的卸载标志填写virtio_net_hdr，与分散/聚集链的各段一起用writev写入TAP设备。
+ *        TAP设备每次write只能写入一帧，没有可以合并的批量发送，因此直接写出不排队
+ * 
+ * @param drv 驱动实例
+ * @param buf 要发送的数据包
+ * @return int 成功为0，内核队列已满为DRIVER_TX_BUSY，失败为-1
+ */
+int driver_send(driver_t *drv, buf_t *buf)
+{
+    struct virtio_net_hdr vnet_hdr;
+    memset(&vnet_hdr, 0, sizeof(vnet_hdr));
+    if (buf->flags & BUF_F_CSUM_PARTIAL)
+    {
+        vnet_hdr.flags = VIRTIO_NET_HDR_F_NEEDS_CSUM;
+        vnet_hdr.csum_start = buf->csum_start;
+        vnet_hdr.csum_offset = buf->csum_offset;
+    }
+    if (buf->flags & BUF_F_GSO_UDP)
+    {
+        vnet_hdr.gso_type = VIRTIO_NET_HDR_GSO_UDP;
+        vnet_hdr.gso_size = buf->gso_size;
+        vnet_hdr.hdr_len = 14 + ((buf->data[14] & 0xf) << 2) + 8; //以太网头 + ip头 + udp头
+    }
+    struct iovec iov[DRIVER_TX_IOV_MAX] = {{.iov_base = &vnet_hdr, .iov_len = sizeof(vnet_hdr)}};
+    int iovcnt = 1;
+    for (buf_t *seg = buf; seg; seg = seg->next) //分散/聚集链的各段直接交给内核，不拼接
+    {
+        if (iovcnt == DRIVER_TX_IOV_MAX)
+        {
+            fprintf(stderr, "Error in driver_send: too many segments\n");
+            return -1;
+        }
+        iov[iovcnt].iov_base = seg->data;
+        iov[iovcnt++].iov_len = seg->len;
+    }
+    if (writev(drv->tap_fd, iov, iovcnt) == -1)
+    {
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return DRIVER_TX_BUSY;
+        fprintf(stderr, "Error in driver_send: %s\n", strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @brief 把发送队列中的数据包一次批量发出
+ * 
+ * @param drv 驱动实例
+ * @return int 发出的数据包个数，TAP驱动不排队，总为0
+ */
+int driver_flush(driver_t *drv)
+{
+    (void)drv;
+    return 0;
+}
+
+/**
+ * @brief 查询网卡支持的卸载功能
+ * 
+ * @param drv 驱动实例
+ * @return int DRIVER_OFFLOAD_*的组合
+ */
+int driver_offload(driver_t *drv)
+{
+    (void)drv;
+    return DRIVER_OFFLOAD_TX_CSUM | DRIVER_OFFLOAD_TX_UFO | DRIVER_OFFLOAD_RX_CSUM;
+}
+
+/**
+ * @brief 获取网卡的接收统计，包括内核丢包计数
+ * 
+ * @param drv 驱动实例
+ * @param stats 统计结果
+ * @return int TAP设备不提供丢包计数，总为-1
+ */
+int driver_stats(driver_t *drv, driver_stats_t *stats)
+{
+    (void)drv;
+    (void)stats;
+    return -1;
+}
+
+/**
+ * @brief 获取可以用epoll/select等待数据到达的描述符
+ * 
+ * @param drv 驱动实例
+ * @return int TAP设备描述符
+ */
+int driver_fd(driver_t *drv)
+{
+    return drv->tap_fd;
+}
+
+/**
+ * @brief 关闭网卡，释放驱动实例
+ * 
+ * @param drv 驱动实例
+ */
+void driver_close(driver_t *drv)
+{
+    close(drv->tap_fd);
+    drv->netif->drv = NULL;
+    free(drv);
+}
+#endif
@@ -3,6 +3,7 @@
 #include "driver.h"
 #include "arp.h"
 #include "ip.h"
+#include "netif.h"
 #include <string.h>
 #include <stdio.h>
 
@@ -22,9 +23,10 @@ void ethernet_in(buf_t *buf)
     p+=12;
     if(p[0]==0x08 && p[1]==0x00){
         //IP
+        //确认发送方仍然可达，只在arp表项临近过期时才有实际工作
+        if(buf->len >= 14 + 20)
+            arp_confirm(p+2+12,p-6);
         buf_remove_header(buf,14);
-        //下面一行为UDP实验新增的
-        arp_in(buf);
         ip_in(buf);
     }else if(p[0]==0x08 && p[1]==0x06){
         //ARP
@@ -38,22 +40,26 @@ void ethernet_in(buf_t *buf)
  * @brief 处理一个要发送的数据包
  *        你需添加以太网包头，填写目的MAC地址、源MAC地址、协议类型
  *        添加完成后将以太网数据帧发送到驱动层
+ *        源MAC地址与发送使用的驱动都取buf->if_index指定的网卡
  * 
  * @param buf 要处理的数据包
  * @param mac 目标ip地址
  * @param protocol 上层协议
+ * @return int 成功为0，驱动发送队列已满为DRIVER_TX_BUSY（buf恢复原样，可以重发），失败为-1
  */
-void ethernet_out(buf_t *buf, const uint8_t *mac, net_protocol_t protocol)
+int ethernet_out(buf_t *buf, const uint8_t *mac, net_protocol_t protocol)
 {
     // TODO
+    net_if_t *netif = net_if_get(buf->if_index);
+    if(netif->drv == NULL)
+        return -1;
     buf_add_header(buf,14);
     uint8_t *p1,*p2;
     p1 = buf->data;
     for(int i = 0;i<6;i++){
         *p1++ =*mac++;
     }
-    uint8_t mac_addr[6] = DRIVER_IF_MAC;
-    p2 = mac_addr;
+    p2 = netif->mac;
     for(int i=0;i<6;i++){
         *p1++ = *p2++;
     }
@@ -62,26 +68,103 @@ void ethernet_out(buf_t *buf, const uint8_t *mac, net_protocol_t protocol)
     uint8_t b = (uint8_t)(type>>8);
     *p1++=b;
     *p1=a;
-    driver_send(buf); 
+    int ret = driver_send(netif->drv,buf);
+    if(ret == DRIVER_TX_BUSY)
+        buf_remove_header(buf,14);
+    return ret;
 }
 
 /**
  * @brief 初始化以太网协议
+ *        没有添加网卡时先添加默认网卡，再依次打开所有网卡
  * 
  * @return int 成功为0，失败为-1
  */
 int ethernet_init()
 {
-    buf_init(&rxbuf, ETHERNET_MTU + sizeof(ether_hdr_t));
-    return driver_open();
+    if (net_if_init() == -1)
+        return -1;
+    for (int i = 0; i < net_if_nr; i++)
+    {
+        net_if_t *netif = net_if_get(i);
+        if (netif->drv)
+            continue;
+        if (driver_open(netif) == -1)
+        {
+            fprintf(stderr, "Error in ethernet_init: cannot open %s\n", netif->name);
+            return -1;
+        }
+        netif->offload = driver_offload(netif->drv);
+    }
+    return 0;
+}
+
+/**
+ * @brief 批量接收使用的buffer数组
+ * 
+ */
+static buf_t rx_burst[DRIVER_RX_BURST];
+
+/**
+ * @brief 轮询一块网卡，批量接收并处理至多budget个数据帧
+ *        零拷贝模式下由驱动直接把其帧内存交给ethernet_in()处理，
+ *        否则每次向驱动取出一批数据帧拷入rx_burst，依次交给ethernet_in()处理，
+ *        直到用完budget或驱动中已没有数据帧
+ * 
+ * @param drv 网卡的驱动实例
+ * @param budget 本次最多处理的帧数
+ * @return int 实际处理的帧数，错误为-1
+ */
+static int ethernet_poll_if(driver_t *drv, int budget)
+{
+    if (DRIVER_RX_ZEROCOPY)
+        return driver_recv_zerocopy(drv, budget, ethernet_in);
+
+    int done = 0;
+    while (done < budget)
+    {
+        int want = budget - done;
+        if (want > DRIVER_RX_BURST)
+            want = DRIVER_RX_BURST;
+        int cnt = driver_recv_burst(drv, rx_burst, want);
+        if (cnt < 0)
+            return done ? done : -1;
+        for (int i = 0; i < cnt; i++)
+            ethernet_in(&rx_burst[i]);
+        done += cnt;
+        if (cnt < want)
+            break;
+    }
+    return done;
 }
 
 /**
- * @brief 一次以太网轮询
+ * @brief 一次以太网轮询，所有网卡共用至多budget个数据帧
+ *        每块网卡分到尚未用完的budget在剩余网卡间的平均份额，
+ *        空闲网卡用不完的留给后面的网卡；每次轮询从下一块网卡开始，
+ *        繁忙的网卡不会一直占用其他网卡的份额
  * 
+ * @param budget 本次最多处理的帧数
+ * @return int 实际处理的帧数，所有网卡都出错时为-1
  */
-void ethernet_poll()
+int ethernet_poll(int budget)
 {
-    if (driver_recv(&rxbuf) > 0)
-        ethernet_in(&rxbuf);
+    static int first; //本次最先轮询的网卡
+    int done = 0, err = 0;
+    if (net_if_nr == 0)
+        return 0;
+    for (int n = 0; n < net_if_nr && done < budget; n++)
+    {
+        net_if_t *netif = net_if_get((first + n) % net_if_nr);
+        if (netif->drv == NULL)
+            continue;
+        int left = net_if_nr - n;
+        int cnt = ethernet_poll_if(netif->drv, (budget - done + left - 1) / left);
+        if (cnt < 0)
+            err = 1;
+        else
+            done += cnt;
+    }
+    first = (first + 1) % net_if_nr;
+    return done == 0 && err ? -1 : done;
 }
@@ -1,25 +1,36 @@
 #include "icmp.h"
 #include "ip.h"
+#include "netif.h"
+#include "checksum.h"
 #include <string.h>
 #include <stdio.h>
 
 int flag = 0;
 
+/**
+ * @brief 发送数据包使用的buffer
+ * 
+ */
+static buf_t txbuf;
+
 /**
  * @brief 处理一个收到的数据包
  *        你首先要检查buf长度是否小于icmp头部长度
  *        接着，查看该报文的ICMP类型是否为回显请求，
- *        如果是，则回送一个回显应答（ping应答），需要自行封装应答包。
+ *        如果是，则验证其校验和，正确时回送一个回显应答（ping应答），需要自行封装应答包。
+ *        如果是目的不可达中的需要分片（RFC 1191），且原数据报是本机发出、设置了DF的udp或icmp数据报，
+ *        则降低到原数据报目的地址的路径MTU。
  * 
  *        应答包封装如下：
  *        首先调用buf_init()函数初始化txbuf，然后封装报头和数据，
  *        数据部分可以拷贝来自接收到的回显请求报文中的数据。
- *        最后将封装好的ICMP报文发送到IP层。  
+ *        最后将封装好的ICMP报文发送到IP层，应答的源地址为请求的目的地址。  
  * 
  * @param buf 要处理的数据包
  * @param src_ip 源ip地址
+ * @param dest_ip 目的ip地址，本机的某个地址
  */
-void icmp_in(buf_t *buf, uint8_t *src_ip)
+void icmp_in(buf_t *buf, uint8_t *src_ip, uint8_t *dest_ip)
 {
     // TODO
     // 检查buf长度是否小于icmp头部长度
@@ -29,65 +40,103 @@ void icmp_in(buf_t *buf, uint8_t *src_ip)
     uint16_t *p_16 = (uint16_t *)buf->data;
     //回显请求
     if(p[0]==8 && p[1]==0){
-        //回送回显应答
+        //回送回显应答，标识符、序列号与可选数据原样拷贝
         buf_init(&txbuf,buf->len);
         uint8_t *p2 = txbuf.data;
         uint16_t *p2_16 = (uint16_t *)txbuf.data;
-        //TYPE
+        //拷贝的同时验证请求的校验和，损坏的请求不应答
+        if(csum_fold(csum_partial_copy(p2,p,buf->len,0))!=0)
+            return;
+        //TYPE 回显请求8改为回显应答0，CODE为0
+        uint16_t type_code = p2_16[0];
         p2[0]=0;
-        //CODE
         p2[1]=0;
-        //标识符
-        p2_16[2] = p_16[2];
-        //序列号
-        p2_16[3] = p_16[3];
-        //可选数据
-        for(int i=0;i<buf->len-8;i++){
-            p2[8+i]=p[8+i];
-        }
-        //检验和
-        p2_16[1] = 0;
-        p2_16[1] =checksum16(p2_16,buf->len/2);
-        p2_16[1] =swap16(p2_16[1]);
-        ip_out(&txbuf,src_ip,NET_PROTOCOL_ICMP);
+        //检验和 只有类型字段变化，增量修改，与报文长度无关
+        csum_replace2(&p2_16[1],type_code,p2_16[0]);
+        ip_out_from(&txbuf,dest_ip,src_ip,NET_PROTOCOL_ICMP);
+    }else if(p[0]==ICMP_TYPE_UNREACH && p[1]==ICMP_CODE_FRAG_NEEDED && buf->len>=8+20){
+        //需要分片：第7、8字节为下一跳MTU，之后是本机发出的原数据报的首部
+        //只有本机发出、设置了DF的udp或icmp数据报才会引起该报文，其它的是伪造的，不能用来降低路径MTU
+        ip_hdr_t *orig = (ip_hdr_t *)(p+8);
+        if(net_if_local(orig->src_ip) && (orig->flags_fragment & swap16(IP_DONT_FRAGMENT << 8))
+           && (orig->protocol==NET_PROTOCOL_UDP || orig->protocol==NET_PROTOCOL_ICMP))
+            ip_pmtu_update(orig->dest_ip,swap16(p_16[3]),swap16(orig->total_len));
     }
 
 }
 
 /**
- * @brief 发送icmp不可达
- *        你需要首先调用buf_init初始化buf，长度为ICMP头部 + IP头部 + 原始IP数据报中的前8字节 
- *        填写ICMP报头首部，类型值为目的不可达
- *        填写校验和
- *        将封装好的ICMP数据报发送到IP层。
+ * @brief 发送一个icmp差错报文
+ *        长度为ICMP头部 + IP头部 + 原始IP数据报中的前8字节
+ *        原数据报发往本机的某个地址时以该地址为源地址
  * 
  * @param recv_buf 收到的ip数据包
  * @param src_ip 源ip地址
- * @param code icmp code，协议不可达或端口不可达
+ * @param type icmp类型
+ * @param code icmp代码
+ * @param mtu 需要分片时的下一跳MTU，其它差错为0
  */
-void icmp_unreachable(buf_t *recv_buf, uint8_t *src_ip, icmp_code_t code)
+static void icmp_error(buf_t *recv_buf, uint8_t *src_ip, icmp_type_t type, int code, uint16_t mtu)
 {
-    // TODO
     buf_init(&txbuf,8+20+8);
     uint8_t *p = txbuf.data;
     uint16_t *p_16 = (uint16_t *)txbuf.data;
     uint8_t *p2 = recv_buf->data;
     //TYPE
-    p[0]=3;
+    p[0]=type;
     //code
     p[1] = code;
-    //未使用
+    //未使用，需要分片时第7、8字节为下一跳MTU
     p_16[2]=0;
-    p_16[3]=0;
+    p_16[3]=swap16(mtu);
     //IP首部+数据报中数据的前8字节
     for(int i=0;i<20+8;i++){
         p[8+i]=p2[i];
     }
     //检验和
     p_16[1]=0;
-    p_16[1]=checksum16(p_16,txbuf.len);
+    p_16[1]=checksum16(p_16,txbuf.len/2);
     p_16[1]=swap16(p_16[1]);
-    ip_out(&txbuf,src_ip,NET_PROTOCOL_ICMP);
-    
+    //原数据报发往本机时以其目的地址回送，转发的数据报按出口网卡选择源地址
+    ip_out_from(&txbuf,net_if_local(p2+16) ? p2+16 : NULL,src_ip,NET_PROTOCOL_ICMP);
 }
 
+/**
+ * @brief 发送icmp不可达
+ *        你需要首先调用buf_init初始化buf，长度为ICMP头部 + IP头部 + 原始IP数据报中的前8字节 
+ *        填写ICMP报头首部，类型值为目的不可达
+ *        填写校验和
+ *        将封装好的ICMP数据报发送到IP层。
+ * 
+ * @param recv_buf 收到的ip数据包
+ * @param src_ip 源ip地址
+ * @param code icmp code，协议不可达或端口不可达
+ */
+void icmp_unreachable(buf_t *recv_buf, uint8_t *src_ip, icmp_code_t code)
+{
+    // TODO
+    icmp_error(recv_buf,src_ip,ICMP_TYPE_UNREACH,code,0);
+}
+
+/**
+ * @brief 转发时TTL耗尽，发送icmp超时（代码0：传输中TTL为0）
+ * 
+ * @param recv_buf 收到的ip数据包
+ * @param src_ip 源ip地址
+ */
+void icmp_time_exceeded(buf_t *recv_buf, uint8_t *src_ip)
+{
+    icmp_error(recv_buf,src_ip,ICMP_TYPE_TIME_EXCEEDED,0,0);
+}
+
+/**
+ * @brief 转发时数据报超过出口网卡MTU且设置了DF，发送icmp需要分片（RFC 1191）
+ * 
+ * @param recv_buf 收到的ip数据包
+ * @param src_ip 源ip地址
+ * @param mtu 出口网卡的MTU
+ */
+void icmp_frag_needed(buf_t *recv_buf, uint8_t *src_ip, uint16_t mtu)
+{
+    icmp_error(recv_buf,src_ip,ICMP_TYPE_UNREACH,ICMP_CODE_FRAG_NEEDED,mtu);
+}
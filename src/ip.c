@@ -2,9 +2,611 @@
 #include "arp.h"
 #include "icmp.h"
 #include "udp.h"
+#include "driver.h"
+#include "checksum.h"
+#include "timer.h"
+#include "route.h"
+#include "netif.h"
+#include "config.h"
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+
+/**
+ * @brief 分片的协议头段与引用原数据包负载的段，两者组成一个分散/聚集链
+ * 
+ */
+static buf_t frag_hdr, frag_data;
+
+/**
+ * @brief 每个分片的最大负载长度：MTU减去ip首部，向下取8的倍数（片偏移的单位）
+ * 
+ */
+#define IP_FRAG_PAYLOAD_MAX(mtu) (((mtu) - (int)sizeof(ip_hdr_t)) & ~(IP_HDR_OFFSET_PER_BYTE - 1))
+
+/**
+ * @brief 路径MTU缓存，按目的地址直接映射，冲突时覆盖（丢失的值会被再次探测到）
+ * 
+ */
+typedef struct ip_pmtu_entry
+{
+    uint8_t ip[NET_IP_LEN]; //目的ip
+    uint16_t mtu;           //路径MTU，0为空
+    uint64_t expires;       //过期时间(ms)
+} ip_pmtu_entry_t;
+
+static ip_pmtu_entry_t ip_pmtu_cache[IP_PMTU_CACHE_NR];
+
+/**
+ * @brief RFC 1191中的MTU平台表，下一跳MTU为0时从中取小于原数据报长度的最大值
+ * 
+ */
+static const uint16_t ip_pmtu_plateau[] = {32000, 17914, 8166, 4352, 2002, 1492, 1006, 508, 296, 68};
+
+static int ip_forwarding = IP_FORWARD; //是否转发目的地址不是本机的数据报
+
+/**
+ * @brief 上一个发出的分片的ip首部
+ *        同一数据报的各个分片只有总长度与标志/片偏移不同，
+ *        后续分片直接拷贝该模板，增量修改这两个字段的校验和
+ * 
+ */
+static ip_hdr_t frag_tmpl;
+static int frag_tmpl_valid;
+
+/**
+ * @brief 正在发送的数据报的源地址，由ip_out_from()设置
+ * 
+ */
+static uint8_t ip_tx_src[NET_IP_LEN];
+
+/**
+ * @brief 重组中的一个分片，引用收到的数据包的缓冲块，不拷贝负载
+ * 
+ */
+typedef struct ip_frag
+{
+    buf_t buf;       //分片的负载
+    uint16_t offset; //负载在数据报中的偏移(B)
+    int next;        //同一数据报的下一个分片，-1为结束
+} ip_frag_t;
+
+/**
+ * @brief 数据报中尚未收到的一段（RFC 815），last为最后一个字节
+ * 
+ */
+typedef struct ip_frag_hole
+{
+    uint16_t first;
+    uint16_t last;
+} ip_frag_hole_t;
+
+/**
+ * @brief 一个重组中的数据报，以(源ip, 目的ip, 标识, 协议)区分
+ * 
+ */
+typedef struct ip_frag_queue
+{
+    int used;                               //是否在使用
+    uint8_t src_ip[NET_IP_LEN];             //源ip
+    uint8_t dest_ip[NET_IP_LEN];            //目的ip
+    uint16_t id;                            //标识，网络字节序
+    uint8_t protocol;                       //上层协议
+    uint8_t hdr_len;                        //第一个分片的首部长度(B)，未收到时为0
+    uint8_t hdr[60];                        //第一个分片的首部，重组后作为数据报的首部
+    uint16_t total;                         //负载总长，未收到最后一个分片时为0
+    int mem;                                //分片占用的缓冲块大小之和
+    int frags;                              //分片链表的表头，-1为空
+    int hole_nr;                            //空洞数，为0时重组完成
+    ip_frag_hole_t holes[IP_FRAG_HOLE_NR];  //空洞
+    uint64_t created;                       //收到第一个到达的分片的时间(ms)
+    net_timer_t timer;                      //超时定时器
+} ip_frag_queue_t;
+
+static ip_frag_queue_t ip_frag_queue[IP_FRAG_QUEUE_NR];
+static ip_frag_t ip_frag[IP_FRAG_NR];
+static int ip_frag_free; //空闲分片链表的表头
+static int ip_frag_mem;  //所有重组中的分片占用的缓冲块大小之和
+
+/**
+ * @brief 重组完成的数据报，各分片的负载只在这里拷贝一次
+ * 
+ */
+static buf_t ip_reasm_buf;
+
+/**
+ * @brief 需要分片转发、直接引用驱动帧内存的数据报的拷贝
+ * 
+ */
+static buf_t ip_fwd_buf;
+
+/**
+ * @brief 初始化ip协议：建立重组分片的空闲链表
+ * 
+ */
+void ip_init()
+{
+    for (int i = 0; i < IP_FRAG_QUEUE_NR; i++)
+        ip_frag_queue[i].used = 0;
+    for (int i = 0; i < IP_FRAG_NR; i++)
+        ip_frag[i].next = i + 1 < IP_FRAG_NR ? i + 1 : -1;
+    ip_frag_free = 0;
+    ip_frag_mem = 0;
+}
+
+/**
+ * @brief 丢弃一个重组中的数据报，释放其所有分片
+ * 
+ * @param q 重组中的数据报
+ */
+static void ip_frag_drop(ip_frag_queue_t *q)
+{
+    int i = q->frags;
+    while (i != -1)
+    {
+        int next = ip_frag[i].next;
+        buf_free(&ip_frag[i].buf);
+        ip_frag[i].next = ip_frag_free;
+        ip_frag_free = i;
+        i = next;
+    }
+    ip_frag_mem -= q->mem;
+    timer_del(&q->timer);
+    q->used = 0;
+}
+
+/**
+ * @brief 重组超时，丢弃已收到的分片
+ * 
+ * @param timer 定时器
+ * @param arg 重组中的数据报
+ */
+static void ip_frag_expire(net_timer_t *timer, void *arg)
+{
+    (void)timer;
+    ip_frag_drop((ip_frag_queue_t *)arg);
+}
+
+/**
+ * @brief 丢弃最早开始重组的数据报，为新的分片腾出空间
+ * 
+ * @param src_ip 只在该源地址的数据报中选择，为NULL时不限
+ * @param keep 不能丢弃的数据报（当前分片所属的），可以为NULL
+ * @return int 丢弃了一个数据报为1，没有可丢弃的为0
+ */
+static int ip_frag_evict(const uint8_t *src_ip, const ip_frag_queue_t *keep)
+{
+    ip_frag_queue_t *oldest = NULL;
+    for (int i = 0; i < IP_FRAG_QUEUE_NR; i++)
+    {
+        ip_frag_queue_t *q = &ip_frag_queue[i];
+        if (!q->used || q == keep || (src_ip && memcmp(q->src_ip, src_ip, NET_IP_LEN)))
+            continue;
+        if (!oldest || q->created < oldest->created)
+            oldest = q;
+    }
+    if (!oldest)
+        return 0;
+    ip_frag_drop(oldest);
+    return 1;
+}
+
+/**
+ * @brief 取一个空闲的重组位置
+ * 
+ * @return ip_frag_queue_t* 空闲的位置，没有时为NULL
+ */
+static ip_frag_queue_t *ip_frag_slot()
+{
+    for (int i = 0; i < IP_FRAG_QUEUE_NR; i++)
+        if (!ip_frag_queue[i].used)
+            return &ip_frag_queue[i];
+    return NULL;
+}
+
+/**
+ * @brief 查找分片所属的数据报，没有时新建
+ *        每个源地址同时重组的数据报不超过IP_FRAG_PER_SRC个，超过或没有空位时丢弃最早的
+ * 
+ * @param hdr 分片的首部
+ * @return ip_frag_queue_t* 重组中的数据报
+ */
+static ip_frag_queue_t *ip_frag_find(const ip_hdr_t *hdr)
+{
+    ip_frag_queue_t *q = NULL;
+    int same_src = 0;
+    for (int i = 0; i < IP_FRAG_QUEUE_NR; i++)
+    {
+        ip_frag_queue_t *e = &ip_frag_queue[i];
+        if (!e->used)
+        {
+            if (!q)
+                q = e;
+            continue;
+        }
+        if (memcmp(e->src_ip, hdr->src_ip, NET_IP_LEN))
+            continue;
+        if (e->id == hdr->id && e->protocol == hdr->protocol && memcmp(e->dest_ip, hdr->dest_ip, NET_IP_LEN) == 0)
+            return e;
+        same_src++;
+    }
+    //超过每个源地址的上限时丢弃该源地址最早的数据报，腾出的位置可以直接使用，
+    //只有仍然没有空位时才丢弃其它源地址的数据报
+    if (same_src >= IP_FRAG_PER_SRC)
+        ip_frag_evict(hdr->src_ip, NULL);
+    if (!q)
+        q = ip_frag_slot();
+    if (!q)
+    {
+        ip_frag_evict(NULL, NULL);
+        q = ip_frag_slot();
+    }
+    q->used = 1;
+    memcpy(q->src_ip, hdr->src_ip, NET_IP_LEN);
+    memcpy(q->dest_ip, hdr->dest_ip, NET_IP_LEN);
+    q->id = hdr->id;
+    q->protocol = hdr->protocol;
+    q->hdr_len = 0;
+    q->total = 0;
+    q->mem = 0;
+    q->frags = -1;
+    q->hole_nr = 1;
+    q->holes[0].first = 0;
+    q->holes[0].last = UINT16_MAX;
+    q->created = timer_now();
+    timer_setup(&q->timer, ip_frag_expire, q);
+    timer_mod(&q->timer, q->created + IP_FRAG_TIMEOUT_SEC * 1000);
+    return q;
+}
+
+/**
+ * @brief 用一个分片填补数据报的空洞（RFC 815）
+ *        分片必须完整地落在一个空洞内；与已收到的数据部分重叠时整个数据报作废（同RFC 5722），
+ *        与已收到的数据完全重复时忽略该分片
+ * 
+ * @param q 重组中的数据报
+ * @param first 分片负载的第一个字节在数据报中的偏移
+ * @param last 分片负载的最后一个字节在数据报中的偏移
+ * @param mf 是否还有后续分片
+ * @return int 填入为0，重复为1，数据报作废为-1
+ */
+static int ip_frag_fill(ip_frag_queue_t *q, uint16_t first, uint16_t last, int mf)
+{
+    if (q->total && (last >= q->total || (!mf && last + 1 != q->total)))
+        return -1;
+    for (int i = 0; i < q->hole_nr; i++)
+    {
+        ip_frag_hole_t hole = q->holes[i];
+        if (first > hole.last || last < hole.first)
+            continue;
+        if (first < hole.first || last > hole.last)
+            return -1;
+        if (!mf && last < hole.last && hole.last != UINT16_MAX)
+            return -1; //最后一个分片之后还有已收到的数据
+        q->holes[i] = q->holes[--q->hole_nr];
+        if (first > hole.first)
+        {
+            q->holes[q->hole_nr].first = hole.first;
+            q->holes[q->hole_nr++].last = first - 1;
+        }
+        if (mf && last < hole.last)
+        {
+            if (q->hole_nr == IP_FRAG_HOLE_NR)
+                return -1;
+            q->holes[q->hole_nr].first = last + 1;
+            q->holes[q->hole_nr++].last = hole.last;
+        }
+        if (!mf)
+            q->total = last + 1;
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief 处理一个收到的分片
+ *        分片只引用收到的数据包的缓冲块（驱动直接引用帧内存时才拷贝），
+ *        全部到齐后按偏移拷贝到一个缓冲区中，组成完整的数据报
+ * 
+ * @param buf 分片，首部已检查过
+ * @return buf_t* 重组完成的数据报，尚未完成或分片被丢弃时为NULL
+ */
+static buf_t *ip_reassemble(buf_t *buf)
+{
+    ip_hdr_t *hdr = (ip_hdr_t *)buf->data;
+    int hdr_len = hdr->hdr_len * IP_HDR_LEN_PER_BYTE;
+    int len = swap16(hdr->total_len) - hdr_len;
+    uint16_t flags_fragment = swap16(hdr->flags_fragment);
+    int offset = (flags_fragment & IP_OFFSET_MASK) * IP_HDR_OFFSET_PER_BYTE;
+    int mf = (flags_fragment >> 8) & IP_MORE_FRAGMENT;
+    //除最后一个分片外长度必须是8的倍数，数据报不能超过65535字节
+    if (len <= 0 || (mf && len % IP_HDR_OFFSET_PER_BYTE) || hdr_len + offset + len > UINT16_MAX)
+        return NULL;
+
+    ip_frag_queue_t *q = ip_frag_find(hdr);
+    int r = ip_frag_fill(q, offset, offset + len - 1, mf);
+    if (r)
+    {
+        if (r < 0)
+            ip_frag_drop(q);
+        return NULL;
+    }
+    if (offset == 0)
+    {
+        q->hdr_len = hdr_len;
+        memcpy(q->hdr, hdr, hdr_len);
+    }
+
+    //保存分片，超出内存预算时丢弃最早的数据报
+    if (ip_frag_free == -1)
+        ip_frag_evict(NULL, q);
+    int i = ip_frag_free;
+    if (i == -1)
+    {
+        ip_frag_drop(q);
+        return NULL;
+    }
+    ip_frag_free = ip_frag[i].next;
+    buf_clone(&ip_frag[i].buf, buf);
+    buf_remove_header(&ip_frag[i].buf, hdr_len);
+    ip_frag[i].buf.len = len; //去掉以太网帧的填充
+    ip_frag[i].offset = offset;
+    ip_frag[i].next = q->frags;
+    q->frags = i;
+    int size = ip_frag[i].buf.block ? (int)ip_frag[i].buf.block->size : len;
+    q->mem += size;
+    ip_frag_mem += size;
+    while (ip_frag_mem > IP_FRAG_MEM_MAX && ip_frag_evict(NULL, q))
+        ;
+    if (ip_frag_mem > IP_FRAG_MEM_MAX)
+    {
+        ip_frag_drop(q);
+        return NULL;
+    }
+    if (q->hole_nr)
+        return NULL;
+
+    //全部到齐，拼成完整的数据报，修改首部的总长度与标志/片偏移
+    int total = q->hdr_len + q->total;
+    buf_init(&ip_reasm_buf, total);
+    memcpy(ip_reasm_buf.data, q->hdr, q->hdr_len);
+    for (i = q->frags; i != -1; i = ip_frag[i].next)
+        memcpy(ip_reasm_buf.data + q->hdr_len + ip_frag[i].offset, ip_frag[i].buf.data, ip_frag[i].buf.len);
+    ip_frag_drop(q);
+    hdr = (ip_hdr_t *)ip_reasm_buf.data;
+    hdr->total_len = swap16((uint16_t)total);
+    hdr->flags_fragment = 0;
+    hdr->hdr_checksum = 0;
+    hdr->hdr_checksum = csum_fold(csum_partial(hdr, hdr->hdr_len * IP_HDR_LEN_PER_BYTE, 0));
+    return &ip_reasm_buf;
+}
+
+/**
+ * @brief 取目的地址在路径MTU缓存中对应的表项
+ * 
+ * @param ip 目的ip地址
+ * @return ip_pmtu_entry_t* 表项，不一定属于该地址
+ */
+static ip_pmtu_entry_t *ip_pmtu_slot(const uint8_t *ip)
+{
+    uint32_t key;
+    memcpy(&key, ip, NET_IP_LEN);
+    return &ip_pmtu_cache[((key * 0x9e3779b1u) >> 16) & (IP_PMTU_CACHE_NR - 1)];
+}
+
+/**
+ * @brief 按路由表选择发往目的地址的出口网卡与下一跳
+ * 
+ * @param dest_ip 目的ip地址
+ * @param next_hop 下一跳，经网关转发时为网关地址，直连或没有路由时为目的地址本身
+ * @return net_if_t* 出口网卡，没有路由时为0号网卡
+ */
+net_if_t *ip_route(const uint8_t *dest_ip, const uint8_t **next_hop)
+{
+    route_entry_t *r = route_lookup(dest_ip);
+    *next_hop = r && r->has_gw ? r->gw : dest_ip;
+    return net_if_get(r ? r->if_index : 0);
+}
+
+/**
+ * @brief 获取到目的地址的路径MTU
+ * 
+ * @param ip 目的ip地址
+ * @return int 缓存的路径MTU，没有缓存或已过期时为出口网卡的MTU
+ */
+int ip_pmtu(const uint8_t *ip)
+{
+    const uint8_t *nh;
+    int mtu = ip_route(ip, &nh)->mtu;
+    ip_pmtu_entry_t *e = ip_pmtu_slot(ip);
+    if (e->mtu == 0 || memcmp(e->ip, ip, NET_IP_LEN))
+        return mtu;
+    if (timer_now() >= e->expires)
+    {
+        e->mtu = 0; //过期后按网卡MTU发送，路径仍然较小时会再收到"需要分片"
+        return mtu;
+    }
+    return e->mtu < mtu ? e->mtu : mtu;
+}
+
+/**
+ * @brief 收到icmp"需要分片"报文时降低到目的地址的路径MTU（RFC 1191）
+ *        只会降低，不低于IP_PMTU_MIN；IP_PMTU_TIMEOUT_SEC后过期
+ * 
+ * @param ip 原数据报的目的ip地址
+ * @param mtu 报文中的下一跳MTU，为0时（旧路由器不填）按原数据报长度估计
+ * @param len 原数据报的总长度
+ */
+void ip_pmtu_update(const uint8_t *ip, int mtu, int len)
+{
+    if (mtu == 0)
+    {
+        for (int i = 0; i < (int)(sizeof(ip_pmtu_plateau) / sizeof(ip_pmtu_plateau[0])); i++)
+            if (ip_pmtu_plateau[i] < len)
+            {
+                mtu = ip_pmtu_plateau[i];
+                break;
+            }
+    }
+    if (mtu < IP_PMTU_MIN)
+        mtu = IP_PMTU_MIN;
+    if (mtu >= ip_pmtu(ip))
+        return;
+    ip_pmtu_entry_t *e = ip_pmtu_slot(ip);
+    memcpy(e->ip, ip, NET_IP_LEN);
+    e->mtu = mtu;
+    e->expires = timer_now() + IP_PMTU_TIMEOUT_SEC * 1000;
+}
+
+/**
+ * @brief 设置是否转发目的地址不是本机的数据报，需在net_init()之前调用
+ * 
+ * @param on 为1时转发
+ */
+void ip_set_forward(int on)
+{
+    ip_forwarding = on;
+}
+
+/**
+ * @brief 查询是否开启了转发
+ * 
+ * @return int 开启为1
+ */
+int ip_forward_enabled()
+{
+    return ip_forwarding;
+}
+
+/**
+ * @brief 补全收到的尚未计算校验和的数据包（BUF_F_CSUM_PARTIAL）的传输层校验和
+ *        校验和字段中已有伪首部的和，从csum_start到数据包结尾求和即可
+ * 
+ * @param buf 收到的数据报，data指向ip首部
+ * @return int 成功为0，补全位置超出数据包为-1
+ */
+static int ip_csum_finish(buf_t *buf)
+{
+    if (buf->csum_start + buf->csum_offset + 2 > buf->len)
+        return -1;
+    uint16_t *check = (uint16_t *)(buf->data + buf->csum_start + buf->csum_offset);
+    *check = csum_fold(csum_partial(buf->data + buf->csum_start, buf->len - buf->csum_start, 0));
+    if (*check == 0 && ((ip_hdr_t *)buf->data)->protocol == NET_PROTOCOL_UDP)
+        *check = 0xffff; //udp中0表示没有校验和
+    buf->flags &= ~BUF_F_CSUM_PARTIAL;
+    return 0;
+}
+
+/**
+ * @brief 把超过出口网卡MTU的数据报分片转发
+ *        同本机发送的分片一样，每个分片是协议头段 + 引用原数据报负载的段；
+ *        第一个分片带原首部的全部选项，之后的分片只带20字节的基本首部。
+ *        原数据报本身是分片时，新分片的片偏移从它的片偏移算起，最后一个新分片保留它的MF
+ * 
+ * @param buf 收到的数据报，TTL已减1
+ * @param out 出口网卡
+ * @param next_hop 下一跳
+ * @return int 全部发出或等待arp解析为0，否则为第一个发不出的分片的结果
+ */
+static int ip_forward_fragment(buf_t *buf, net_if_t *out, uint8_t *next_hop)
+{
+    //直接引用驱动帧内存的数据报先拷贝一次，各分片再共享同一缓冲块
+    if (buf->block == NULL)
+    {
+        buf_copy(&ip_fwd_buf, buf);
+        buf = &ip_fwd_buf;
+    }
+    ip_hdr_t *hdr = (ip_hdr_t *)buf->data;
+    int hdr_len = hdr->hdr_len * IP_HDR_LEN_PER_BYTE;
+    int len = buf->len - hdr_len;
+    uint16_t flags_fragment = swap16(hdr->flags_fragment);
+    int base = flags_fragment & IP_OFFSET_MASK;
+    int mf = flags_fragment & (IP_MORE_FRAGMENT << 8);
+    int ret = 0;
+    for (int off = 0, n; off < len && ret == 0; off += n)
+    {
+        int h = off ? (int)sizeof(ip_hdr_t) : hdr_len;
+        n = (out->mtu - h) & ~(IP_HDR_OFFSET_PER_BYTE - 1);
+        if (n > len - off)
+            n = len - off;
+        buf_init(&frag_hdr, h);
+        memcpy(frag_hdr.data, hdr, sizeof(ip_hdr_t));
+        if (off == 0)
+            memcpy(frag_hdr.data + sizeof(ip_hdr_t), buf->data + sizeof(ip_hdr_t), hdr_len - sizeof(ip_hdr_t));
+        ip_hdr_t *fh = (ip_hdr_t *)frag_hdr.data;
+        fh->hdr_len = h / IP_HDR_LEN_PER_BYTE;
+        fh->total_len = swap16(h + n);
+        fh->flags_fragment = swap16((off + n < len ? IP_MORE_FRAGMENT << 8 : mf) | (base + off / IP_HDR_OFFSET_PER_BYTE));
+        fh->hdr_checksum = 0;
+        fh->hdr_checksum = csum_fold(csum_partial(fh, h, 0));
+        frag_hdr.if_index = out->index;
+        buf_slice(&frag_data, buf, hdr_len + off, n);
+        frag_hdr.next = &frag_data;
+        ret = arp_out(&frag_hdr, next_hop, NET_PROTOCOL_IP);
+    }
+    buf_free(&frag_data); //不再引用原数据报的缓冲块
+    return ret;
+}
+
+/**
+ * @brief 转发一个目的地址不是本机的数据报
+ *        不转发广播与组播；TTL耗尽时回送icmp超时；按最长前缀匹配查路由表，
+ *        没有路由时回送icmp网络不可达；TTL减1并增量修改首部校验和后从路由的出口网卡发往下一跳。
+ *        超过出口网卡MTU的数据报：设置了DF时丢弃，回送携带出口网卡MTU的icmp需要分片（RFC 1191），
+ *        否则分片转发。
+ *        本机内核产生、校验和尚未补全的数据包，出口网卡不能补全或需要分片时在这里补全。
+ *        不分片的数据报不做拷贝，以太网头直接写在收到的帧的以太网头位置
+ * 
+ * @param buf 收到的数据报，首部已检查过，len已去掉以太网帧的填充
+ */
+static void ip_forward(buf_t *buf)
+{
+    ip_hdr_t *hdr = (ip_hdr_t *)buf->data;
+    uint8_t src_ip[NET_IP_LEN], dest_ip[NET_IP_LEN];
+    memcpy(src_ip, hdr->src_ip, NET_IP_LEN);
+    memcpy(dest_ip, hdr->dest_ip, NET_IP_LEN);
+    if (dest_ip[0] >= 224)
+        return; //组播、广播与保留地址
+    //icmp差错只针对第一个分片回送
+    int first = (swap16(hdr->flags_fragment) & IP_OFFSET_MASK) == 0;
+    if (hdr->ttl <= 1)
+    {
+        if (first)
+            icmp_time_exceeded(buf, src_ip);
+        return;
+    }
+    route_entry_t *r = route_lookup(dest_ip);
+    if (r == NULL)
+    {
+        if (first)
+            icmp_unreachable(buf, src_ip, ICMP_CODE_NET_UNREACH);
+        return;
+    }
+    net_if_t *out = net_if_get(r->if_index);
+    int frag = buf->len > out->mtu;
+    if (frag && (hdr->flags_fragment & swap16(IP_DONT_FRAGMENT << 8)))
+    {
+        if (first)
+            icmp_frag_needed(buf, src_ip, out->mtu);
+        return;
+    }
+    //分片后网卡无法再按整个数据报补全校验和
+    if ((buf->flags & BUF_F_CSUM_PARTIAL) && (frag || !(out->offload & DRIVER_OFFLOAD_TX_CSUM)) && ip_csum_finish(buf) == -1)
+        return;
+    //ttl与协议组成首部中的一个16位字，用memcpy读取以免与hdr->ttl的写入重排
+    uint16_t from, to;
+    memcpy(&from, &hdr->ttl, sizeof(from));
+    hdr->ttl--;
+    memcpy(&to, &hdr->ttl, sizeof(to));
+    csum_replace2(&hdr->hdr_checksum, from, to);
+    buf->if_index = out->index;
+    //发送队列已满时丢弃，同路由器的尾部丢弃
+    if (frag)
+        ip_forward_fragment(buf, out, r->has_gw ? r->gw : dest_ip);
+    else
+        arp_out(buf, r->has_gw ? r->gw : dest_ip, NET_PROTOCOL_IP);
+}
+
 /**
  * @brief 处理一个收到的数据包
  *        你首先需要做报头检查，检查项包括：版本号、总长度、首部长度等。
@@ -13,7 +615,8 @@
  *        调用checksum16()函数计算头部检验和，比较计算的结果与之前缓存的校验和是否一致，
  *        如果不一致，则不处理该数据报。
  * 
- *        检查收到的数据包的目的IP地址是否为本机的IP地址，只处理目的IP为本机的数据报。
+ *        检查收到的数据包的目的IP地址是否为本机任意网卡的IP地址，只处理目的IP为本机的数据报；
+ *        开启转发时，目的IP不是本机的数据报交给ip_forward()转发。
  * 
  *        检查IP报头的协议字段：
  *        如果是ICMP协议，则去掉IP头部，发送给ICMP协议层处理
@@ -43,39 +646,54 @@ void ip_in(buf_t *buf)
     a = (p[1] << 7) >> 7;
     if(a != 0)
         return;
-    //总长度  46~1500
+    //总长度  不超过收到它的网卡的MTU
     uint16_t len = p16[1];
     len = swap16(len);
     /*
         之前为if(len>1500||len<46)
     */
-    if(len>1500)
+    if(len>net_if_get(buf->if_index)->mtu)
         return;
-    //首部校验和
+    //首部校验和，内核的校验和卸载只涉及传输层，首部总要验证
     uint16_t check;
     //b单位为4B
     check = checksum16((uint16_t*)buf->data,(int)b*4/2);
     if(check!=0)
         return;
-    //目的IP
-    for(int i=0;i<4;i++){
-        if(p[16+i]!=net_if_ip[i])
+    //目的IP  不是本机时转发或丢弃
+    if(net_if_local(p+16)==NULL){
+        if(ip_forwarding && len<=buf->len){
+            buf->len = len;
+            ip_forward(buf);
+        }
+        return;
+    }
+    //分片：交给重组，到齐后按完整的数据报继续处理
+    if(p16[3] & swap16(IP_MORE_FRAGMENT << 8 | IP_OFFSET_MASK)){
+        if(len>buf->len)
             return;
+        buf = ip_reassemble(buf);
+        if(buf == NULL)
+            return;
+        p = buf->data;
+        b = p[0] & 0xf;
     }
-    //源IP
-    uint8_t src_ip[4];
-    for(int i=0;i<4;i++)
+    //源IP与目的IP
+    uint8_t src_ip[4],dest_ip[4];
+    for(int i=0;i<4;i++){
         src_ip[i]=p[12+i];
+        dest_ip[i]=p[16+i];
+    }
     if(p[9]==NET_PROTOCOL_ICMP){
         //ICMP
         //b单位为4B
         buf_remove_header(buf,b*4);
-        icmp_in(buf,src_ip);
+        icmp_in(buf,src_ip,dest_ip);
     }else if(p[9]==NET_PROTOCOL_UDP){
         //UDP
         //b单位为4B
         buf_remove_header(buf,b*4);
-        udp_in(buf,src_ip);
+        udp_in(buf,src_ip,dest_ip);
     }else{
         //printf("调用icmp_unreachable\n");
         icmp_unreachable(buf,src_ip,ICMP_CODE_PROTOCOL_UNREACH);
@@ -97,11 +715,26 @@ void ip_in(buf_t *buf)
  * @param id 数据包id
  * @param offset 分片offset，必须被8整除
  * @param mf 分片mf标志，是否有下一个分片
+ * @return int 已发出或等待arp解析为0，驱动发送队列已满为DRIVER_TX_BUSY，丢弃为-1
  */
-void ip_fragment_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol, int id, uint16_t offset, int mf)
+int ip_fragment_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol, int id, uint16_t offset, int mf)
 {
     // TODO
     buf_add_header(buf,20);
+    ip_hdr_t *hdr = (ip_hdr_t *)buf->data;
+    uint16_t total_len = swap16(buf_chain_len(buf));
+    uint16_t flags_fragment = swap16((mf ? IP_MORE_FRAGMENT << 8 : 0) | (buf->flags & BUF_F_DF ? IP_DONT_FRAGMENT << 8 : 0) | offset);
+    //同一数据报的后续分片：拷贝上一个分片的首部，增量修改校验和，与首部长度无关
+    if(frag_tmpl_valid && frag_tmpl.id == swap16((uint16_t)id) && frag_tmpl.protocol == protocol &&
+       memcmp(frag_tmpl.dest_ip,ip,NET_IP_LEN) == 0 && memcmp(frag_tmpl.src_ip,ip_tx_src,NET_IP_LEN) == 0){
+        *hdr = frag_tmpl;
+        csum_replace2(&hdr->hdr_checksum,hdr->total_len,total_len);
+        hdr->total_len = total_len;
+        csum_replace2(&hdr->hdr_checksum,hdr->flags_fragment,flags_fragment);
+        hdr->flags_fragment = flags_fragment;
+        frag_tmpl = *hdr;
+        return arp_out(buf,(uint8_t *)route_next_hop(ip),NET_PROTOCOL_IP);
+    }
     uint8_t *p = buf->data;
     // 16位指针   使用16位指针时 使用swap16 交换大小端
     uint16_t *p16 = (uint16_t *)buf->data;
@@ -112,8 +745,8 @@ void ip_fragment_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol, int id, u
     p[0] += 0x05;
     //区分服务  最后一位为0
     p[1] = 0;
-    //总长度  
-    p16[1]=buf->len;
+    //总长度  分片可能是协议头段+负载段组成的链
+    p16[1]=buf_chain_len(buf);
     p16[1] = swap16(p16[1]);
     //标识
     p16[2]=(uint16_t)id;
@@ -122,6 +755,9 @@ void ip_fragment_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol, int id, u
     //标志 总共3位  位1为保留，位2 DF表示禁止分片  位3 MF表示更多分片
     p[6]=0;
     p[6] |= (mf<<5);   
+    //上层要求不分片时置DF位
+    if(buf->flags & BUF_F_DF)
+        p[6] |= IP_DONT_FRAGMENT;
     //片偏移
     p[7]=0;
     offset = swap16(offset);
@@ -133,7 +769,7 @@ void ip_fragment_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol, int id, u
     p[9] = protocol;
     //源IP
     for(int i=0;i<4;i++){
-        p[12+i] = net_if_ip[i];
+        p[12+i] = ip_tx_src[i];
     }
     //目的IP
     for(int i=0;i<4;i++){
@@ -144,49 +780,91 @@ void ip_fragment_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol, int id, u
     //当做长度为16位的数计算  所以长度为20/2=10
     p16[5] = checksum16((uint16_t*)buf->data,10);
     p16[5] = swap16(p16[5]);
-    arp_out(buf,ip,NET_PROTOCOL_IP);
+    frag_tmpl = *hdr;
+    frag_tmpl_valid = 1;
+    //按路由表发往网关，没有路由时直接发往目的地址
+    return arp_out(buf,(uint8_t *)route_next_hop(ip),NET_PROTOCOL_IP);
     
 }
 
 /**
  * @brief 处理一个要发送的数据包
- *        你首先需要检查需要发送的IP数据报是否大于以太网帧的最大包长（1500字节 - ip包头长度）。
+ *        你首先需要检查需要发送的IP数据报是否大于每个分片的最大负载（路径MTU - ip包头长度，向下取8的倍数）。
  *        
  *        如果超过，则需要分片发送。 
  *        分片步骤：
- *        （1）调用buf_init()函数初始化buf，长度为以太网帧的最大包长（1500字节 - ip包头头长度）
- *        （2）将数据报截断，每个截断后的包长度 = 以太网帧的最大包长，调用ip_fragment_out()函数发送出去
- *        （3）如果截断后最后的一个分片小于或等于以太网帧的最大包长，
- *             调用buf_init()函数初始化buf，长度为该分片大小，再调用ip_fragment_out()函数发送出去
- *             注意：最后一个分片的MF = 0
+ *        （1）调用buf_init()函数初始化一个只用来装协议头的buf，
+ *             再用buf_slice()引用原数据报中从当前偏移开始、长度不超过最大负载的一片，链在其后
+ *        （2）调用ip_fragment_out()函数发送协议头段与负载段组成的链，
+ *             负载不做拷贝，由驱动直接发送；原数据报不做修改，后续分片的首部不会覆盖已发送的负载
+ *        （3）最后一个分片同样按链发送，注意：最后一个分片的MF = 0
  *    
- *        如果没有超过以太网帧的最大包长，则直接调用调用ip_fragment_out()函数发送出去。
+ *        如果没有超过最大负载，则直接调用调用ip_fragment_out()函数发送出去。
+ * 
+ *        如果网卡支持udp分片卸载，超过最大负载的udp数据包不在本地分片，
+ *        整个交给网卡，由内核按最大负载分片。
+ * 
+ *        上层设置了BUF_F_DF的数据包置DF位整个发送，不分片；超过路径MTU时丢弃。
+ * 
+ *        源地址由出口网卡上与下一跳同一子网的地址决定。
  * 
  * @param buf 要处理的包
  * @param ip 目标ip地址
  * @param protocol 上层协议
+ * @return int 已发出或等待arp解析为0，驱动发送队列已满为DRIVER_TX_BUSY，丢弃为-1
  */
-void ip_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol)
+int ip_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol)
 {
     // TODO 
+    return ip_out_from(buf,NULL,ip,protocol);
+}
+
+/**
+ * @brief 以指定的源地址发送一个ip数据包
+ *        按路由表选择出口网卡，数据包及其各个分片都从该网卡发出，分片过程同ip_out()
+ *        有分片发不出时不再发送其余分片，整个数据报交由上层决定是否重发
+ * 
+ * @param buf 要处理的包
+ * @param src_ip 源ip地址，为NULL时按出口网卡与下一跳选择
+ * @param ip 目标ip地址
+ * @param protocol 上层协议
+ * @return int 已发出或等待arp解析为0，驱动发送队列已满为DRIVER_TX_BUSY，丢弃为-1
+ */
+int ip_out_from(buf_t *buf, const uint8_t *src_ip, uint8_t *ip, net_protocol_t protocol)
+{
     static uint16_t x =0;
-    uint8_t* p = buf->data;
-    //offset   单位8B
-    uint16_t offset=0;
-    //检查需要发送的IP数据报是否大于以太网帧的最大包长（1500字节 - ip包头长度）
-    while(buf->len>1480){
-        buf_init(&txbuf,1480);
-        //拷贝数据
-        for(int i=0;i<1480;i++){
-            (txbuf.data)[i] = p[i];
-        }
-        //发送分片
-        ip_fragment_out(&txbuf,ip,protocol,x,offset,1);
-        buf_remove_header(buf,1480);
-        p = buf->data;
-        //单位为8B 所以/8
-        offset += (1480/8);
+    const uint8_t *nh;
+    net_if_t *netif = ip_route(ip,&nh);
+    memcpy(ip_tx_src,src_ip ? src_ip : net_if_src(netif,nh),NET_IP_LEN);
+    buf->if_index = netif->index;
+    int pmtu = ip_pmtu(ip);
+    int frag_max = IP_FRAG_PAYLOAD_MAX(pmtu);
+    //禁止分片，由上层按路径MTU控制数据报大小
+    if(buf->flags & BUF_F_DF){
+        if(buf->len+20>pmtu)
+            return -1;
+        return ip_fragment_out(buf,ip,protocol,x++,0,0);
+    }
+    //udp分片卸载，交给内核分片
+    if(buf->len>frag_max && protocol==NET_PROTOCOL_UDP && (netif->offload & DRIVER_OFFLOAD_TX_UFO)){
+        buf->flags |= BUF_F_GSO_UDP;
+        buf->gso_size = frag_max;
+        return ip_fragment_out(buf,ip,protocol,x++,0,0);
+    }
+    if(buf->len<=frag_max)
+        return ip_fragment_out(buf,ip,protocol,x++,0,0);
+    int ret = 0;
+    //每个分片都是协议头段 + 引用原数据报的负载段，不拷贝数据
+    for(int off=0;off<buf->len && ret==0;off+=frag_max){
+        int n = buf->len-off<frag_max ? buf->len-off : frag_max;
+        buf_init(&frag_hdr,0);
+        frag_hdr.if_index = netif->index;
+        buf_slice(&frag_data,buf,off,n);
+        frag_hdr.next = &frag_data;
+        //offset单位为8B 所以/8
+        ret = ip_fragment_out(&frag_hdr,ip,protocol,x,off/IP_HDR_OFFSET_PER_BYTE,off+n<buf->len);
     }
-    ip_fragment_out(buf,ip,protocol,x,offset,0);
+    buf_free(&frag_data); //不再引用原数据报的缓冲块
     x++;
+    return ret;
 }
@@ -1,8 +1,15 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <signal.h>
 #include "net.h"
 #include "udp.h"
+#include "arp.h"
+#include "driver.h"
+#include "ip.h"
+#include "route.h"
+#include "netif.h"
 
 void handler(udp_entry_t *entry, uint8_t *src_ip, uint16_t src_port, buf_t *buf)
 {
@@ -20,16 +27,136 @@ void handler(udp_entry_t *entry, uint8_t *src_ip, uint16_t src_port, buf_t *buf)
 
     udp_send(data, len, 60000, src_ip, dest_port); //发送udp包
 }
+
+static volatile sig_atomic_t running = 1;
+
+/**
+ * @brief 获取最后添加的网卡，还没有网卡时先添加默认网卡
+ * 
+ * @return net_if_t* 网卡，失败为NULL
+ */
+static net_if_t *last_if()
+{
+    if (net_if_init() == -1)
+        return NULL;
+    return net_if_get(net_if_nr - 1);
+}
+
+/**
+ * @brief 解析"a.b.c.d/len"形式的地址与前缀长度
+ * 
+ * @param spec 要解析的字符串
+ * @param ip 解析出的地址
+ * @param len 解析出的前缀长度
+ * @return int 成功为0，格式错误为-1
+ */
+static int parse_prefix(const char *spec, uint8_t *ip, int *len)
+{
+    int a[4];
+    if (sscanf(spec, "%d.%d.%d.%d/%d", &a[0], &a[1], &a[2], &a[3], len) != 5)
+        return -1;
+    for (int j = 0; j < NET_IP_LEN; j++)
+        ip[j] = a[j];
+    return 0;
+}
+
+void stop(int sig)
+{
+    (void)sig;
+    running = 0;
+}
+
 int main(int argc, char const *argv[])
 {
-    
+    for (int i = 1; i < argc; i++)
+    {
+        // -t 使用高吞吐配置，默认为低延迟配置
+        if (strcmp(argv[i], "-t") == 0)
+            driver_set_profile(DRIVER_PROFILE_THROUGHPUT);
+        // -a <n> arp表容量
+        else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc)
+            arp_set_size(atoi(argv[++i]));
+        // -s <文件> 加载静态邻居文件，每行"ip mac"
+        else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc)
+            arp_set_static_file(argv[++i]);
+        // -c <文件> 启动时从快照文件恢复arp表，定期及退出时保存
+        else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc)
+            arp_set_snapshot_file(argv[++i]);
+        // -i <网卡名> <地址>/<长度> 添加网卡，第一次使用时不再添加默认网卡
+        else if (strcmp(argv[i], "-i") == 0 && i + 2 < argc)
+        {
+            const char *name = argv[++i], *spec = argv[++i];
+            uint8_t ip[NET_IP_LEN];
+            int len;
+            net_if_t *netif;
+            if (parse_prefix(spec, ip, &len) == -1)
+                fprintf(stderr, "Error in main: bad address %s\n", spec);
+            else if ((netif = net_if_add(name, NULL, ETHERNET_MTU)) == NULL || net_if_addr_add(netif, ip, len) == -1)
+                fprintf(stderr, "Error in main: cannot add interface %s\n", name);
+        }
+        // -A <地址>/<长度> 为最后添加的网卡添加辅助地址
+        else if (strcmp(argv[i], "-A") == 0 && i + 1 < argc)
+        {
+            const char *spec = argv[++i];
+            uint8_t ip[NET_IP_LEN];
+            int len;
+            net_if_t *netif = last_if();
+            if (parse_prefix(spec, ip, &len) == -1)
+                fprintf(stderr, "Error in main: bad address %s\n", spec);
+            else if (netif == NULL || net_if_addr_add(netif, ip, len) == -1)
+                fprintf(stderr, "Error in main: cannot add address %s\n", spec);
+        }
+        // -m <mtu> 最后添加的网卡的MTU，如9000使用巨型帧
+        else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc)
+        {
+            net_if_t *netif = last_if();
+            if (netif == NULL || net_if_set_mtu(netif, atoi(argv[++i])) == -1)
+                fprintf(stderr, "Error in main: mtu out of range [%d, %d]\n", ETHERNET_MTU_MIN, ETHERNET_MTU_MAX);
+        }
+        // -f 开启ip转发
+        else if (strcmp(argv[i], "-f") == 0)
+            ip_set_forward(1);
+        // -r <前缀>/<长度> [网关] 添加路由，不带网关时为直连，出口网卡为网关所在子网的网卡
+        else if (strcmp(argv[i], "-r") == 0 && i + 1 < argc)
+        {
+            const char *spec = argv[++i];
+            int a[4], len;
+            uint8_t prefix[NET_IP_LEN], gw[NET_IP_LEN];
+            if (parse_prefix(spec, prefix, &len) == -1)
+            {
+                fprintf(stderr, "Error in main: bad route %s\n", spec);
+                continue;
+            }
+            int has_gw = i + 1 < argc && sscanf(argv[i + 1], "%d.%d.%d.%d", &a[0], &a[1], &a[2], &a[3]) == 4;
+            if (has_gw)
+            {
+                i++;
+                for (int j = 0; j < NET_IP_LEN; j++)
+                    gw[j] = a[j];
+            }
+            if (last_if() == NULL || route_add(prefix, len, has_gw ? gw : NULL, -1) == -1)
+                fprintf(stderr, "Error in main: cannot add route %s\n", spec);
+        }
+    }
     net_init();               //初始化协议栈
     udp_open(60000, handler); //注册端口的udp监听回调
-    
-    while (1)
+    signal(SIGINT, stop);     //退出时保存arp表快照(-c)
+    signal(SIGTERM, stop);
+
+    int ret = 0;
+    while (running)
     {
-        net_poll(); //一次主循环
+        int done = net_poll(); //一次主循环
+        if (done == -1)
+        {
+            fprintf(stderr, "Error in main: cannot receive from any interface\n");
+            ret = 1;
+            break;
+        }
+        if (done == 0)
+            net_idle(); //空闲时先忙等，再阻塞等待网卡
     }
 
-    return 0;
+    net_close();
+    return ret;
 }
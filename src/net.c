@@ -1,7 +1,32 @@
 #include "net.h"
 #include "arp.h"
+#include "ip.h"
 #include "udp.h"
 #include "ethernet.h"
+#include "driver.h"
+#include "checksum.h"
+#include "timer.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+static int net_epfd = -1;       //等待网卡数据的epoll描述符
+static uint64_t net_idle_since; //本次空闲开始的时间(ns)，0表示不在空闲中
+
+/**
+ * @brief 获取单调时钟的当前时间
+ * 
+ * @return uint64_t 当前时间(ns)
+ */
+static uint64_t net_clock_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
 
 /**
  * @brief 初始化协议栈
@@ -9,16 +34,120 @@
  */
 void net_init()
 {
+    csum_select(NULL); //按CPU特性选择校验和实现
+    timer_init();
     ethernet_init();
     arp_init();
+    ip_init();
     udp_init();
+
+    //等待任意一块网卡有数据到达，有网卡的驱动不支持等待时只能忙等
+    for (int i = 0; i < net_if_nr; i++)
+        if (net_if_get(i)->drv == NULL || driver_fd(net_if_get(i)->drv) == -1)
+            return;
+    if ((net_epfd = epoll_create1(0)) == -1)
+    {
+        fprintf(stderr, "Error in epoll: %s\n", strerror(errno));
+        return;
+    }
+    for (int i = 0; i < net_if_nr; i++)
+    {
+        int fd = driver_fd(net_if_get(i)->drv);
+        struct epoll_event ev = {.events = EPOLLIN, .data.fd = fd};
+        if (epoll_ctl(net_epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+        {
+            fprintf(stderr, "Error in epoll: %s\n", strerror(errno));
+            close(net_epfd);
+            net_epfd = -1;
+            return;
+        }
+    }
 }
 
 /**
- * @brief 一次协议栈轮询
+ * @brief 关闭协议栈，保存arp表快照并关闭网卡
  * 
  */
-void net_poll()
+void net_close()
 {
-    ethernet_poll();
-}
\ No newline at end of file
+    arp_close();
+    for (int i = 0; i < net_if_nr; i++)
+        if (net_if_get(i)->drv)
+            driver_close(net_if_get(i)->drv);
+    if (net_epfd != -1)
+    {
+        close(net_epfd);
+        net_epfd = -1;
+    }
+}
+
+/**
+ * @brief 一次协议栈轮询，至多处理budget个数据帧
+ *        处理过程中产生的数据包在驱动发送队列中积累，轮询结束时一次批量发出
+ * 
+ * @param budget 本次最多处理的帧数
+ * @return int 本次处理的帧数，0表示空闲，所有网卡接收出错为-1
+ */
+int net_poll_budget(int budget)
+{
+    int done = ethernet_poll(budget);
+    timer_run(); //更新缓存的时钟，处理到期的定时器
+    for (int i = 0; i < net_if_nr; i++)
+        if (net_if_get(i)->drv)
+            driver_flush(net_if_get(i)->drv);
+    if (done > 0)
+        net_idle_since = 0;
+    return done;
+}
+
+/**
+ * @brief 一次协议栈轮询，至多处理NET_POLL_BUDGET个数据帧
+ * 
+ * @return int 本次处理的帧数，所有网卡接收出错为-1
+ */
+int net_poll()
+{
+    return net_poll_budget(NET_POLL_BUDGET);
+}
+
+/**
+ * @brief 阻塞等待网卡有数据到达
+ * 
+ * @param timeout_ms 最长等待时间(ms)，-1为一直等待
+ * @return int 有数据到达为1，超时为0，错误为-1
+ */
+int net_wait(int timeout_ms)
+{
+    struct epoll_event ev;
+    if (net_epfd == -1)
+        return 1;
+    int ret = epoll_wait(net_epfd, &ev, 1, timeout_ms);
+    if (ret == -1 && errno != EINTR)
+    {
+        fprintf(stderr, "Error in epoll_wait: %s\n", strerror(errno));
+        return -1;
+    }
+    return ret > 0;
+}
+
+/**
+ * @brief 一次轮询没有处理任何数据帧时调用
+ *        刚空闲时继续忙等，保证突发流量下的延迟；
+ *        空闲超过NET_SPIN_US后阻塞在网卡描述符上，避免空转占满CPU，
+ *        阻塞时间不超过下一个定时器到期的时间
+ * 
+ */
+void net_idle()
+{
+    uint64_t now = net_clock_ns();
+    if (net_idle_since == 0)
+    {
+        net_idle_since = now;
+        return;
+    }
+    if (now - net_idle_since < (uint64_t)NET_SPIN_US * 1000)
+        return;
+    int timeout = timer_next();
+    net_wait(timeout < 0 || timeout > NET_WAIT_MAX_MS ? NET_WAIT_MAX_MS : timeout);
+    net_idle_since = 0;
+}
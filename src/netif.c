@@ -0,0 +1,243 @@
+#include "netif.h"
+#include "route.h"
+#include "utils.h"
+#include <stdio.h>
+
+net_if_t net_ifs[NET_IF_MAX_NR];
+int net_if_nr;
+
+net_if_local_entry_t net_if_locals[NET_IF_LOCAL_NR];
+uint16_t net_if_local_hash[NET_IF_LOCAL_NR];
+
+static uint16_t net_if_local_free; //空闲本机地址链表的表头，0为已满
+static int net_if_local_inited;
+
+/**
+ * @brief 前缀长度对应的掩码
+ * 
+ * @param len 前缀长度
+ * @return uint32_t 掩码，主机字节序
+ */
+static inline uint32_t net_if_mask(int len)
+{
+    return len ? ~0u << (32 - len) : 0;
+}
+
+/**
+ * @brief 把ip地址转换为主机字节序的32位数
+ * 
+ * @param ip ip地址
+ * @return uint32_t 主机字节序的地址
+ */
+static inline uint32_t net_if_addr_of(const uint8_t *ip)
+{
+    return (uint32_t)ip[0] << 24 | (uint32_t)ip[1] << 16 | (uint32_t)ip[2] << 8 | ip[3];
+}
+
+/**
+ * @brief 把地址加入本机地址哈希表
+ * 
+ * @param ip ip地址
+ * @param if_index 地址所在的网卡
+ * @return int 成功为0，表已满为-1
+ */
+static int net_if_local_add(const uint8_t *ip, int if_index)
+{
+    if (!net_if_local_inited)
+    {
+        for (int i = 1; i < NET_IF_LOCAL_NR; i++)
+            net_if_locals[i].next = i + 1 < NET_IF_LOCAL_NR ? i + 1 : 0;
+        net_if_local_free = 1;
+        net_if_local_inited = 1;
+    }
+    uint16_t e = net_if_local_free;
+    if (e == 0)
+        return -1;
+    net_if_local_free = net_if_locals[e].next;
+    memcpy(&net_if_locals[e].ip, ip, NET_IP_LEN);
+    net_if_locals[e].if_index = if_index;
+    uint32_t h = net_if_local_hash_of(net_if_locals[e].ip);
+    net_if_locals[e].next = net_if_local_hash[h];
+    net_if_local_hash[h] = e;
+    return 0;
+}
+
+/**
+ * @brief 把地址从本机地址哈希表中删除
+ * 
+ * @param ip ip地址
+ */
+static void net_if_local_del(const uint8_t *ip)
+{
+    uint32_t a;
+    memcpy(&a, ip, NET_IP_LEN);
+    for (uint16_t *pp = &net_if_local_hash[net_if_local_hash_of(a)]; *pp; pp = &net_if_locals[*pp].next)
+    {
+        uint16_t e = *pp;
+        if (net_if_locals[e].ip != a)
+            continue;
+        *pp = net_if_locals[e].next;
+        net_if_locals[e].next = net_if_local_free;
+        net_if_local_free = e;
+        return;
+    }
+}
+
+/**
+ * @brief 添加默认网卡(DRIVER_IF_NAME)及其地址，已有网卡时什么也不做
+ * 
+ * @return int 成功为0，失败为-1
+ */
+int net_if_init()
+{
+    if (net_if_nr)
+        return 0;
+    uint8_t mac[NET_MAC_LEN] = DRIVER_IF_MAC;
+    uint8_t ip[NET_IP_LEN] = DRIVER_IF_IP;
+    net_if_t *netif = net_if_add(DRIVER_IF_NAME, mac, ETHERNET_MTU);
+    if (netif == NULL)
+        return -1;
+    return net_if_addr_add(netif, ip, DRIVER_IF_PREFIX_LEN);
+}
+
+/**
+ * @brief 添加一块网卡，需在net_init()之前调用
+ * 
+ * @param name 网卡名称
+ * @param mac mac地址，为NULL时由DRIVER_IF_MAC的最后一个字节加上网卡编号得到
+ * @param mtu 最大传输单元，ETHERNET_MTU_MIN到ETHERNET_MTU_MAX之间
+ * @return net_if_t* 新的网卡，失败为NULL
+ */
+net_if_t *net_if_add(const char *name, const uint8_t *mac, int mtu)
+{
+    if (net_if_nr == NET_IF_MAX_NR)
+    {
+        fprintf(stderr, "Error in net_if_add: too many interfaces\n");
+        return NULL;
+    }
+    if (strlen(name) >= NET_IF_NAME_LEN)
+    {
+        fprintf(stderr, "Error in net_if_add: interface name %s too long\n", name);
+        return NULL;
+    }
+    net_if_t *netif = &net_ifs[net_if_nr];
+    memset(netif, 0, sizeof(net_if_t));
+    netif->index = net_if_nr;
+    if (net_if_set_mtu(netif, mtu) == -1)
+    {
+        fprintf(stderr, "Error in net_if_add: mtu out of range [%d, %d]\n", ETHERNET_MTU_MIN, ETHERNET_MTU_MAX);
+        return NULL;
+    }
+    strcpy(netif->name, name);
+    if (mac)
+        memcpy(netif->mac, mac, NET_MAC_LEN);
+    else
+    {
+        uint8_t def[NET_MAC_LEN] = DRIVER_IF_MAC;
+        memcpy(netif->mac, def, NET_MAC_LEN);
+        netif->mac[NET_MAC_LEN - 1] += netif->index;
+    }
+    net_if_nr++;
+    return netif;
+}
+
+/**
+ * @brief 设置网卡的MTU，需在net_init()之前调用
+ * 
+ * @param netif 网卡
+ * @param mtu 最大传输单元，ETHERNET_MTU_MIN到ETHERNET_MTU_MAX之间
+ * @return int 成功为0，超出范围为-1
+ */
+int net_if_set_mtu(net_if_t *netif, int mtu)
+{
+    if (mtu < ETHERNET_MTU_MIN || mtu > ETHERNET_MTU_MAX)
+        return -1;
+    netif->mtu = mtu;
+    return 0;
+}
+
+/**
+ * @brief 为网卡添加一个ip地址，并添加该地址所在子网的直连路由
+ * 
+ * @param netif 网卡
+ * @param ip ip地址
+ * @param len 子网前缀长度，0~32
+ * @return int 成功为0，失败为-1
+ */
+int net_if_addr_add(net_if_t *netif, const uint8_t *ip, int len)
+{
+    if (len < 0 || len > 32)
+        return -1;
+    if (net_if_local(ip))
+    {
+        fprintf(stderr, "Error in net_if_addr_add: %s is already a local address\n", iptos((uint8_t *)ip));
+        return -1;
+    }
+    if (netif->addr_nr == NET_IF_ADDR_NR || net_if_local_add(ip, netif->index) == -1)
+    {
+        fprintf(stderr, "Error in net_if_addr_add: too many addresses\n");
+        return -1;
+    }
+    net_if_addr_t *a = &netif->addr[netif->addr_nr++];
+    memcpy(a->ip, ip, NET_IP_LEN);
+    a->len = len;
+    if (route_add(ip, len, NULL, netif->index) == -1)
+        fprintf(stderr, "Error in net_if_addr_add: cannot add connected route for %s/%d\n", iptos((uint8_t *)ip), len);
+    return 0;
+}
+
+/**
+ * @brief 删除网卡的一个ip地址，网卡上没有其他地址在同一子网时同时删除直连路由
+ * 
+ * @param netif 网卡
+ * @param ip ip地址
+ * @return int 成功为0，网卡没有该地址为-1
+ */
+int net_if_addr_del(net_if_t *netif, const uint8_t *ip)
+{
+    int i = 0;
+    while (i < netif->addr_nr && memcmp(netif->addr[i].ip, ip, NET_IP_LEN))
+        i++;
+    if (i == netif->addr_nr)
+        return -1;
+    net_if_local_del(ip);
+    int len = netif->addr[i].len;
+    uint32_t prefix = net_if_addr_of(ip) & net_if_mask(len);
+    //保持主地址在最前
+    memmove(&netif->addr[i], &netif->addr[i + 1], (netif->addr_nr - i - 1) * sizeof(net_if_addr_t));
+    netif->addr_nr--;
+    for (i = 0; i < netif->addr_nr; i++)
+        if (netif->addr[i].len == len && (net_if_addr_of(netif->addr[i].ip) & net_if_mask(len)) == prefix)
+            return 0;
+    route_del(ip, len);
+    return 0;
+}
+
+/**
+ * @brief 为发往目的地址的数据包选择源地址
+ * 
+ * @param netif 出口网卡
+ * @param dest 下一跳地址
+ * @return const uint8_t* 网卡上子网包含dest的地址（前缀最长的），没有时为主地址，网卡没有地址时为0.0.0.0
+ */
+const uint8_t *net_if_src(const net_if_t *netif, const uint8_t *dest)
+{
+    static const uint8_t any[NET_IP_LEN];
+    if (netif->addr_nr == 0)
+        return any;
+    const net_if_addr_t *best = &netif->addr[0];
+    if (netif->addr_nr == 1)
+        return best->ip;
+    uint32_t d = net_if_addr_of(dest);
+    int best_len = -1;
+    for (int i = 0; i < netif->addr_nr; i++)
+    {
+        const net_if_addr_t *a = &netif->addr[i];
+        if (a->len > best_len && ((net_if_addr_of(a->ip) ^ d) & net_if_mask(a->len)) == 0)
+        {
+            best = a;
+            best_len = a->len;
+        }
+    }
+    return best->ip;
+}
@@ -0,0 +1,279 @@
+#include "route.h"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#define ROUTE_TBL24_NR (1 << 24) //一级表项数
+
+route_entry_t route_table[ROUTE_MAX_NR];
+uint16_t *route_tbl24;
+uint16_t *route_tbl8;
+
+static uint16_t route_hash[ROUTE_MAX_NR]; //按(前缀, 长度)索引路由的哈希表，存放链表头
+static uint16_t route_free;               //空闲路由链表的表头，0为已满
+static int route_nr;                      //路由条数
+static int route_tbl8_free;               //空闲二级表组链表的表头，-1为已满
+static int route_tbl8_next[ROUTE_TBL8_NR]; //空闲二级表组链表
+
+/**
+ * @brief 前缀长度对应的掩码
+ * 
+ * @param len 前缀长度
+ * @return uint32_t 掩码，主机字节序
+ */
+static inline uint32_t route_mask(int len)
+{
+    return len ? ~0u << (32 - len) : 0;
+}
+
+/**
+ * @brief (前缀, 长度)的哈希值
+ * 
+ * @param prefix 前缀
+ * @param len 前缀长度
+ * @return uint32_t 哈希表下标
+ */
+static inline uint32_t route_hash_of(uint32_t prefix, int len)
+{
+    return ((prefix ^ (uint32_t)len) * 0x9e3779b1u >> 7) & (ROUTE_MAX_NR - 1);
+}
+
+/**
+ * @brief 按(前缀, 长度)查找路由
+ * 
+ * @param prefix 前缀，主机位已清零
+ * @param len 前缀长度
+ * @return uint16_t 路由下标，没有时为0
+ */
+static uint16_t route_find(uint32_t prefix, int len)
+{
+    for (uint16_t i = route_hash[route_hash_of(prefix, len)]; i; i = route_table[i].next)
+        if (route_table[i].prefix == prefix && route_table[i].len == len)
+            return i;
+    return 0;
+}
+
+/**
+ * @brief 初始化路由表，映射一级表与二级表组的内存
+ *        匿名映射的页在第一次写入时才分配，只有少量路由时占用的内存很少
+ * 
+ * @return int 成功为0，失败为-1
+ */
+int route_init()
+{
+    if (route_tbl24)
+        return 0;
+    size_t len24 = (size_t)ROUTE_TBL24_NR * sizeof(uint16_t);
+    size_t len8 = (size_t)ROUTE_TBL8_NR * 256 * sizeof(uint16_t);
+    uint8_t *mem = mmap(NULL, len24 + len8, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mem == MAP_FAILED)
+    {
+        fprintf(stderr, "Error in route_init: %s\n", strerror(errno));
+        return -1;
+    }
+    route_tbl8 = (uint16_t *)(mem + len24);
+    for (int i = 0; i < ROUTE_TBL8_NR; i++)
+        route_tbl8_next[i] = i + 1 < ROUTE_TBL8_NR ? i + 1 : -1;
+    route_tbl8_free = 0;
+    for (int i = 1; i < ROUTE_MAX_NR; i++)
+        route_table[i].next = i + 1 < ROUTE_MAX_NR ? i + 1 : 0;
+    route_free = 1;
+    memset(route_hash, 0, sizeof(route_hash));
+    route_nr = 0;
+    route_tbl24 = (uint16_t *)mem;
+    return 0;
+}
+
+/**
+ * @brief 判断一个表项是否应改为新的值
+ * 
+ * @param e 表项
+ * @param len 添加时为新路由的前缀长度
+ * @param from 删除时为被删除的路由，添加时为0
+ * @return int 应修改为1
+ */
+static inline int route_match(uint16_t e, int len, uint16_t from)
+{
+    if (from)
+        return e == from;
+    return e == 0 || route_table[e].len <= len; //更长的前缀仍然优先
+}
+
+/**
+ * @brief 二级表组中的表项都相同且前缀不超过24时，合并回一级表项，释放表组
+ * 
+ * @param i 一级表下标，其表项指向二级表组
+ */
+static void route_tbl8_merge(uint32_t i)
+{
+    int group = route_tbl24[i] & ~ROUTE_TBL8_FLAG;
+    uint16_t *g = route_tbl8 + ((uint32_t)group << 8);
+    uint16_t e = g[0];
+    if (e && route_table[e].len > 24)
+        return;
+    for (int j = 1; j < 256; j++)
+        if (g[j] != e)
+            return;
+    route_tbl24[i] = e;
+    route_tbl8_next[group] = route_tbl8_free;
+    route_tbl8_free = group;
+}
+
+/**
+ * @brief 把前缀覆盖的表项中满足route_match()的改为to
+ * 
+ * @param prefix 前缀
+ * @param len 前缀长度
+ * @param from 删除时为被删除的路由，添加时为0
+ * @param to 新的路由下标
+ * @return int 成功为0，二级表组用完时为-1（此时表未被修改）
+ */
+static int route_set(uint32_t prefix, int len, uint16_t from, uint16_t to)
+{
+    if (len <= 24)
+    {
+        uint32_t first = prefix >> 8;
+        uint32_t last = first + (1u << (24 - len)) - 1;
+        for (uint32_t i = first; i <= last; i++)
+        {
+            uint16_t e = route_tbl24[i];
+            if (!(e & ROUTE_TBL8_FLAG))
+            {
+                if (route_match(e, len, from))
+                    route_tbl24[i] = to;
+                continue;
+            }
+            uint16_t *g = route_tbl8 + ((uint32_t)(e & ~ROUTE_TBL8_FLAG) << 8);
+            for (int j = 0; j < 256; j++)
+                if (route_match(g[j], len, from))
+                    g[j] = to;
+            route_tbl8_merge(i);
+        }
+        return 0;
+    }
+
+    uint32_t i = prefix >> 8;
+    uint16_t e = route_tbl24[i];
+    if (!(e & ROUTE_TBL8_FLAG))
+    {
+        //展开为二级表组，组内先填入原来的路由
+        int group = route_tbl8_free;
+        if (group == -1)
+            return -1;
+        route_tbl8_free = route_tbl8_next[group];
+        uint16_t *g = route_tbl8 + ((uint32_t)group << 8);
+        for (int j = 0; j < 256; j++)
+            g[j] = e;
+        route_tbl24[i] = ROUTE_TBL8_FLAG | group;
+        e = route_tbl24[i];
+    }
+    uint16_t *g = route_tbl8 + ((uint32_t)(e & ~ROUTE_TBL8_FLAG) << 8);
+    uint32_t first = prefix & 0xff;
+    uint32_t last = first + (1u << (32 - len)) - 1;
+    for (uint32_t j = first; j <= last; j++)
+        if (route_match(g[j], len, from))
+            g[j] = to;
+    route_tbl8_merge(i);
+    return 0;
+}
+
+/**
+ * @brief 把ip地址转换为主机字节序的32位数
+ * 
+ * @param ip ip地址
+ * @return uint32_t 主机字节序的地址
+ */
+static inline uint32_t route_addr(const uint8_t *ip)
+{
+    return (uint32_t)ip[0] << 24 | (uint32_t)ip[1] << 16 | (uint32_t)ip[2] << 8 | ip[3];
+}
+
+/**
+ * @brief 添加一条路由，前缀与长度相同的路由已存在时修改其网关与出口网卡
+ * 
+ * @param prefix 前缀，主机位会被清零
+ * @param len 前缀长度，0~32
+ * @param gw 网关ip地址，为NULL或0.0.0.0时目的地址直连
+ * @param if_index 出口网卡，为负数时取到达网关的直连路由的网卡，没有时为0号网卡
+ * @return int 成功为0，失败为-1
+ */
+int route_add(const uint8_t *prefix, int len, const uint8_t *gw, int if_index)
+{
+    if (len < 0 || len > 32)
+        return -1;
+    if (route_init() == -1)
+        return -1;
+    if (if_index < 0)
+    {
+        route_entry_t *via = gw ? route_lookup(gw) : NULL;
+        if_index = via && !via->has_gw ? via->if_index : 0;
+    }
+    uint32_t addr = route_addr(prefix) & route_mask(len);
+    uint16_t r = route_find(addr, len);
+    if (r == 0)
+    {
+        if ((r = route_free) == 0)
+        {
+            fprintf(stderr, "Error in route_add: route table full\n");
+            return -1;
+        }
+        route_table[r].prefix = addr;
+        route_table[r].len = len;
+        if (route_set(addr, len, 0, r) == -1)
+        {
+            fprintf(stderr, "Error in route_add: out of tbl8 groups\n");
+            return -1;
+        }
+        route_free = route_table[r].next;
+        uint32_t h = route_hash_of(addr, len);
+        route_table[r].next = route_hash[h];
+        route_hash[h] = r;
+        route_nr++;
+    }
+    route_table[r].if_index = if_index;
+    route_table[r].has_gw = gw && route_addr(gw) != 0;
+    if (route_table[r].has_gw)
+        memcpy(route_table[r].gw, gw, NET_IP_LEN);
+    return 0;
+}
+
+/**
+ * @brief 删除一条路由，原来匹配它的地址改为匹配次长的前缀
+ * 
+ * @param prefix 前缀
+ * @param len 前缀长度
+ * @return int 成功为0，没有该路由为-1
+ */
+int route_del(const uint8_t *prefix, int len)
+{
+    if (len < 0 || len > 32 || route_tbl24 == NULL)
+        return -1;
+    uint32_t addr = route_addr(prefix) & route_mask(len);
+    uint16_t r = route_find(addr, len);
+    if (r == 0)
+        return -1;
+    uint16_t parent = 0;
+    for (int l = len - 1; l >= 0 && parent == 0; l--)
+        parent = route_find(addr & route_mask(l), l);
+    route_set(addr, len, r, parent); //只会合并二级表组，不会失败
+
+    uint16_t *pp = &route_hash[route_hash_of(addr, len)];
+    while (*pp != r)
+        pp = &route_table[*pp].next;
+    *pp = route_table[r].next;
+    route_table[r].next = route_free;
+    route_free = r;
+    route_nr--;
+    return 0;
+}
+
+/**
+ * @brief 获取路由条数
+ * 
+ * @return int 路由条数
+ */
+int route_count()
+{
+    return route_nr;
+}
@@ -0,0 +1,226 @@
+#include "timer.h"
+#include <time.h>
+
+#define TIMER_WHEEL_BITS 6                        //每层时间轮槽数的位数
+#define TIMER_WHEEL_SIZE (1 << TIMER_WHEEL_BITS)  //每层时间轮的槽数
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SIZE - 1)
+#define TIMER_LEVELS 4                            //时间轮层数
+#define TIMER_MAX_DELTA ((1ULL << (TIMER_WHEEL_BITS * TIMER_LEVELS)) - 1) //能直接放入时间轮的最大时长(ms)
+
+#ifdef CLOCK_MONOTONIC_COARSE
+#define TIMER_CLOCK_ID CLOCK_MONOTONIC_COARSE //粗精度单调时钟，只读vDSO中的数据，开销最小
+#else
+#define TIMER_CLOCK_ID CLOCK_MONOTONIC
+#endif
+
+uint64_t timer_clock; //缓存的单调时钟(ms)
+
+static net_timer_t *timer_wheel[TIMER_LEVELS][TIMER_WHEEL_SIZE];
+static uint64_t timer_jiffies; //下一个待处理的时刻(ms)
+static int timer_count;        //已启动的定时器数
+
+/**
+ * @brief 读取单调时钟，更新缓存
+ * 
+ */
+static void timer_clock_update()
+{
+    struct timespec ts;
+    clock_gettime(TIMER_CLOCK_ID, &ts);
+    timer_clock = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * @brief 把定时器挂入时间轮中对应的槽
+ *        按到期时间与timer_jiffies的差选择层，层内按到期时间的对应位选择槽；
+ *        超出时间轮范围的定时器先放在最高层，级联时再重新放置
+ * 
+ * @param timer 定时器
+ */
+static void timer_link(net_timer_t *timer)
+{
+    uint64_t expires = timer->expires;
+    if (expires < timer_jiffies)
+        expires = timer_jiffies;
+    else if (expires - timer_jiffies > TIMER_MAX_DELTA)
+        expires = timer_jiffies + TIMER_MAX_DELTA;
+    uint64_t delta = expires - timer_jiffies;
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 && delta >= 1ULL << (TIMER_WHEEL_BITS * (level + 1)))
+        level++;
+    net_timer_t **slot = &timer_wheel[level][(expires >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK];
+    timer->next = *slot;
+    if (*slot)
+        (*slot)->pprev = &timer->next;
+    timer->pprev = slot;
+    *slot = timer;
+}
+
+/**
+ * @brief 把定时器从所在的槽中摘下
+ * 
+ * @param timer 已启动的定时器
+ */
+static void timer_unlink(net_timer_t *timer)
+{
+    *timer->pprev = timer->next;
+    if (timer->next)
+        timer->next->pprev = timer->pprev;
+    timer->next = 0;
+    timer->pprev = 0;
+}
+
+/**
+ * @brief 初始化定时器子系统，读取一次时钟
+ * 
+ */
+void timer_init()
+{
+    timer_clock_update();
+    timer_jiffies = timer_clock;
+}
+
+/**
+ * @brief 设置定时器的处理函数，定时器处于未启动状态
+ * 
+ * @param timer 定时器
+ * @param handler 到期处理函数，调用前定时器已变为未启动，可在其中重新启动
+ * @param arg 处理函数的参数
+ */
+void timer_setup(net_timer_t *timer, net_timer_handler_t handler, void *arg)
+{
+    timer->next = 0;
+    timer->pprev = 0;
+    timer->expires = 0;
+    timer->handler = handler;
+    timer->arg = arg;
+}
+
+/**
+ * @brief 启动定时器，已启动时修改其到期时间
+ * 
+ * @param timer 定时器
+ * @param expires 到期时间(ms)，早于当前时间时在下一次timer_run()中到期
+ */
+void timer_mod(net_timer_t *timer, uint64_t expires)
+{
+    if (timer_pending(timer))
+        timer_unlink(timer);
+    else
+        timer_count++;
+    timer->expires = expires;
+    timer_link(timer);
+}
+
+/**
+ * @brief 停止定时器，未启动时不做任何事
+ * 
+ * @param timer 定时器
+ */
+void timer_del(net_timer_t *timer)
+{
+    if (!timer_pending(timer))
+        return;
+    timer_unlink(timer);
+    timer_count--;
+}
+
+/**
+ * @brief 把一个槽中的定时器整体摘下，挂到临时链表上
+ *        摘下后槽可以重新接收定时器，链表上的定时器仍可被timer_del()删除
+ * 
+ * @param slot 槽
+ * @param list 临时链表的表头
+ */
+static void timer_detach(net_timer_t **slot, net_timer_t **list)
+{
+    *list = *slot;
+    *slot = 0;
+    if (*list)
+        (*list)->pprev = list;
+}
+
+/**
+ * @brief 级联：把高层一个槽中的定时器按剩余时间重新放入低层
+ * 
+ * @param level 层
+ * @param index 槽下标
+ */
+static void timer_cascade(int level, int index)
+{
+    net_timer_t *list, *timer;
+    timer_detach(&timer_wheel[level][index], &list);
+    while ((timer = list) != 0)
+    {
+        timer_unlink(timer);
+        timer_link(timer);
+    }
+}
+
+/**
+ * @brief 更新缓存的时钟，并处理所有已到期的定时器
+ *        每次协议栈轮询时调用
+ * 
+ * @return int 本次处理的定时器数
+ */
+int timer_run()
+{
+    int done = 0;
+    timer_clock_update();
+    if (timer_count == 0)
+    {
+        timer_jiffies = timer_clock + 1; //没有定时器时直接跳到当前时间
+        return 0;
+    }
+    while (timer_jiffies <= timer_clock)
+    {
+        int index = timer_jiffies & TIMER_WHEEL_MASK;
+        //最低层转完一圈时，从上一层取下一个槽的定时器放下来，逐层向上
+        for (int level = 1; level < TIMER_LEVELS; level++)
+        {
+            if ((timer_jiffies >> (TIMER_WHEEL_BITS * (level - 1))) & TIMER_WHEEL_MASK)
+                break;
+            timer_cascade(level, (timer_jiffies >> (TIMER_WHEEL_BITS * level)) & TIMER_WHEEL_MASK);
+        }
+        net_timer_t *list, *timer;
+        timer_detach(&timer_wheel[0][index], &list);
+        timer_jiffies++; //处理函数中重新启动的已到期定时器放到下一个时刻
+        while ((timer = list) != 0)
+        {
+            timer_unlink(timer);
+            timer_count--;
+            timer->handler(timer, timer->arg);
+            done++;
+        }
+    }
+    return done;
+}
+
+/**
+ * @brief 估计距离下一个定时器到期的时间，用于决定空闲时阻塞等待的时长
+ *        最低层的槽精确到ms；第二层取下一个非空槽级联的时间；更高层只取第二层转完一圈的时间，
+ *        结果不会晚于实际到期时间
+ * 
+ * @return int 距离下一次需要调用timer_run()的时间(ms)，没有定时器时为-1
+ */
+int timer_next()
+{
+    if (timer_count == 0)
+        return -1;
+    uint64_t next = ((timer_jiffies >> (TIMER_WHEEL_BITS * 2)) + 1) << (TIMER_WHEEL_BITS * 2);
+    for (int k = 0; k < TIMER_WHEEL_SIZE; k++)
+        if (timer_wheel[0][(timer_jiffies + k) & TIMER_WHEEL_MASK])
+        {
+            next = timer_jiffies + k;
+            break;
+        }
+    uint64_t base = timer_jiffies >> TIMER_WHEEL_BITS;
+    for (int k = 1; k <= TIMER_WHEEL_SIZE; k++)
+        if (timer_wheel[1][(base + k) & TIMER_WHEEL_MASK])
+        {
+            if ((base + k) << TIMER_WHEEL_BITS < next)
+                next = (base + k) << TIMER_WHEEL_BITS;
+            break;
+        }
+    return next > timer_clock ? (int)(next - timer_clock) : 0;
+}
@@ -1,6 +1,9 @@
 #include "udp.h"
 #include "ip.h"
+#include "netif.h"
 #include "icmp.h"
+#include "driver.h"
+#include "checksum.h"
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -11,15 +14,16 @@
  */
 static udp_entry_t udp_table[UDP_MAX_HANDLER];
 
+/**
+ * @brief 发送数据包使用的buffer
+ * 
+ */
+static buf_t txbuf;
+
 /**
  * @brief udp伪校验和计算
- *        1. 你首先调用buf_add_header()添加UDP伪头部
- *        2. 将IP头部拷贝出来，暂存被UDP伪头部覆盖的IP头部
- *        3. 填写UDP伪头部的12字节字段
- *        4. 计算UDP校验和，注意：UDP校验和覆盖了UDP头部、UDP数据和UDP伪头部
- *        5. 再将暂存的IP头部拷贝回来
- *        6. 调用buf_remove_header()函数去掉UDP伪头部
- *        7. 返回计算后的校验和。  
+ *        伪首部的部分和单独计算（按对端缓存），与UDP头部、UDP数据的部分和累加，
+ *        不再借用ip首部的空间写入伪首部
  * 
  * @param buf 要计算的包
  * @param src_ip 源ip地址
@@ -29,53 +33,26 @@ static udp_entry_t udp_table[UDP_MAX_HANDLER];
 static uint16_t udp_checksum(buf_t *buf, uint8_t *src_ip, uint8_t *dest_ip)
 {
     // TODO
-    buf_add_header(buf,12);
-    uint8_t data[12];
-    //拷贝数据
-    memcpy(data,buf->data,12);
-
-
-    //从此处开始 填写数据
-    uint8_t* p = buf->data;
-    uint16_t *p16 = (uint16_t*)buf->data;
-    //源IP
-    for(int i=0;i<4;i++){
-        p[i]=src_ip[i];
-    }
-    //目的IP
-    for(int i=0;i<4;i++){
-        p[4+i]=dest_ip[i];
-    }
-    //全0
-    p[8]=0;
-    //协议
-    p[9]=NET_PROTOCOL_UDP;
-    //UDP长度
-    p16[5]=p16[8];
-    
-    //到此处填写完成
-
-    //计算检验和
-    uint32_t sum=0;
-    for(int i=0;i<buf->len/2;i++){
-        uint16_t temp=swap16(p16[i]);
-        sum+=temp;
-    }
-    //如果UDP数据为奇数位
-    if(buf->len%2==1){
-        uint16_t temp = p[buf->len-1];
-        temp = swap16(temp);
-        sum += temp;
-    }
-    uint16_t a=sum>>16;
-    uint16_t b=sum;
-    uint16_t c=a+b;
-    c=~c;
+    //伪首部中的UDP长度取自UDP首部
+    uint16_t len = swap16(((udp_hdr_t *)buf->data)->total_len);
+    //UDP数据为奇数位时最后一个字节后补0
+    uint32_t sum = csum_partial(buf->data,buf->len,0);
+    sum = csum_add(sum,csum_pseudo_partial(src_ip,dest_ip,NET_PROTOCOL_UDP,len));
+    return swap16(csum_fold(sum));
+}
 
-    //从此处开始将数据拷贝回去
-    memcpy(buf->data,data,12);
-    buf_remove_header(buf,12);
-    return c;
+/**
+ * @brief 计算udp伪首部的和，用于由网卡补全校验和
+ * 
+ * @param src_ip 源ip地址
+ * @param dest_ip 目的ip地址
+ * @param len udp数据包长度
+ * @return uint16_t 伪首部按16位求和折叠后的结果，未取反
+ */
+static uint16_t udp_pseudo_sum(uint8_t *src_ip, uint8_t *dest_ip, uint16_t len)
+{
+    uint16_t c = ~csum_fold(csum_pseudo_partial(src_ip, dest_ip, NET_PROTOCOL_UDP, len));
+    return swap16(c);
 }
 
 /**
@@ -95,8 +72,9 @@ static uint16_t udp_checksum(buf_t *buf, uint8_t *src_ip, uint8_t *dest_ip)
  * 
  * @param buf 要处理的包
  * @param src_ip 源ip地址
+ * @param dest_ip 目的ip地址，本机的某个地址，计算伪首部校验和时使用
  */
-void udp_in(buf_t *buf, uint8_t *src_ip)
+void udp_in(buf_t *buf, uint8_t *src_ip, uint8_t *dest_ip)
 {
     // TODO
     uint8_t *p=buf->data;
@@ -108,12 +86,14 @@ void udp_in(buf_t *buf, uint8_t *src_ip)
     if(swap16(p16[2])<18){
         buf->len = swap16(p16[2]);
     }
-    //检验和
-    uint16_t checksum_buf = p16[3];
-    p16[3]=0;
-    p16[3] = swap16(udp_checksum(buf,src_ip,net_if_ip));
-    if(checksum_buf!=p16[3]){
-        return;
+    //检验和，驱动标明内核已验证过，或是本机内核产生、尚未计算校验和时跳过
+    if(!(buf->flags & (BUF_F_CSUM_VALID | BUF_F_CSUM_PARTIAL))){
+        uint16_t checksum_buf = p16[3];
+        p16[3]=0;
+        p16[3] = swap16(udp_checksum(buf,src_ip,dest_ip));
+        if(checksum_buf!=p16[3]){
+            return;
+        }
     }
     // 查udp_table 
     for(int i=0;i<UDP_MAX_HANDLER;i++){
@@ -139,14 +119,22 @@ void udp_in(buf_t *buf, uint8_t *src_ip)
  *        调用udp_checksum()函数计算UDP校验和
  *        将封装的UDP数据报发送到IP层。    
  * 
+ *        如果网卡支持校验和卸载，且数据包不会在本地分片，
+ *        校验和字段只填伪首部的和，由网卡补全。
+ *        如果buf带有数据的部分和(BUF_F_CSUM_SUM)，只需再加上udp首部与伪首部，不再遍历数据。
+ *        伪首部的源地址与卸载功能都取路由选出的出口网卡的。
+ * 
  * @param buf 要处理的包
  * @param src_port 源端口号
  * @param dest_ip 目的ip地址
  * @param dest_port 目的端口号
+ * @return int 已发出或等待arp解析为0，驱动发送队列已满为DRIVER_TX_BUSY，丢弃为-1
  */
-void udp_out(buf_t *buf, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port)
+int udp_out(buf_t *buf, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port)
 {
     // TODO
+    int has_sum = buf->flags & BUF_F_CSUM_SUM;
+    uint32_t sum = buf->csum;
     buf_add_header(buf,8);
     //8位指针
     uint8_t *p=buf->data;
@@ -158,10 +146,61 @@ void udp_out(buf_t *buf, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port
     p16[1]=swap16(dest_port);
     //长度
     p16[2]=swap16(buf->len);
-    //校验和
-    p16[3]=0;
-    p16[3]=swap16(udp_checksum(buf,net_if_ip,dest_ip));
-    ip_out(buf,dest_ip,NET_PROTOCOL_UDP);
+    //校验和，源地址与ip层按同一路由选择
+    const uint8_t *nh;
+    net_if_t *netif = ip_route(dest_ip,&nh);
+    uint8_t *src_ip = (uint8_t *)net_if_src(netif,nh);
+    int offload = netif->offload;
+    if((offload & DRIVER_OFFLOAD_TX_CSUM) && (buf->len+20<=ip_pmtu(dest_ip) || (offload & DRIVER_OFFLOAD_TX_UFO))){
+        p16[3]=swap16(udp_pseudo_sum(src_ip,dest_ip,buf->len));
+        buf->flags |= BUF_F_CSUM_PARTIAL;
+        buf->csum_start = 0;
+        buf->csum_offset = 6;
+    }else if(has_sum){
+        //数据的部分和已在拷贝时算出，加上udp首部与伪首部即可
+        p16[3]=0;
+        sum = csum_partial(buf->data,8,sum);
+        p16[3]=csum_fold(csum_add(sum,csum_pseudo_partial(src_ip,dest_ip,NET_PROTOCOL_UDP,buf->len)));
+    }else{
+        p16[3]=0;
+        p16[3]=swap16(udp_checksum(buf,src_ip,dest_ip));
+    }
+    return ip_out_from(buf,src_ip,dest_ip,NET_PROTOCOL_UDP);
+}
+
+/**
+ * @brief 根据udp_table中打开的端口重新生成内核过滤器
+ *        放行arp、icmp、非首片的ip分片（不含udp首部，无法按端口判断），
+ *        以及发往已打开端口的udp数据包；其余数据包在内核中丢弃。
+ *        开启转发时放行所有arp与ip数据包，由ip层判断是否转发。
+ *        所有打开的网卡使用同一过滤条件
+ * 
+ */
+static void udp_filter_update()
+{
+    char exp[PCAP_BUF_SIZE];
+    const char *filter = exp;
+    if (ip_forward_enabled())
+        filter = "arp or ip";
+    else
+    {
+        int len = snprintf(exp, sizeof(exp), "arp or icmp or (ip[6:2] & 0x1fff != 0)");
+#if UDP_FILTER_PASS_CLOSED
+        len += snprintf(exp + len, sizeof(exp) - len, " or udp");
+#else
+        for (int i = 0; i < UDP_MAX_HANDLER && len < (int)sizeof(exp); i++)
+            if (udp_table[i].valid)
+                len += snprintf(exp + len, sizeof(exp) - len, " or udp dst port %d", udp_table[i].port);
+#endif
+        if (len >= (int)sizeof(exp))
+            filter = NULL;
+    }
+    for (int i = 0; i < net_if_nr; i++)
+    {
+        net_if_t *netif = net_if_get(i);
+        if (netif->drv && driver_set_filter(netif->drv, filter) == -1)
+            driver_set_filter(netif->drv, NULL); //无法收紧过滤时退回只按mac过滤，不丢弃需要的数据包
+    }
 }
 
 /**
@@ -172,6 +211,7 @@ void udp_init()
 {
     for (int i = 0; i < UDP_MAX_HANDLER; i++)
         udp_table[i].valid = 0;
+    udp_filter_update();
 }
 
 /**
@@ -188,6 +228,8 @@ int udp_open(uint16_t port, udp_handler_t handler)
         {
             udp_table[i].handler = handler;
             udp_table[i].valid = 1;
+            udp_table[i].df = 0;
+            udp_filter_update();
             return 0;
         }
 
@@ -197,6 +239,8 @@ int udp_open(uint16_t port, udp_handler_t handler)
             udp_table[i].handler = handler;
             udp_table[i].port = port;
             udp_table[i].valid = 1;
+            udp_table[i].df = 0;
+            udp_filter_update();
             return 0;
         }
     return -1;
@@ -212,20 +256,64 @@ void udp_close(uint16_t port)
     for (int i = 0; i < UDP_MAX_HANDLER; i++)
         if (udp_table[i].port == port)
             udp_table[i].valid = 0;
+    udp_filter_update();
+}
+
+/**
+ * @brief 设置从一个已打开的端口发出的数据包是否置DF位
+ *        置DF位后数据包不再分片，由应用按udp_max_payload()控制大小
+ * 
+ * @param port 端口号
+ * @param df 为1时置DF位
+ * @return int 成功为0，端口未打开为-1
+ */
+int udp_set_df(uint16_t port, int df)
+{
+    for (int i = 0; i < UDP_MAX_HANDLER; i++)
+        if (udp_table[i].valid && udp_table[i].port == port)
+        {
+            udp_table[i].df = df;
+            return 0;
+        }
+    return -1;
+}
+
+/**
+ * @brief 获取发往目的地址时不会被分片的最大udp数据长度
+ * 
+ * @param dest_ip 目的ip地址
+ * @return int 路径MTU减去ip与udp首部
+ */
+int udp_max_payload(uint8_t *dest_ip)
+{
+    return ip_pmtu(dest_ip) - (int)sizeof(ip_hdr_t) - (int)sizeof(udp_hdr_t);
 }
 
 /**
  * @brief 发送一个udp包
+ *        源端口设置了DF位时，超过路径MTU的数据不发送，由应用缩小后重发
  * 
  * @param data 要发送的数据
  * @param len 数据长度
  * @param src_port 源端口号
  * @param dest_ip 目的ip地址
  * @param dest_port 目的端口号
+ * @return int 成功为0，驱动发送队列已满为DRIVER_TX_BUSY（可在net_poll()后重发），
+ *             端口禁止分片且数据超过udp_max_payload()或数据包被丢弃时为-1
  */
-void udp_send(uint8_t *data, uint16_t len, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port)
+int udp_send(uint8_t *data, uint16_t len, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port)
 {
+    int df = 0;
+    for (int i = 0; i < UDP_MAX_HANDLER; i++)
+        if (udp_table[i].valid && udp_table[i].port == src_port)
+            df = udp_table[i].df;
+    if (df && len > udp_max_payload(dest_ip))
+        return -1;
     buf_init(&txbuf, len);
-    memcpy(txbuf.data, data, len);
-    udp_out(&txbuf, src_port, dest_ip, dest_port);
+    //拷贝的同时计算数据的部分和，udp_out不必再遍历一次
+    txbuf.csum = csum_partial_copy(txbuf.data, data, len, 0);
+    txbuf.flags |= BUF_F_CSUM_SUM;
+    if (df)
+        txbuf.flags |= BUF_F_DF;
+    return udp_out(&txbuf, src_port, dest_ip, dest_port);
 }
\ No newline at end of file
@@ -1,7 +1,10 @@
 #include "utils.h"
+#include "checksum.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
 #define IPTOSBUFFERS 12
 #define swap16(x) ((((x)&0xFF) << 8) | (((x) >> 8) & 0xFF))
 /**
@@ -19,16 +22,170 @@ char *iptos(uint8_t *ip)
     return output[which];
 }
 
+#define BUF_HUGEPAGE_SIZE (2 << 20) //大页大小
+#define BUF_ALIGN(x) (((x) + 63) & ~63) //缓冲块按缓存行对齐
+
+/**
+ * @brief 各尺寸等级缓冲块的数据区大小，巨型块可容纳最大udp包加预留空间
+ * 
+ */
+static const uint32_t buf_class_size[BUF_CLASS_NR] = {
+    [BUF_CLASS_SMALL] = BUF_ALIGN(BUF_SMALL_SIZE),
+    [BUF_CLASS_MTU] = BUF_ALIGN(BUF_MTU_SIZE),
+    [BUF_CLASS_JFRAME] = BUF_ALIGN(BUF_JFRAME_SIZE),
+    [BUF_CLASS_JUMBO] = BUF_ALIGN(BUF_MAX_LEN + BUF_HEADROOM),
+};
+
+/**
+ * @brief 各尺寸等级缓冲块的个数
+ * 
+ */
+static const int buf_class_nr[BUF_CLASS_NR] = {
+    [BUF_CLASS_SMALL] = BUF_POOL_SMALL_NR,
+    [BUF_CLASS_MTU] = BUF_POOL_MTU_NR,
+    [BUF_CLASS_JFRAME] = BUF_POOL_JFRAME_NR,
+    [BUF_CLASS_JUMBO] = BUF_POOL_JUMBO_NR,
+};
+
+static buf_block_t buf_blocks[BUF_POOL_SMALL_NR + BUF_POOL_MTU_NR + BUF_POOL_JFRAME_NR + BUF_POOL_JUMBO_NR]; //缓冲块描述符
+static buf_block_t *buf_free_list[BUF_CLASS_NR];                                     //各尺寸等级的空闲链表
+static int buf_pool_ready;                                                           //缓冲池是否已初始化
+
+/**
+ * @brief 为缓冲池映射一段内存，开启BUF_POOL_HUGEPAGE时优先使用大页
+ * 
+ * @param len 长度
+ * @return void* 映射的内存，失败为NULL
+ */
+static void *buf_pool_map(size_t len)
+{
+    void *mem;
+#if BUF_POOL_HUGEPAGE
+    mem = mmap(NULL, (len + BUF_HUGEPAGE_SIZE - 1) & ~(size_t)(BUF_HUGEPAGE_SIZE - 1),
+               PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (mem != MAP_FAILED)
+        return mem;
+#endif
+    mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return mem == MAP_FAILED ? NULL : mem;
+}
+
+/**
+ * @brief 初始化缓冲池，每个尺寸等级映射一段连续内存，切成缓冲块挂入空闲链表
+ *        第一次分配缓冲块时调用
+ * 
+ */
+static void buf_pool_init()
+{
+    buf_block_t *blk = buf_blocks;
+    for (int cls = 0; cls < BUF_CLASS_NR; cls++)
+    {
+        uint8_t *mem = buf_pool_map((size_t)buf_class_size[cls] * buf_class_nr[cls]);
+        if (mem == NULL)
+            fprintf(stderr, "Error in buf_pool_init: %s\n", strerror(errno));
+        for (int i = 0; mem && i < buf_class_nr[cls]; i++, blk++)
+        {
+            blk->data = mem + (size_t)buf_class_size[cls] * i;
+            blk->size = buf_class_size[cls];
+            blk->cls = cls;
+            blk->ref = 0;
+            blk->next = buf_free_list[cls];
+            buf_free_list[cls] = blk;
+        }
+    }
+    buf_pool_ready = 1;
+}
+
+/**
+ * @brief 选择能容纳len字节数据与预留空间的最小尺寸等级
+ * 
+ * @param len 数据长度
+ * @return int 尺寸等级
+ */
+static int buf_class_of(int len)
+{
+    for (int cls = 0; cls < BUF_CLASS_JUMBO; cls++)
+        if (len + BUF_HEADROOM <= (int)buf_class_size[cls])
+            return cls;
+    return BUF_CLASS_JUMBO;
+}
+
+/**
+ * @brief 从缓冲池取出一个缓冲块
+ *        该等级已耗尽时依次尝试更大的等级，全部耗尽时从堆上分配，释放时归还堆
+ * 
+ * @param cls 尺寸等级
+ * @return buf_block_t* 引用计数为1的缓冲块
+ */
+static buf_block_t *buf_block_get(int cls)
+{
+    buf_block_t *blk;
+    if (!buf_pool_ready)
+        buf_pool_init();
+    for (int c = cls; c < BUF_CLASS_NR; c++)
+        if ((blk = buf_free_list[c]) != NULL)
+        {
+            buf_free_list[c] = blk->next;
+            blk->ref = 1;
+            return blk;
+        }
+
+    if ((blk = malloc(sizeof(buf_block_t) + buf_class_size[cls])) == NULL)
+    {
+        fprintf(stderr, "Error in buf_block_get: out of memory\n");
+        exit(1);
+    }
+    blk->data = (uint8_t *)(blk + 1);
+    blk->size = buf_class_size[cls];
+    blk->cls = BUF_CLASS_HEAP;
+    blk->ref = 1;
+    return blk;
+}
+
+/**
+ * @brief 释放对缓冲块的一个引用，引用归零时归还缓冲池
+ * 
+ * @param blk 缓冲块
+ */
+static void buf_block_put(buf_block_t *blk)
+{
+    if (--blk->ref)
+        return;
+    if (blk->cls == BUF_CLASS_HEAP)
+    {
+        free(blk);
+        return;
+    }
+    blk->next = buf_free_list[blk->cls];
+    buf_free_list[blk->cls] = blk;
+}
+
 /**
  * @brief 初始化buffer为给定的长度，用于装载数据包
+ *        buffer已独占大小合适的缓冲块时直接复用，否则释放原来的引用，
+ *        从缓冲池中取一个能容纳len字节与BUF_HEADROOM的缓冲块。
+ *        数据放在缓冲块的末尾，前面的空间留给之后添加的协议头
  * 
  * @param buf 要初始化的buffer
  * @param len 长度
  */
 void buf_init(buf_t *buf, int len)
 {
+    int cls = buf_class_of(len);
+    buf_block_t *blk = buf->block;
+    if (blk == NULL || blk->ref != 1 || blk->size != buf_class_size[cls])
+    {
+        if (blk)
+            buf_block_put(blk);
+        blk = buf_block_get(cls);
+    }
+    buf->block = blk;
+    buf->payload = blk->data;
     buf->len = len;
-    buf->data = buf->payload + BUF_MAX_LEN - len;
+    buf->data = blk->data + blk->size - len;
+    buf->flags = 0;
+    buf->if_index = 0;
+    buf->next = NULL;
 }
 
 /**
@@ -41,6 +198,9 @@ void buf_add_header(buf_t *buf, int len)
 {
     buf->len += len;
     buf->data -= len;
+    buf->flags &= ~BUF_F_CSUM_SUM;
+    if (buf->flags & BUF_F_CSUM_PARTIAL)
+        buf->csum_start += len;
 }
 
 /**
@@ -53,18 +213,114 @@ void buf_remove_header(buf_t *buf, int len)
 {
     buf->len -= len;
     buf->data += len;
+    buf->flags &= ~BUF_F_CSUM_SUM;
+    if (buf->flags & BUF_F_CSUM_PARTIAL)
+        buf->csum_start -= len;
 }
 
 /**
  * @brief 复制一个buffer到新buffer
+ *        src为分散/聚集链时，各段数据依次拷入dst，dst为一段连续的buffer
  * 
  * @param dst 目的buffer
  * @param src 源buffer
  */
 void buf_copy(buf_t *dst, buf_t *src)
 {
-    buf_init(dst, src->len);
-    memcpy(dst->payload, src->payload, BUF_MAX_LEN);
+    if (dst == src)
+        return;
+    buf_init(dst, buf_chain_len(src));
+    buf_gather(src, dst->data);
+    dst->flags = src->flags;
+    dst->if_index = src->if_index;
+    dst->csum_start = src->csum_start;
+    dst->csum_offset = src->csum_offset;
+    dst->gso_size = src->gso_size;
+    dst->csum = src->csum;
+}
+
+/**
+ * @brief 克隆一个buffer，不复制数据，两个buffer共享同一个缓冲块
+ *        源buffer直接引用驱动的帧内存时无法共享，退化为buf_copy
+ * 
+ * @param dst 目的buffer
+ * @param src 源buffer
+ */
+void buf_clone(buf_t *dst, buf_t *src)
+{
+    if (dst == src)
+        return;
+    if (src->block == NULL || src->next)
+    {
+        buf_copy(dst, src);
+        return;
+    }
+    src->block->ref++; //先增加引用，dst原来就引用同一缓冲块时不会被提前归还
+    if (dst->block)
+        buf_block_put(dst->block);
+    *dst = *src;
+}
+
+/**
+ * @brief 引用src中从offset开始的len字节，不复制数据
+ *        dst与src共享缓冲块，只是data与len指向其中的一片，用于拼接分散/聚集链
+ * 
+ * @param dst 目的buffer
+ * @param src 源buffer，必须是一段连续的buffer
+ * @param offset 相对src->data的偏移
+ * @param len 长度
+ */
+void buf_slice(buf_t *dst, buf_t *src, int offset, int len)
+{
+    buf_clone(dst, src);
+    dst->data += offset;
+    dst->len = len;
+    dst->flags = 0;
+}
+
+/**
+ * @brief 计算分散/聚集链的总长度
+ * 
+ * @param buf 链的第一段
+ * @return int 各段长度之和
+ */
+int buf_chain_len(buf_t *buf)
+{
+    int len = 0;
+    for (; buf; buf = buf->next)
+        len += buf->len;
+    return len;
+}
+
+/**
+ * @brief 把分散/聚集链中各段的数据依次拷贝到一段连续内存
+ * 
+ * @param buf 链的第一段
+ * @param dst 目的内存，长度至少为buf_chain_len(buf)
+ */
+void buf_gather(buf_t *buf, uint8_t *dst)
+{
+    for (; buf; buf = buf->next)
+    {
+        memcpy(dst, buf->data, buf->len);
+        dst += buf->len;
+    }
+}
+
+/**
+ * @brief 释放buffer对缓冲块的引用，引用归零时缓冲块归还缓冲池
+ * 
+ * @param buf 要释放的buffer
+ */
+void buf_free(buf_t *buf)
+{
+    if (buf->block)
+        buf_block_put(buf->block);
+    buf->block = NULL;
+    buf->payload = NULL;
+    buf->data = NULL;
+    buf->next = NULL;
+    buf->len = 0;
 }
 
 /**
@@ -75,22 +331,14 @@ void buf_copy(buf_t *dst, buf_t *src)
  *           采用 32 位加法时，即为将高 16 位与低 16 位相加，
  *           之后还要把该次加法最高位产生的进位加到低 16 位
  *        3. 将上述的和取反，即得到校验和。  
+ *        求和由checksum.c中按CPU特性选出的向量化实现完成
  *        
  * @param buf 要计算的数据包
- * @param len 要计算的长度
- * @return uint16_t 校验和
+ * @param len 要计算的长度（16位字数）
+ * @return uint16_t 校验和（本机字节序）
  */
 uint16_t checksum16(uint16_t *buf, int len)
 {
-    // TODO
-    uint32_t sum=0;
-    for(int i=0;i<len;i++){
-        uint16_t temp =swap16(buf[i]);
-        sum+=temp;
-    }
-    uint16_t a=sum;//低16位
-    uint16_t b=sum>>16;//高16位
-    uint16_t c=a+b;
-    c = ~c;
-    return c;
+    uint16_t c = csum_fold(csum_partial(buf, len * 2, 0));
+    return swap16(c);
 }
\ No newline at end of file
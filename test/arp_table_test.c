@@ -0,0 +1,344 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "arp.h"
+#include "netif.h"
+#include "ethernet.h"
+#include "timer.h"
+
+#define TABLE_SIZE 16 //哈希索引为32个位置，容易构造探测链与回绕
+#define TX_LOG 128
+
+extern uint64_t fake_clock_ms;
+extern arp_entry_t *arp_table;
+extern arp_buf_t arp_buf[ARP_PENDING_NR];
+
+static int err;
+
+#define CHECK(cond, ...)                                        \
+        do{                                                     \
+                if(!(cond) && err++ < 20){                      \
+                        printf("\e[0;31m" __VA_ARGS__);         \
+                        printf("\n");                           \
+                }                                               \
+        }while(0)
+
+static uint8_t my_ip[] = DRIVER_IF_IP;
+static buf_t rx, tx_pkt, tx_hdr, tx_data;
+
+// 替换以太网层：记录最近一次发送的目的地址，以及前TX_LOG个数据包的长度与首尾字节
+static struct
+{
+        int nr;                   //发送次数
+        uint8_t mac[NET_MAC_LEN]; //最近一次的目的mac
+        net_protocol_t protocol;  //最近一次的上层协议
+        int len[TX_LOG];          //整条链的长度
+        uint8_t first[TX_LOG];    //第一个字节
+        uint8_t last[TX_LOG];     //最后一个字节
+} tx;
+
+int ethernet_out(buf_t *buf, const uint8_t *mac, net_protocol_t protocol)
+{
+        static uint8_t frame[BUF_MAX_LEN];
+        if(tx.nr < TX_LOG){
+                tx.len[tx.nr] = buf_chain_len(buf);
+                buf_gather(buf, frame);
+                tx.first[tx.nr] = frame[0];
+                tx.last[tx.nr] = frame[tx.len[tx.nr] - 1];
+        }
+        tx.nr++;
+        memcpy(tx.mac, mac, NET_MAC_LEN);
+        tx.protocol = protocol;
+        return 0;
+}
+
+static void ip_of(uint32_t a, uint8_t *ip)
+{
+        ip[0] = a >> 24;
+        ip[1] = a >> 16;
+        ip[2] = a >> 8;
+        ip[3] = a;
+}
+
+static void mac_of(uint32_t n, uint8_t *mac)
+{
+        mac[0] = 0x02;
+        mac[1] = 0;
+        mac[2] = n >> 24;
+        mac[3] = n >> 16;
+        mac[4] = n >> 8;
+        mac[5] = n;
+}
+
+// 与arp.c中的arp_hash()一致
+static uint32_t home_of(const uint8_t *ip, int bits)
+{
+        uint32_t key;
+        memcpy(&key, ip, NET_IP_LEN);
+        return (key * 0x9e3779b1u) >> (32 - bits);
+}
+
+// 从网卡0收到一个arp报文
+static void arp_pkt_in(int opcode, const uint8_t *sender_ip, const uint8_t *sender_mac, const uint8_t *target_ip)
+{
+        buf_init(&rx, sizeof(arp_pkt_t));
+        arp_pkt_t *pkt = (arp_pkt_t *)rx.data;
+        pkt->hw_type = swap16(ARP_HW_ETHER);
+        pkt->pro_type = swap16(NET_PROTOCOL_IP);
+        pkt->hw_len = NET_MAC_LEN;
+        pkt->pro_len = NET_IP_LEN;
+        pkt->opcode = swap16(opcode);
+        memcpy(pkt->sender_mac, sender_mac, NET_MAC_LEN);
+        memcpy(pkt->sender_ip, sender_ip, NET_IP_LEN);
+        memset(pkt->target_mac, 0, NET_MAC_LEN);
+        memcpy(pkt->target_ip, target_ip, NET_IP_LEN);
+        arp_in(&rx);
+}
+
+// 询问本机地址的请求，发送方新建表项
+static void learn(const uint8_t *ip, const uint8_t *mac)
+{
+        arp_pkt_in(ARP_REQUEST, ip, mac, my_ip);
+}
+
+// 发送一个ip数据包：已解析时直接发往mac，返回1；否则排入等待队列并发出arp请求，返回0
+static int resolved(const uint8_t *ip, const uint8_t *mac)
+{
+        buf_init(&tx_pkt, 20);
+        tx.nr = 0;
+        arp_out(&tx_pkt, (uint8_t *)ip, NET_PROTOCOL_IP);
+        return tx.nr == 1 && tx.protocol == NET_PROTOCOL_IP && memcmp(tx.mac, mac, NET_MAC_LEN) == 0;
+}
+
+// 发送一个协议头段 + 负载段的分片：协议头段的字节都是tag，负载段引用tx_data中从tag开始的len字节
+static int send_frag(const uint8_t *ip, int tag, int len)
+{
+        buf_init(&tx_hdr, 20);
+        memset(tx_hdr.data, tag, 20);
+        buf_slice(&tx_pkt, &tx_data, tag, len);
+        tx_hdr.next = &tx_pkt;
+        return arp_out(&tx_hdr, (uint8_t *)ip, NET_PROTOCOL_IP);
+}
+
+static int entries()
+{
+        int nr = 0;
+        for(int i = 0; i < TABLE_SIZE; i++)
+                nr += arp_table[i].state != ARP_INVALID;
+        return nr;
+}
+
+static void run_to(uint64_t now)
+{
+        fake_clock_ms = now;
+        timer_run();
+}
+
+// 所有表项老化删除后重新初始化arp表；逐秒推进，重发请求的表项也能按时删除
+static void reset()
+{
+        for(int i = 0; i <= ARP_TIMEOUT_SEC; i++)
+                run_to(fake_clock_ms + 1000);
+        CHECK(entries() == 0, "reset: %d entries left after aging", entries());
+        arp_init();
+}
+
+// 哈希索引：同一探测链上插入、回绕，删除链中间的表项后其余表项仍能找到
+static void test_index()
+{
+        int bits = 5;
+        uint8_t ip[TABLE_SIZE][NET_IP_LEN], mac[TABLE_SIZE][NET_MAC_LEN];
+        //起始位置在索引末尾与开头的地址，组成一条回绕的长探测链
+        int nr = 0;
+        for(uint32_t a = 0x0a000001; nr < TABLE_SIZE; a++){
+                ip_of(a, ip[nr]);
+                uint32_t home = home_of(ip[nr], bits);
+                if(home >= 29 || home <= 1)
+                        mac_of(a, mac[nr++]);
+        }
+        reset();
+        //偶数号先插入，先老化
+        for(int i = 0; i < TABLE_SIZE; i += 2)
+                learn(ip[i], mac[i]);
+        run_to(fake_clock_ms + 10000);
+        for(int i = 1; i < TABLE_SIZE; i += 2)
+                learn(ip[i], mac[i]);
+        CHECK(entries() == TABLE_SIZE, "insert: %d entries", entries());
+        for(int i = 0; i < TABLE_SIZE; i++)
+                CHECK(resolved(ip[i], mac[i]), "insert: entry %d (home %u) not found", i, home_of(ip[i], bits));
+        //探测链上隔一个删除一个
+        run_to(fake_clock_ms + ARP_TIMEOUT_SEC * 1000 - 10000);
+        CHECK(entries() == TABLE_SIZE / 2, "delete: %d entries", entries());
+        for(int i = 1; i < TABLE_SIZE; i += 2)
+                CHECK(resolved(ip[i], mac[i]), "delete: entry %d (home %u) lost", i, home_of(ip[i], bits));
+        for(int i = 0; i < TABLE_SIZE; i += 2)
+                CHECK(!resolved(ip[i], mac[i]) && tx.protocol == NET_PROTOCOL_ARP, "delete: entry %d still found", i);
+        //重新解析删除的地址后全部能找到
+        for(int i = 0; i < TABLE_SIZE; i += 2)
+                arp_pkt_in(ARP_REPLY, ip[i], mac[i], my_ip);
+        CHECK(entries() == TABLE_SIZE, "reinsert: %d entries", entries());
+        for(int i = 0; i < TABLE_SIZE; i++)
+                CHECK(resolved(ip[i], mac[i]), "reinsert: entry %d (home %u) not found", i, home_of(ip[i], bits));
+}
+
+// RFC 826的合并规则：与本机无关的arp报文只更新已有表项，不新建
+static void test_merge()
+{
+        uint8_t ip[NET_IP_LEN], mac[NET_MAC_LEN], other[NET_IP_LEN], mac2[NET_MAC_LEN];
+        reset();
+        ip_of(0x0a000101, ip);
+        mac_of(1, mac);
+        mac_of(2, mac2);
+        ip_of(0x0a000102, other);
+        arp_pkt_in(ARP_REQUEST, ip, mac, other);
+        arp_pkt_in(ARP_REPLY, ip, mac, other);
+        CHECK(entries() == 0, "merge: %d entries from packets not for us", entries());
+        learn(ip, mac);
+        CHECK(entries() == 1, "merge: request for us not learned");
+        //已有表项的mac变化时随之更新
+        arp_pkt_in(ARP_REQUEST, ip, mac2, other);
+        CHECK(entries() == 1 && resolved(ip, mac2), "merge: existing entry not updated");
+}
+
+// 表满后被引用过两次的下一跳不会被大量只出现一次的发送方挤出
+static void test_flood()
+{
+        uint8_t hot_ip[NET_IP_LEN], hot_mac[NET_MAC_LEN], once_ip[NET_IP_LEN], once_mac[NET_MAC_LEN];
+        uint8_t ip[NET_IP_LEN], mac[NET_MAC_LEN];
+        reset();
+        ip_of(0x0a000201, hot_ip);
+        mac_of(1, hot_mac);
+        ip_of(0x0a000202, once_ip);
+        mac_of(2, once_mac);
+        learn(hot_ip, hot_mac);
+        learn(once_ip, once_mac);
+        CHECK(resolved(hot_ip, hot_mac) && resolved(hot_ip, hot_mac), "flood: hot entry not resolved");
+        CHECK(resolved(once_ip, once_mac), "flood: entry referenced once not resolved");
+        for(uint32_t i = 0; i < 10 * TABLE_SIZE; i++){
+                ip_of(0x0b000000 + i, ip);
+                mac_of(0x1000 + i, mac);
+                learn(ip, mac);
+        }
+        CHECK(entries() == TABLE_SIZE, "flood: %d entries", entries());
+        CHECK(resolved(hot_ip, hot_mac), "flood: hot entry evicted");
+        CHECK(!resolved(once_ip, once_mac), "flood: entry referenced once survived");
+}
+
+// 等待队列：分片不复制、按顺序发出、每个地址的上限、请求的退避与重试耗尽后丢弃
+static void test_pending()
+{
+        uint8_t ip[NET_IP_LEN], mac[NET_MAC_LEN];
+        reset();
+        ip_of(0x0a000301, ip);
+        mac_of(1, mac);
+        buf_init(&tx_data, 256);
+        for(int k = 0; k < 256; k++)
+                tx_data.data[k] = k;
+        //分片的两段都共享发送者的缓冲块，发送者重用协议头段不影响已排队的分片
+        tx.nr = 0;
+        int ref = tx_data.block->ref;
+        for(int i = 0; i < 3; i++)
+                CHECK(send_frag(ip, i + 1, 100) == 0, "pending: frag %d not queued", i);
+        CHECK(tx.nr == 1 && tx.protocol == NET_PROTOCOL_ARP, "pending: %d frames sent, expected one arp request", tx.nr);
+        buf_free(&tx_pkt);
+        CHECK(tx_data.block->ref == ref + 3, "pending: payload copied, ref %d", tx_data.block->ref);
+        //按先后顺序发出
+        tx.nr = 0;
+        arp_pkt_in(ARP_REPLY, ip, mac, my_ip);
+        CHECK(tx.nr == 3, "pending: %d frags sent after reply", tx.nr);
+        for(int i = 0; i < 3 && i < tx.nr; i++)
+                CHECK(tx.len[i] == 120 && tx.first[i] == i + 1 && tx.last[i] == i + 100,
+                      "pending: frag %d sent as len %d first %d last %d", i, tx.len[i], tx.first[i], tx.last[i]);
+        CHECK(tx_data.block->ref == ref, "pending: payload not released, ref %d", tx_data.block->ref);
+
+        //超过ARP_PENDING_MAX的数据包丢弃
+        ip_of(0x0a000302, ip);
+        mac_of(2, mac);
+        for(int i = 0; i < ARP_PENDING_MAX + 5; i++)
+                CHECK(send_frag(ip, i % 100, 1) == (i < ARP_PENDING_MAX ? 0 : -1), "cap: packet %d", i);
+        buf_free(&tx_pkt);
+        tx.nr = 0;
+        arp_pkt_in(ARP_REPLY, ip, mac, my_ip);
+        CHECK(tx.nr == ARP_PENDING_MAX, "cap: %d packets sent after reply", tx.nr);
+
+        //请求间隔按ARP_MIN_INTERVAL加倍，ARP_MAX_RETRY次后删除表项并丢弃等待的数据包
+        ip_of(0x0a000303, ip);
+        uint64_t t = fake_clock_ms, interval = ARP_MIN_INTERVAL * 1000;
+        tx.nr = 0;
+        send_frag(ip, 1, 100);
+        send_frag(ip, 2, 100);
+        buf_free(&tx_pkt);
+        CHECK(tx.nr == 1, "backoff: %d requests for two packets", tx.nr);
+        for(int n = 1; n < ARP_MAX_RETRY; n++){
+                t += interval;
+                run_to(t - 1);
+                CHECK(tx.nr == n, "backoff: request %d sent early", n + 1);
+                run_to(t);
+                CHECK(tx.nr == n + 1 && tx.protocol == NET_PROTOCOL_ARP, "backoff: request %d not sent at %llu ms",
+                      n + 1, (unsigned long long)(t - fake_clock_ms));
+                interval *= 2;
+        }
+        int nr = entries();
+        run_to(t + interval);
+        CHECK(tx.nr == ARP_MAX_RETRY, "backoff: %d requests, expected %d", tx.nr, ARP_MAX_RETRY);
+        CHECK(entries() == nr - 1, "backoff: entry not removed after %d requests", ARP_MAX_RETRY);
+        CHECK(tx_data.block->ref == ref, "backoff: queued packets not dropped, ref %d", tx_data.block->ref);
+}
+
+// 从快照恢复的表项立即可用，依次单播探测，没有应答的删除
+static void test_restore()
+{
+        const char *path = "arp_table_test.bin";
+        uint8_t ip[3][NET_IP_LEN], mac[3][NET_MAC_LEN];
+        reset();
+        for(int i = 0; i < 3; i++){
+                ip_of(0x0a000401 + i, ip[i]);
+                mac_of(i + 1, mac[i]);
+                learn(ip[i], mac[i]);
+        }
+        CHECK(arp_save(path) == 3, "restore: snapshot not saved");
+        reset();
+        CHECK(arp_load(path) == 3, "restore: snapshot not loaded");
+        remove(path);
+        uint64_t t = fake_clock_ms;
+        for(int i = 0; i < 3; i++)
+                CHECK(resolved(ip[i], mac[i]), "restore: entry %d not usable", i);
+        //探测按ARP_PROBE_GAP_MS的间隔逐个单播发出
+        for(int i = 0; i < 3; i++){
+                tx.nr = 0;
+                run_to(t + (i + 1) * ARP_PROBE_GAP_MS);
+                CHECK(tx.nr == 1 && tx.protocol == NET_PROTOCOL_ARP && memcmp(tx.mac, mac[i], NET_MAC_LEN) == 0,
+                      "restore: probe %d not sent to its mac", i);
+        }
+        arp_pkt_in(ARP_REPLY, ip[0], mac[0], my_ip);
+        arp_pkt_in(ARP_REPLY, ip[1], mac[1], my_ip);
+        tx.nr = 0;
+        run_to(t + 3 * ARP_PROBE_GAP_MS + ARP_MIN_INTERVAL * 1000);
+        CHECK(tx.nr == 0, "restore: %d frames sent after the probes", tx.nr);
+        CHECK(entries() == 2, "restore: %d entries after the probe deadline", entries());
+        CHECK(resolved(ip[0], mac[0]) && resolved(ip[1], mac[1]), "restore: confirmed entry removed");
+        CHECK(!resolved(ip[2], mac[2]), "restore: unanswered entry kept");
+}
+
+int main()
+{
+        printf("\e[0;34mTest begin.\n");
+        fake_clock_ms = 1000000;
+        timer_init();
+        net_if_init();
+        arp_set_size(TABLE_SIZE);
+        arp_init();
+        test_index();
+        test_merge();
+        test_flood();
+        test_pending();
+        test_restore();
+        if(err){
+                printf("\e[1;31mArp table test failed, %d errors.\n", err);
+                return 1;
+        }
+        printf("\e[1;32mArp table test passed.\n");
+        return 0;
+}
@@ -51,17 +51,18 @@ int main(){
         log_tab_buf();
         int i = 1;
         printf("\e[0;34mFeeding input %02d",i);
-        while((ret = driver_recv(&buf)) > 0){
+        while((ret = driver_recv(net_if_get(0)->drv,&buf)) > 0){
                 printf("\b\b%02d",i);
                 fprintf(control_flow,"\nRound %02d -----------------------------\n",i++);
                 if(memcmp(buf.data,my_mac,6) && memcmp(buf.data,boardcast_mac,6)){
-                        buf_t buf2;
+                        buf_t buf2 = {0};
                         buf_copy(&buf2, &buf);
                         memset(buf2.data,0,sizeof(ether_hdr_t));
                         buf_remove_header(&buf2, sizeof(ether_hdr_t));
                         uint8_t * ip = buf.data + 30;
                         net_protocol_t pro = buf.data[13] ? NET_PROTOCOL_ARP : NET_PROTOCOL_IP;
                         arp_out(&buf2,ip,pro);
+                        buf_free(&buf2);
                 }else{
                         ethernet_in(&buf);
                 }
@@ -70,7 +71,7 @@ int main(){
         if(ret < 0){
                 fprintf(stderr,"\e[1;31m\nError occur on receive,exiting\n");
         }
-        driver_close();
+        driver_close(net_if_get(0)->drv);
         printf("\e[0;34m\nSample input all processed, checking output\n");
 
         fclose(control_flow);
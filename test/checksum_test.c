@@ -0,0 +1,193 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utils.h"
+#include "checksum.h"
+
+#define swap16(x) ((((x)&0xFF) << 8) | (((x) >> 8) & 0xFF))
+#define MAX_LEN 65536
+
+static const char *impls[] = {"scalar", "sse2", "avx2"};
+static const int bench_len[] = {20, 64, 256, 576, 1500, 4096, 9000, 65535};
+static uint8_t data[MAX_LEN + 64];
+static uint8_t copy[MAX_LEN + 64];
+
+// 原来udp_checksum中的逐字实现，作为对照
+uint16_t ref_checksum(const uint8_t *p, int len)
+{
+        uint32_t sum = 0;
+        for(int i = 0; i < len / 2; i++)
+                sum += (p[2 * i] << 8) | p[2 * i + 1];
+        if(len % 2 == 1)
+                sum += p[len - 1] << 8;
+        while(sum >> 16)
+                sum = (sum & 0xffff) + (sum >> 16);
+        return ~sum;
+}
+
+uint16_t new_checksum(const uint8_t *p, int len)
+{
+        uint16_t c = csum_fold(csum_partial(p, len, 0));
+        return swap16(c);
+}
+
+// 先拷贝再求和
+uint16_t copy_then_checksum(const uint8_t *p, int len)
+{
+        memcpy(copy, p, len);
+        return new_checksum(copy, len);
+}
+
+// 拷贝与求和合并
+uint16_t fused_copy_checksum(const uint8_t *p, int len)
+{
+        uint16_t c = csum_fold(csum_partial_copy(copy, p, len, 0));
+        return swap16(c);
+}
+
+int check(const char *name)
+{
+        int err = 0;
+        // 所有长度与起始对齐
+        for(int off = 0; off < 4; off++)
+                for(int len = 0; len <= 2048 + 64; len++)
+                        if(new_checksum(data + off, len) != ref_checksum(data + off, len)){
+                                if(err++ < 5)
+                                        printf("\e[0;31m%s: mismatch len=%d off=%d\n", name, len, off);
+                        }
+        // 大包
+        for(int len = MAX_LEN - 40; len <= MAX_LEN; len++)
+                if(new_checksum(data + 1, len) != ref_checksum(data + 1, len)){
+                        if(err++ < 5)
+                                printf("\e[0;31m%s: mismatch len=%d\n", name, len);
+                }
+        // 分段累加
+        for(int cut = 0; cut <= 1500; cut += 2){
+                uint32_t sum = csum_partial(data, cut, 0);
+                sum = csum_partial(data + cut, 1500 - cut, sum);
+                if(swap16(csum_fold(sum)) != ref_checksum(data, 1500)){
+                        if(err++ < 5)
+                                printf("\e[0;31m%s: mismatch at cut %d\n", name, cut);
+                }
+        }
+        // 拷贝并求和：拷贝结果与校验和都要正确
+        for(int off = 0; off < 4; off++)
+                for(int len = 0; len <= 2048 + 64; len += 1 + off){
+                        memset(copy, 0, len + 8);
+                        if(fused_copy_checksum(data + off, len) != ref_checksum(data + off, len)
+                           || memcmp(copy, data + off, len) || copy[len] != 0){
+                                if(err++ < 5)
+                                        printf("\e[0;31m%s: copy mismatch len=%d off=%d\n", name, len, off);
+                        }
+                }
+        // 增量修改：改写首部中的字段后与重新计算的结果一致
+        for(int i = 0; i < 1000; i++){
+                uint16_t hdr[10];
+                memcpy(hdr, data + i, 20);
+                hdr[5] = 0;
+                hdr[5] = csum_fold(csum_partial(hdr, 20, 0));
+                uint16_t to = rand();
+                uint32_t to32 = ((uint32_t)rand() << 16) ^ rand();
+                csum_replace2(&hdr[5], hdr[i % 5], to);
+                hdr[i % 5] = to;
+                uint32_t from32;
+                memcpy(&from32, &hdr[6 + (i & 2)], 4);
+                csum_replace4(&hdr[5], from32, to32);
+                memcpy(&hdr[6 + (i & 2)], &to32, 4);
+                if(csum_fold(csum_partial(hdr, 20, 0)) != 0){
+                        if(err++ < 5)
+                                printf("\e[0;31m%s: incremental update mismatch at %d\n", name, i);
+                }
+        }
+        // 伪首部：缓存命中与未命中都与逐字节构造的伪首部一致
+        for(int i = 0; i < 1000; i++){
+                uint8_t pseudo[12];
+                const uint8_t *ip = data + (i % 40) * 8;
+                memcpy(pseudo, ip, 8);
+                pseudo[8] = 0;
+                pseudo[9] = (i & 4) ? 6 : 17;
+                pseudo[10] = (i * 7) >> 8;
+                pseudo[11] = (i * 7) & 0xff;
+                if(csum_fold(csum_pseudo_partial(ip, ip + 4, pseudo[9], i * 7)) != csum_fold(csum_partial(pseudo, 12, 0))){
+                        if(err++ < 5)
+                                printf("\e[0;31m%s: pseudo header mismatch at %d\n", name, i);
+                }
+        }
+        // checksum16按16位字计数
+        if(checksum16((uint16_t *)data, 10) != ref_checksum(data, 20)){
+                err++;
+                printf("\e[0;31m%s: checksum16 mismatch\n", name);
+        }
+        return err;
+}
+
+double bench(int len, uint16_t (*func)(const uint8_t *, int))
+{
+        struct timespec t0, t1;
+        int rounds = (64 << 20) / len + 1;
+        volatile uint16_t sink = 0;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        for(int i = 0; i < rounds; i++)
+                sink += func(data + (i & 1), len);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
+        double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+        return ns / rounds;
+}
+
+int main()
+{
+        int diff = 0;
+        srand(1);
+        printf("\e[0;34mTest begin.\n");
+
+        // 随机数据 + 全0xff数据（进位最多的情况）
+        for(int pass = 0; pass < 2; pass++){
+                for(int i = 0; i < (int)sizeof(data); i++)
+                        data[i] = pass ? 0xff : rand();
+                for(int i = 0; i < (int)(sizeof(impls) / sizeof(impls[0])); i++){
+                        if(csum_select(impls[i]) != 0){
+                                if(pass == 0)
+                                        printf("\e[0;33m%s not supported, skipped.\n", impls[i]);
+                                continue;
+                        }
+                        diff += check(impls[i]);
+                }
+        }
+        if(diff){
+                printf("\e[1;31mChecksum mismatch, %d errors.\n", diff);
+                return 1;
+        }
+        printf("\e[1;32mAll checksums match the reference.\n");
+
+        printf("\e[0;34mBenchmark (ns per call / GB/s):\n\e[0m%8s %18s", "len", "reference");
+        for(int i = 0; i < (int)(sizeof(impls) / sizeof(impls[0])); i++)
+                printf(" %18s", impls[i]);
+        printf("\n");
+        for(int j = 0; j < (int)(sizeof(bench_len) / sizeof(bench_len[0])); j++){
+                int len = bench_len[j];
+                double ns = bench(len, ref_checksum);
+                printf("%8d %9.1f / %6.2f", len, ns, len / ns);
+                for(int i = 0; i < (int)(sizeof(impls) / sizeof(impls[0])); i++){
+                        if(csum_select(impls[i]) != 0){
+                                printf(" %18s", "-");
+                                continue;
+                        }
+                        ns = bench(len, new_checksum);
+                        printf(" %9.1f / %6.2f", ns, len / ns);
+                }
+                printf("\n");
+        }
+
+        csum_select(NULL);
+        printf("\e[0;34mCopy + checksum with %s (ns per call / GB/s):\n\e[0m%8s %18s %18s\n", csum_impl_name(), "len", "memcpy+csum", "fused");
+        for(int j = 0; j < (int)(sizeof(bench_len) / sizeof(bench_len[0])); j++){
+                int len = bench_len[j];
+                double ns1 = bench(len, copy_then_checksum);
+                double ns2 = bench(len, fused_copy_checksum);
+                printf("%8d %9.1f / %6.2f %9.1f / %6.2f\n", len, ns1, len / ns1, ns2, len / ns2);
+        }
+        printf("\e[0;34mSelected implementation: %s\n\e[0m", csum_impl_name());
+        return 0;
+}
@@ -32,6 +32,7 @@ uint8_t ip[][4] =
 };
 
 buf_t buf;
+net_if_t netif;
 buf_t* redirect_in(int id)
 {
         memcpy(buf.data,my_mac,6);
@@ -116,7 +117,7 @@ int main()
         pcap_out = fopen("data/in.pcap","w");
         control_flow = fopen("data/control.txt","w");
 
-        if(driver_open()){
+        if(driver_open(&netif)){
                 fprintf(stderr,"driver open failed,exiting\n");
                 return 0;
         }
@@ -124,36 +125,36 @@ int main()
         int j = 0;
         int k = 0;
         initArp();
-        while((ret = driver_recv(&buf)) > 0){
+        while((ret = driver_recv(netif.drv,&buf)) > 0){
                 if(i == 21){
-                        driver_send(redirect_out(1));
-                        driver_send(genArp(1,1));
+                        driver_send(netif.drv,redirect_out(1));
+                        driver_send(netif.drv,genArp(1,1));
                 }
                 if(i == 22 || i == 25){
-                        driver_send(redirect_out(1));
+                        driver_send(netif.drv,redirect_out(1));
                 }
                 if(i == 23 || i == 24 || i == 26){
-                        driver_send(redirect_in(1));
+                        driver_send(netif.drv,redirect_in(1));
                 }
                 if(i == 27){
-                        driver_send(redirect_in(0));
-                        driver_send(genArp(0,1));
-                        driver_send(genArp(2,0));
+                        driver_send(netif.drv,redirect_in(0));
+                        driver_send(netif.drv,genArp(0,1));
+                        driver_send(netif.drv,genArp(2,0));
                 }
                 if(i == 28){
-                        driver_send(redirect_out(0));
+                        driver_send(netif.drv,redirect_out(0));
                 }
                 if(i == 33){
-                        driver_send(redirect_in(2));
+                        driver_send(netif.drv,redirect_in(2));
                 }
                 if(i == 34){
-                        driver_send(redirect_out(2));
+                        driver_send(netif.drv,redirect_out(2));
                 }
                 if(i == 114){
-                        driver_send(redirect_out(1));
+                        driver_send(netif.drv,redirect_out(1));
                 }
                 if(i == 115){
-                        driver_send(redirect_in(1));
+                        driver_send(netif.drv,redirect_in(1));
                 }
                 // if(i == cap_in[j]){
                 //         j++;
@@ -178,7 +179,7 @@ int main()
         if(ret < 0){
                 fprintf(stderr,"error occur on receive,exiting\n");
         }
-        driver_close();
+        driver_close(netif.drv);
         
         // fclose(pcap_in);
         // fclose(pcap_out);
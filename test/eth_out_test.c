@@ -37,7 +37,7 @@ int main(){
         }
         int i = 1;
         printf("\e[0;34mFeeding input %02d",i);
-        while((ret = driver_recv(&buf)) > 0){
+        while((ret = driver_recv(net_if_get(0)->drv,&buf)) > 0){
                 printf("\b\b%02d",i);
                 fprintf(control_flow,"\nRound %02d -----------------------------\n",i++);
                 buf_copy(&buf2, &buf);
@@ -51,7 +51,7 @@ int main(){
         if(ret < 0){
                 fprintf(stderr,"\e[1;31m\nError occur on loading input,exiting\n");
         }
-        driver_close();
+        driver_close(net_if_get(0)->drv);
         printf("\e[0;34m\nSample input all processed, checking output\n");
 
         fclose(control_flow);
@@ -14,8 +14,9 @@ char* print_ip(uint8_t *ip);
 char* print_mac(uint8_t *mac);
 void fprint_buf(FILE* f, buf_t* buf);
 
-arp_entry_t arp_table[ARP_MAX_ENTRY];
-arp_buf_t arp_buf;
+arp_entry_t *arp_table;
+int arp_table_size;
+arp_buf_t arp_buf[ARP_PENDING_NR];
 
 void arp_update(uint8_t *ip, uint8_t *mac, arp_state_t state)
 {
@@ -31,15 +32,22 @@ void arp_in(buf_t *buf)
         fprint_buf(arp_fout,buf);
 }
 
-void arp_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol)
+int arp_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol)
 {
         fprintf(arp_fout,"arp_out\t");
         fprintf(arp_fout,"ip:%s\t",print_ip(ip));
         fprintf(arp_fout,"protocol: %d\t",protocol);
         fprint_buf(arp_fout,buf);
+        return 0;
 }
 
 void arp_init()
 {
         fprintf(arp_fout,"arp_init\n");
-}
\ No newline at end of file
+}
+
+void arp_confirm(const uint8_t *ip, const uint8_t *mac)
+{
+        (void)ip;
+        (void)mac;
+}
@@ -0,0 +1,13 @@
+#include <stdint.h>
+#include <time.h>
+
+uint64_t fake_clock_ms; //由测试推进的单调时钟(ms)
+
+// 替换libc的clock_gettime，timer_run()读到的时间完全由测试控制
+int clock_gettime(clockid_t clk_id, struct timespec *ts)
+{
+        (void)clk_id;
+        ts->tv_sec = fake_clock_ms / 1000;
+        ts->tv_nsec = fake_clock_ms % 1000 * 1000000;
+        return 0;
+}
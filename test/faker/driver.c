@@ -2,32 +2,45 @@
 #include <string.h>
 #include <utils.h>
 #include "config.h"
+#include "driver.h"
+struct driver
+{
+        net_if_t *netif;
+};
+static struct driver drvs[NET_IF_MAX_NR];
 static pcap_t *pcap;
 static pcap_dumper_t *pdump;
 static char pcap_errbuf[PCAP_ERRBUF_SIZE];
 extern FILE* pcap_in;
 extern FILE* pcap_out;
 extern FILE *control_flow;
+int driver_sent; //交给driver_send()的帧数
 
-int driver_open()
+int driver_open(net_if_t *netif)
 {
-        pcap = pcap_fopen_offline(pcap_in,pcap_errbuf);
-        if(pcap == NULL){
-                fprintf(stderr,"pcap_open_offline() failed:%s\n",pcap_errbuf);
-                return -1;
-        }
+        //所有网卡共用同一对输入输出文件；没有输入文件时（如route_bench）只统计发出的帧数
+        if(pcap == NULL && pcap_in){
+                pcap = pcap_fopen_offline(pcap_in,pcap_errbuf);
+                if(pcap == NULL){
+                        fprintf(stderr,"pcap_open_offline() failed:%s\n",pcap_errbuf);
+                        return -1;
+                }
 
-        pdump = pcap_dump_fopen(pcap,pcap_out);
-        if(pdump == NULL){
-                fprintf(stderr,"pcap_dump_fopen() failed:%s\n", pcap_geterr(pcap));
-                return -1;
+                pdump = pcap_dump_fopen(pcap,pcap_out);
+                if(pdump == NULL){
+                        fprintf(stderr,"pcap_dump_fopen() failed:%s\n", pcap_geterr(pcap));
+                        return -1;
+                }
         }
 
-        fprintf(control_flow,"driver opened\n");
+        drvs[netif->index].netif = netif;
+        netif->drv = &drvs[netif->index];
+        if(control_flow)
+                fprintf(control_flow,"driver opened\n");
         return 0;
 }
 
-int driver_recv(buf_t *buf)
+int driver_recv(driver_t *drv, buf_t *buf)
 {
         struct pcap_pkthdr *pkt_hdr;
         const uint8_t *pkt_data;
@@ -38,6 +51,7 @@ int driver_recv(buf_t *buf)
         }else if (ret == 1){
                 buf_init(buf,pkt_hdr->len);
                 memcpy(buf->data, pkt_data, pkt_hdr->len);
+                buf->if_index = drv->netif->index;
                 return pkt_hdr->len;
         }else{
                 fprintf(stderr, "Error in driver_recv: %s\n", pcap_geterr(pcap));
@@ -45,19 +59,87 @@ int driver_recv(buf_t *buf)
         }
 }
 
-int driver_send(buf_t *buf)
+int driver_recv_burst(driver_t *drv, buf_t *bufs, int max)
+{
+        int cnt = 0;
+        while(cnt < max){
+                int ret = driver_recv(drv, &bufs[cnt]);
+                if(ret < 0)
+                        return cnt ? cnt : -1;
+                if(ret == 0)
+                        break;
+                cnt++;
+        }
+        return cnt;
+}
+
+int driver_recv_zerocopy(driver_t *drv, int max, driver_handler_t handler)
+{
+        static buf_t buf;
+        int cnt = 0;
+        while(cnt < max){
+                int ret = driver_recv(drv, &buf);
+                if(ret < 0)
+                        return cnt ? cnt : -1;
+                if(ret == 0)
+                        break;
+                handler(&buf);
+                cnt++;
+        }
+        return cnt;
+}
+
+int driver_send(driver_t *drv, buf_t *buf)
 {
         struct pcap_pkthdr header;
+        uint8_t frame[BUF_MAX_LEN];
+        driver_sent++;
+        if(pdump == NULL)
+                return 0;
         memset(&header.ts,0,sizeof(header.ts));
-        header.caplen = buf->len;
-        header.len = buf->len;
-        pcap_dump((u_char *)pdump,&header,buf->data);
+        header.caplen = buf_chain_len(buf);
+        header.len = header.caplen;
+        buf_gather(buf,frame);
+        pcap_dump((u_char *)pdump,&header,frame);
         return 0;
 }
 
-void driver_close()
+int driver_flush(driver_t *drv)
+{
+        return 0;
+}
+
+int driver_offload(driver_t *drv)
+{
+        return 0;
+}
+
+int driver_set_filter(driver_t *drv, const char *filter_exp)
+{
+        return 0;
+}
+
+int driver_set_profile(int profile)
+{
+        return 0;
+}
+
+int driver_stats(driver_t *drv, driver_stats_t *stats)
+{
+        return -1;
+}
+
+int driver_fd(driver_t *drv)
+{
+        return -1;
+}
+
+void driver_close(driver_t *drv)
 {
         fprintf(control_flow,"\ndriver closed\n");
         pcap_dump_close(pdump);
         pcap_close(pcap);
+        pdump = NULL;
+        pcap = NULL;
+        drv->netif->drv = NULL;
 }
@@ -15,8 +15,9 @@ static void icmp_resp(buf_t *req_buf, uint8_t *src_ip)
         fprint_buf(icmp_fout, req_buf);
 }
 
-void icmp_in(buf_t *buf, uint8_t *src_ip)
+void icmp_in(buf_t *buf, uint8_t *src_ip, uint8_t *dest_ip)
 {
+        (void)dest_ip;
         fprintf(icmp_fout,"icmp_in:\t");
         fprintf(icmp_fout,"ip: %s\n",print_ip(src_ip));
         fprint_buf(icmp_fout, buf);
@@ -29,4 +30,19 @@ void icmp_unreachable(buf_t *recv_buf, uint8_t *src_ip, icmp_code_t code)
         fprintf(icmp_fout,"ip: %s\t",src_ip ? print_ip(src_ip) : "null");
         fprintf(icmp_fout,"code: %d\n",code);
         fprint_buf(icmp_fout, recv_buf);
-}
\ No newline at end of file
+}
+
+void icmp_time_exceeded(buf_t *recv_buf, uint8_t *src_ip)
+{
+        fprintf(icmp_fout,"icmp_time_exceeded:\t");
+        fprintf(icmp_fout,"ip: %s\n",src_ip ? print_ip(src_ip) : "null");
+        fprint_buf(icmp_fout, recv_buf);
+}
+
+void icmp_frag_needed(buf_t *recv_buf, uint8_t *src_ip, uint16_t mtu)
+{
+        fprintf(icmp_fout,"icmp_frag_needed:\t");
+        fprintf(icmp_fout,"ip: %s\t",src_ip ? print_ip(src_ip) : "null");
+        fprintf(icmp_fout,"mtu: %d\n",mtu);
+        fprint_buf(icmp_fout, recv_buf);
+}
@@ -19,7 +19,7 @@ void ip_in(buf_t *buf)
         fprint_buf(ip_fout, buf);
 }
 
-void ip_fragment_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol, int id, uint16_t offset, int mf)
+int ip_fragment_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol, int id, uint16_t offset, int mf)
 {
         fprintf(ip_fout,"ip_fragment_out:\t");        
         fprintf(ip_fout,"ip: %s\t", print_ip(ip));
@@ -28,12 +28,14 @@ void ip_fragment_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol, int id, u
         fprintf(ip_fout,"offset: %d\t",offset);
         fprintf(ip_fout,"mf: %d\n",mf);
         fprint_buf(ip_fout, buf);
+        return 0;
 }
 
-void ip_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol)
+int ip_out(buf_t *buf, uint8_t *ip, net_protocol_t protocol)
 {
         fprintf(ip_fout,"ip_out:\t");
         fprintf(ip_fout,"ip: %s\t", print_ip(ip));
         fprintf(ip_fout,"protocol: %d\n",protocol);
         fprint_buf(ip_fout, buf);
+        return 0;
 }
\ No newline at end of file
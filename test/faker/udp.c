@@ -10,19 +10,21 @@ extern FILE *udp_fout;
 char* print_ip(uint8_t *ip);
 void fprint_buf(FILE* f, buf_t* buf);
 
-void udp_in(buf_t *buf, uint8_t *src_ip)
+void udp_in(buf_t *buf, uint8_t *src_ip, uint8_t *dest_ip)
 {
+        (void)dest_ip;
         fprintf(udp_fout,"udp_in:\tsrc_ip:%s\n",print_ip(src_ip));
         fprint_buf(udp_fout, buf);
 }
 
-void udp_out(buf_t *buf, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port)
+int udp_out(buf_t *buf, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port)
 {
         fprintf(udp_fout,"udp_out:\t");
         fprintf(udp_fout,"src_port: %d\t", src_port);
         fprintf(udp_fout,"dest_ip: %s\t", print_ip(dest_ip));
         fprintf(udp_fout,"dest_port: %d\n", dest_port);
         fprint_buf(udp_fout, buf);
+        return 0;
 }
 
 void udp_init()
@@ -41,7 +43,7 @@ void udp_close(uint16_t port)
 }
 
 
-void udp_send(uint8_t *data, uint16_t len, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port)
+int udp_send(uint8_t *data, uint16_t len, uint16_t src_port, uint8_t *dest_ip, uint16_t dest_port)
 {
         fprintf(udp_fout,"udp_send: len:%d\t",len);
         fprintf(udp_fout,"src_port:%d\t",src_port);
@@ -56,4 +58,5 @@ void udp_send(uint8_t *data, uint16_t len, uint16_t src_port, uint8_t *dest_ip,
         }else{
                 fprintf(udp_fout," (null)\n");
         }
+        return 0;
 }
\ No newline at end of file
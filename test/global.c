@@ -28,8 +28,9 @@ FILE *udp_fout;
 FILE *out_log;
 FILE *demo_log;
 
-extern arp_entry_t arp_table[ARP_MAX_ENTRY];
-extern arp_buf_t arp_buf;
+extern arp_entry_t *arp_table;
+extern int arp_table_size;
+extern arp_buf_t arp_buf[ARP_PENDING_NR];
 
 static char* state[16] = {
         [ARP_PENDING] "pending",
@@ -79,8 +80,10 @@ void fprint_buf(FILE* f, buf_t* buf)
         if(buf == 0){
                 fprintf(f,"(null)\n");
         }else{
-                for(int i = 0; i < buf->len; i++){
-                        fprintf(f," %02x",buf->data[i]);
+                for(buf_t *seg = buf; seg; seg = seg->next){
+                        for(int i = 0; i < seg->len; i++){
+                                fprintf(f," %02x",seg->data[i]);
+                        }
                 }
                 fprintf(f,"\n");
         }
@@ -89,8 +92,9 @@ void fprint_buf(FILE* f, buf_t* buf)
 void log_tab_buf(){
         fprintf(arp_log_f, "<====== arp table =======>\n");
         fprintf(arp_log_f, "state  \ttimeout/10^7\tip\t\t\tmac\n");
-        for(int i = 0; i < ARP_MAX_ENTRY; i++){
-                if(arp_table[i].state != ARP_INVALID){
+        for(int i = 0; arp_table && i < arp_table_size; i++){
+                //等待解析的表项在下面随其数据包一起输出
+                if(arp_table[i].state != ARP_INVALID && arp_table[i].state != ARP_PENDING){
                         fprintf(arp_log_f, "%s\t%ld\t\t%s\t\t%s\n",
                                 state[arp_table[i].state],
                                 arp_table[i].timeout/10000000,
@@ -99,15 +103,25 @@ void log_tab_buf(){
                 }
         }
         fprintf(arp_log_f, "arp buf: \n");
-        fprintf(arp_log_f, "\tvalid: %d\n",arp_buf.valid);
-        if(arp_buf.valid){
-                fprintf(arp_log_f, "\tbuf:");
-                for(int i = 0; i < arp_buf.buf.len; i++){
-                        fprintf(arp_log_f, "%02x ",arp_buf.buf.data[i]);
+        int pending = 0;
+        for(int i = 0; arp_table && i < arp_table_size; i++){
+                if(arp_table[i].state != ARP_PENDING)
+                        continue;
+                for(int j = arp_table[i].pending_head; j >= 0; j = arp_buf[j].next){
+                        pending++;
+                        fprintf(arp_log_f, "\tvalid: %d\n",arp_buf[j].valid);
+                        fprintf(arp_log_f, "\tbuf:");
+                        for(buf_t *seg = &arp_buf[j].buf; seg; seg = seg->next){
+                                for(int k = 0; k < seg->len; k++){
+                                        fprintf(arp_log_f, "%02x ",seg->data[k]);
+                                }
+                        }
+                        fprintf(arp_log_f, "\n\tip: %s\n", print_ip(arp_buf[j].ip));
+                        fprintf(arp_log_f, "\tprotocol: %04x\n",arp_buf[j].protocol);
                 }
-                fprintf(arp_log_f, "\n\tip: %s\n", print_ip(arp_buf.ip));
-                fprintf(arp_log_f, "\tprotocol: %04x\n",arp_buf.protocol);
         }
+        if(pending == 0)
+                fprintf(arp_log_f, "\tvalid: 0\n");
 }
 
 
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <string.h>
+#include "driver.h"
+#include "ethernet.h"
+#include "arp.h"
+#include "ip.h"
+#include "route.h"
+
+extern FILE *pcap_in;
+extern FILE *pcap_out;
+extern FILE *pcap_demo;
+extern FILE *control_flow;
+extern FILE *icmp_fout;
+extern FILE *udp_fout;
+extern FILE *demo_log;
+extern FILE *out_log;
+extern FILE *arp_log_f;
+extern uint64_t fake_clock_ms;
+
+// 0号网卡为默认网卡（MTU 1500），数据报经1号网卡（MTU 1280）上的网关转发到10.9.0.0/16
+uint8_t out_ip[] = {192, 168, 200, 2};
+uint8_t gw_ip[] = {192, 168, 200, 1};
+uint8_t gw_mac[] = {0x02, 0x00, 0x00, 0x00, 0xc8, 0x01};
+uint8_t dest_net[] = {10, 9, 0, 0};
+
+int check_log();
+int check_pcap();
+void log_tab_buf();
+
+buf_t buf;
+int main(){
+        int ret;
+        printf("\e[0;34mTest begin.\n");
+        pcap_in = fopen("data/ip_forward_test/in.pcap","r");
+        pcap_out = fopen("data/ip_forward_test/out.pcap","w");
+        control_flow = fopen("data/ip_forward_test/log","w");
+        if(pcap_in == 0 || pcap_out == 0 || control_flow == 0){
+                if(pcap_in) fclose(pcap_in); else printf("\e[1;31mFailed to open in.pcap\n");
+                if(pcap_out)fclose(pcap_out); else printf("\e[1;31mFailed to open out.pcap\n");
+                if(control_flow) fclose(control_flow); else printf("\e[1;31mFailed to open log\n");
+                return 0;
+        }
+        icmp_fout = control_flow;
+        udp_fout = control_flow;
+        arp_log_f = control_flow;
+        fake_clock_ms = 1000000;
+
+        net_if_init();
+        net_if_t *out = net_if_add("out", NULL, 1280);
+        if(out == NULL || net_if_addr_add(out, out_ip, 24) || route_add(dest_net, 16, gw_ip, -1)){
+                fprintf(stderr,"\e[1;31mInterface setup failed,exiting\n");
+                fclose(pcap_in);
+                fclose(pcap_out);
+                fclose(control_flow);
+                return 0;
+        }
+        ip_set_forward(1);
+        if(ethernet_init()){
+                fprintf(stderr,"\e[1;31mDriver open failed,exiting\n");
+                fclose(pcap_in);
+                fclose(pcap_out);
+                fclose(control_flow);
+                return 0;
+        }
+        arp_init();
+        ip_init();
+        log_tab_buf();
+        int i = 1;
+        printf("\e[0;34mFeeding input %02d",i);
+        while((ret = driver_recv(net_if_get(0)->drv,&buf)) > 0){
+                printf("\b\b%02d",i);
+                fprintf(control_flow,"\nRound %02d -----------------------------\n",i++);
+                //网关的应答从1号网卡收到
+                if(memcmp(buf.data + 6,gw_mac,6) == 0)
+                        buf.if_index = out->index;
+                ethernet_in(&buf);
+                log_tab_buf();
+        }
+        if(ret < 0){
+                fprintf(stderr,"\e[1;31m\nError occur on loading input,exiting\n");
+        }
+        driver_close(net_if_get(0)->drv);
+        printf("\e[0;34m\nSample input all processed, checking output\n");
+
+        fclose(control_flow);
+
+        demo_log = fopen("data/ip_forward_test/demo_log","r");
+        out_log = fopen("data/ip_forward_test/log","r");
+        pcap_out = fopen("data/ip_forward_test/out.pcap","r");
+        pcap_demo = fopen("data/ip_forward_test/demo_out.pcap","r");
+        if(demo_log == 0 || out_log == 0 || pcap_out == 0 || pcap_demo == 0){
+                if(demo_log) fclose(demo_log); else printf("\e[1;31mFailed to open demo_log\n");
+                if(out_log) fclose(out_log); else printf("\e[1;31mFailed to open log\n");
+                if(pcap_demo) fclose(pcap_demo); else printf("\e[1;31mFailed to open demo_out.pcap\n");
+                if(pcap_out) fclose(pcap_out); else printf("\e[1;31mFailed to open out.pcap\n");
+                return 0;
+        }
+        check_log();
+        check_pcap();
+        printf("\e[1;33mFor this test, log is only a reference. Your implementation is OK if your pcap file is the same to the demo pcap file.\n");
+        fclose(demo_log);
+        fclose(out_log);
+        return 0;
+}
@@ -3,12 +3,14 @@
 
 #include "net.h"
 #include "ip.h"
+#include "netif.h"
 #include "utils.h"
 
 extern FILE *control_flow;
 extern FILE *arp_fout;
 
 buf_t buf;
+uint8_t my_ip[] = DRIVER_IF_IP;
 int main()
 {
         FILE *in = fopen("data/ip_frag_test/in.txt","r");
@@ -19,6 +21,7 @@ int main()
                 return 0;
         }
         arp_fout = control_flow;
+        buf_init(&buf,UINT16_MAX);
         char * p = buf.payload + 1000;
         buf.data = p;
         buf.len = 0;
@@ -29,7 +32,8 @@ int main()
                 buf.len++;
         }
         printf("\e[0;34mFeeding input.\n");
-        ip_out(&buf,net_if_ip,NET_PROTOCOL_TCP);
+        net_if_init();
+        ip_out(&buf,my_ip,NET_PROTOCOL_TCP);
 
         fclose(in);
         fclose(control_flow);
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "ip.h"
+#include "icmp.h"
+#include "netif.h"
+#include "timer.h"
+#include "checksum.h"
+
+extern uint64_t fake_clock_ms;
+
+static int err;
+
+#define CHECK(cond, ...)                                        \
+        do{                                                     \
+                if(!(cond) && err++ < 20){                      \
+                        printf("\e[0;31m" __VA_ARGS__);         \
+                        printf("\n");                           \
+                }                                               \
+        }while(0)
+
+static uint8_t my_ip[] = DRIVER_IF_IP;
+static uint8_t router_ip[] = {10, 0, 0, 1};
+static buf_t buf;
+
+static void ip_of(uint32_t a, uint8_t *ip)
+{
+        ip[0] = a >> 24;
+        ip[1] = a >> 16;
+        ip[2] = a >> 8;
+        ip[3] = a;
+}
+
+// 收到路由器对本机发往dest_ip的数据报回送的"需要分片"
+static void frag_needed(const uint8_t *src_ip, const uint8_t *dest_ip, int df, int protocol, int mtu, int len)
+{
+        buf_init(&buf, 8 + sizeof(ip_hdr_t) + 8);
+        memset(buf.data, 0, buf.len);
+        buf.data[0] = ICMP_TYPE_UNREACH;
+        buf.data[1] = ICMP_CODE_FRAG_NEEDED;
+        buf.data[6] = mtu >> 8;
+        buf.data[7] = mtu;
+        ip_hdr_t *orig = (ip_hdr_t *)(buf.data + 8);
+        orig->version = IP_VERSION_4;
+        orig->hdr_len = sizeof(ip_hdr_t) / IP_HDR_LEN_PER_BYTE;
+        orig->total_len = swap16(len);
+        orig->flags_fragment = df ? swap16(IP_DONT_FRAGMENT << 8) : 0;
+        orig->ttl = IP_DEFALUT_TTL;
+        orig->protocol = protocol;
+        memcpy(orig->src_ip, src_ip, NET_IP_LEN);
+        memcpy(orig->dest_ip, dest_ip, NET_IP_LEN);
+        orig->hdr_checksum = csum_fold(csum_partial(orig, sizeof(ip_hdr_t), 0));
+        uint16_t *p_16 = (uint16_t *)buf.data;
+        p_16[1] = csum_fold(csum_partial(buf.data, buf.len, 0));
+        icmp_in(&buf, router_ip, my_ip);
+}
+
+// 只降低，不低于IP_PMTU_MIN，IP_PMTU_TIMEOUT_SEC后恢复为网卡MTU
+static void test_lower()
+{
+        uint8_t dst[NET_IP_LEN];
+        int mtu = net_if_get(0)->mtu;
+        ip_of(0x0b000001, dst);
+        CHECK(ip_pmtu(dst) == mtu, "lower: initial pmtu %d", ip_pmtu(dst));
+        frag_needed(my_ip, dst, 1, NET_PROTOCOL_UDP, 1200, mtu);
+        CHECK(ip_pmtu(dst) == 1200, "lower: pmtu %d, expected 1200", ip_pmtu(dst));
+        frag_needed(my_ip, dst, 1, NET_PROTOCOL_UDP, 1400, 1200);
+        CHECK(ip_pmtu(dst) == 1200, "lower: raised to %d", ip_pmtu(dst));
+        frag_needed(my_ip, dst, 1, NET_PROTOCOL_ICMP, 1000, 1200);
+        CHECK(ip_pmtu(dst) == 1000, "lower: pmtu %d, expected 1000", ip_pmtu(dst));
+        frag_needed(my_ip, dst, 1, NET_PROTOCOL_UDP, 300, 1000);
+        CHECK(ip_pmtu(dst) == IP_PMTU_MIN, "floor: pmtu %d, expected %d", ip_pmtu(dst), IP_PMTU_MIN);
+        //过期时间从最近一次降低算起
+        uint64_t t = fake_clock_ms;
+        fake_clock_ms = t + IP_PMTU_TIMEOUT_SEC * 1000 - 1;
+        timer_run();
+        CHECK(ip_pmtu(dst) == IP_PMTU_MIN, "expiry: pmtu %d before timeout", ip_pmtu(dst));
+        fake_clock_ms = t + IP_PMTU_TIMEOUT_SEC * 1000;
+        timer_run();
+        CHECK(ip_pmtu(dst) == mtu, "expiry: pmtu %d after timeout", ip_pmtu(dst));
+}
+
+// 下一跳MTU为0（旧路由器）时按原数据报长度取下一个更小的平台值
+static void test_plateau()
+{
+        static const int lens[] = {1500, 1492, 1200, 1006, 600};
+        static const int expect[] = {1492, 1006, 1006, IP_PMTU_MIN, IP_PMTU_MIN};
+        uint8_t dst[NET_IP_LEN];
+        ip_of(0x0b000002, dst);
+        for(int i = 0; i < (int)(sizeof(lens) / sizeof(lens[0])); i++){
+                frag_needed(my_ip, dst, 1, NET_PROTOCOL_UDP, 0, lens[i]);
+                CHECK(ip_pmtu(dst) == expect[i], "plateau: len %d gives pmtu %d, expected %d", lens[i], ip_pmtu(dst), expect[i]);
+        }
+}
+
+// 不可能由本机引起的"需要分片"不改变路径MTU
+static void test_forged()
+{
+        uint8_t dst[3][NET_IP_LEN], other[NET_IP_LEN];
+        int mtu = net_if_get(0)->mtu;
+        for(int i = 0; i < 3; i++)
+                ip_of(0x0b000003 + i, dst[i]);
+        ip_of(0x0b000010, other);
+        frag_needed(my_ip, dst[0], 0, NET_PROTOCOL_UDP, 1000, mtu);
+        CHECK(ip_pmtu(dst[0]) == mtu, "forged: lowered to %d without DF", ip_pmtu(dst[0]));
+        frag_needed(my_ip, dst[1], 1, NET_PROTOCOL_TCP, 1000, mtu);
+        CHECK(ip_pmtu(dst[1]) == mtu, "forged: lowered to %d for tcp", ip_pmtu(dst[1]));
+        frag_needed(other, dst[2], 1, NET_PROTOCOL_UDP, 1000, mtu);
+        CHECK(ip_pmtu(dst[2]) == mtu, "forged: lowered to %d for another source", ip_pmtu(dst[2]));
+}
+
+int main()
+{
+        printf("\e[0;34mTest begin.\n");
+        fake_clock_ms = 1000000;
+        timer_init();
+        net_if_init();
+        ip_init();
+        test_lower();
+        test_plateau();
+        test_forged();
+        if(err){
+                printf("\e[1;31mPmtu test failed, %d errors.\n", err);
+                return 1;
+        }
+        printf("\e[1;32mPmtu test passed.\n");
+        return 0;
+}
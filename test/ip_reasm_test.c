@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "net.h"
+#include "ip.h"
+#include "netif.h"
+#include "timer.h"
+#include "utils.h"
+#include "checksum.h"
+
+extern FILE *control_flow;
+extern FILE *icmp_fout;
+extern FILE *demo_log;
+extern FILE *out_log;
+extern uint64_t fake_clock_ms;
+
+char* print_ip(uint8_t *ip);
+int check_log();
+
+/**
+ * 输入的每一行是一条命令，#开头的行与空行忽略：
+ *     frag <源ip> <标识> <片偏移(B)> <负载长度> <mf> [个数]
+ *         发送一个udp分片，负载第k个字节（在数据报中的偏移）为(k * 7 + 标识) & 0xff；
+ *         个数大于1时连续发送，后一个分片紧接前一个
+ *     wait <ms>   推进时钟并处理到期的定时器
+ *     mtu <mtu>   修改网卡的MTU，用于发送巨型帧大小的分片
+ * 每条命令是一个Round，日志中记录交给上层的完整数据报
+ */
+
+uint8_t my_ip[] = DRIVER_IF_IP;
+buf_t buf;
+
+static uint8_t pattern(int k, int id)
+{
+        return (k * 7 + id) & 0xff;
+}
+
+// 替换udp层：只记录长度并检查负载，不输出整个数据报
+void udp_in(buf_t *buf, uint8_t *src_ip, uint8_t *dest_ip)
+{
+        (void)dest_ip;
+        int id = buf->data[0];
+        int ok = 1;
+        for(int k = 0; k < buf->len; k++)
+                if(buf->data[k] != pattern(k, id))
+                        ok = 0;
+        fprintf(control_flow,"udp_in:\tsrc_ip:%s\tid:%d\tlen:%d\tdata:%s\n",print_ip(src_ip),id,buf->len,ok ? "ok" : "corrupted");
+}
+
+static void send_frag(uint8_t *src_ip, int id, int offset, int len, int mf)
+{
+        buf_init(&buf, sizeof(ip_hdr_t) + len);
+        ip_hdr_t *hdr = (ip_hdr_t *)buf.data;
+        memset(hdr, 0, sizeof(ip_hdr_t));
+        hdr->version = IP_VERSION_4;
+        hdr->hdr_len = sizeof(ip_hdr_t) / IP_HDR_LEN_PER_BYTE;
+        hdr->total_len = swap16(sizeof(ip_hdr_t) + len);
+        hdr->id = swap16(id);
+        hdr->flags_fragment = swap16((mf ? IP_MORE_FRAGMENT << 8 : 0) | offset / IP_HDR_OFFSET_PER_BYTE);
+        hdr->ttl = IP_DEFALUT_TTL;
+        hdr->protocol = NET_PROTOCOL_UDP;
+        memcpy(hdr->src_ip, src_ip, NET_IP_LEN);
+        memcpy(hdr->dest_ip, my_ip, NET_IP_LEN);
+        hdr->hdr_checksum = csum_fold(csum_partial(hdr, sizeof(ip_hdr_t), 0));
+        for(int k = 0; k < len; k++)
+                buf.data[sizeof(ip_hdr_t) + k] = pattern(offset + k, id);
+        ip_in(&buf);
+}
+
+static void run(char *line)
+{
+        int a[4], id, offset, len, mf, count = 1;
+        uint8_t src_ip[NET_IP_LEN];
+        if(sscanf(line, "frag %d.%d.%d.%d %d %d %d %d %d", &a[0], &a[1], &a[2], &a[3], &id, &offset, &len, &mf, &count) >= 8){
+                for(int i = 0; i < NET_IP_LEN; i++)
+                        src_ip[i] = a[i];
+                for(int i = 0; i < count; i++)
+                        send_frag(src_ip, id, offset + i * len, len, mf);
+        }else if(sscanf(line, "wait %d", &len) == 1){
+                fake_clock_ms += len;
+                timer_run();
+        }else if(sscanf(line, "mtu %d", &len) == 1){
+                net_if_set_mtu(net_if_get(0), len);
+        }else{
+                fprintf(control_flow,"unknown command\n");
+        }
+}
+
+int main()
+{
+        printf("\e[0;34mTest begin.\n");
+        FILE *in = fopen("data/ip_reasm_test/in.txt","r");
+        control_flow = fopen("data/ip_reasm_test/log","w");
+        if(in == 0 || control_flow == 0){
+                if(in) fclose(in); else printf("\e[1;31mFailed to open in.txt\n");
+                if(control_flow) fclose(control_flow); else printf("\e[1;31mFailed to open log\n");
+                return 0;
+        }
+        icmp_fout = control_flow;
+        fake_clock_ms = 1000000;
+        timer_init();
+        net_if_init();
+        ip_init();
+
+        char line[256];
+        int round = 1;
+        printf("\e[0;34mFeeding input %02d",round);
+        while(fgets(line, sizeof(line), in)){
+                line[strcspn(line, "\r\n")] = 0;
+                if(line[0] == 0 || line[0] == '#')
+                        continue;
+                printf("\b\b%02d",round);
+                fprintf(control_flow,"\nRound %02d: %s\n",round++,line);
+                run(line);
+        }
+        printf("\e[0;34m\nSample input all processed, checking output\n");
+        fclose(in);
+        fclose(control_flow);
+
+        demo_log = fopen("data/ip_reasm_test/demo_log","r");
+        out_log = fopen("data/ip_reasm_test/log","r");
+        if(demo_log == 0 || out_log == 0){
+                if(demo_log) fclose(demo_log); else printf("\e[1;31mFailed to open demo_log\n");
+                if(out_log) fclose(out_log); else printf("\e[1;31mFailed to open log\n");
+                return 0;
+        }
+        int ret = check_log();
+        fclose(demo_log);
+        fclose(out_log);
+        return ret;
+}
@@ -0,0 +1,256 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "route.h"
+#include "ethernet.h"
+#include "arp.h"
+#include "ip.h"
+#include "checksum.h"
+
+#define ADDR_NR (1 << 20)
+#define ROUNDS (1 << 24)
+#define CHECK_NR 4000
+#define GW_NR 16 //网关都在默认网卡的子网内，事先写入arp表
+
+extern int driver_sent;
+
+static const int bench_nr[] = {1000, 10000, 30000};
+
+typedef struct rule
+{
+        uint32_t prefix;
+        int len;
+        uint8_t gw[4];
+} rule_t;
+
+static rule_t rules[32768];
+static int rule_nr;
+static uint8_t addrs[ADDR_NR][4];
+static uintptr_t sink; //各个被测循环的结果，最后输出，循环不会被当作无用代码删掉
+static uint8_t src_ip[] = {192, 168, 127, 1};
+static uint8_t gw_base[] = DRIVER_IF_IP;
+
+static void to_ip(uint32_t a, uint8_t *ip)
+{
+        ip[0] = a >> 24;
+        ip[1] = a >> 16;
+        ip[2] = a >> 8;
+        ip[3] = a;
+}
+
+static uint32_t rand32()
+{
+        return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+static uint32_t mask(int len)
+{
+        return len ? ~0u << (32 - len) : 0;
+}
+
+// 前缀长度分布接近骨干网路由表：以/24为主，少量长于24的前缀
+static int rand_len()
+{
+        int r = rand() % 100;
+        if(r < 55)
+                return 24;
+        if(r < 90)
+                return 16 + rand() % 8;
+        if(r < 95)
+                return 8 + rand() % 8;
+        return 25 + rand() % 8;
+}
+
+// 逐条比较的最长前缀匹配，作为对照
+static rule_t *ref_lookup(uint32_t a)
+{
+        rule_t *best = NULL;
+        for(int i = 0; i < rule_nr; i++)
+                if((a & mask(rules[i].len)) == rules[i].prefix && (!best || rules[i].len > best->len))
+                        best = &rules[i];
+        return best;
+}
+
+static int check(const char *stage)
+{
+        int err = 0;
+        for(int i = 0; i < CHECK_NR; i++){
+                uint32_t a;
+                // 一半取随机地址，一半取某条路由内的地址
+                if(i & 1 && rule_nr){
+                        rule_t *r = &rules[rand() % rule_nr];
+                        a = r->prefix | (rand32() & ~mask(r->len));
+                }else
+                        a = rand32();
+                uint8_t ip[4];
+                to_ip(a, ip);
+                rule_t *ref = ref_lookup(a);
+                route_entry_t *r = route_lookup(ip);
+                if((ref == NULL) != (r == NULL) || (ref && (r->prefix != ref->prefix || r->len != ref->len || memcmp(r->gw, ref->gw, 4)))){
+                        if(err++ < 5)
+                                printf("\e[0;31m%s: mismatch for %d.%d.%d.%d\n", stage, ip[0], ip[1], ip[2], ip[3]);
+                }
+        }
+        return err;
+}
+
+static double now()
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// 返回添加路由本身的耗时(s)，不含生成与查重
+static double add_rules(int n)
+{
+        double t = 0;
+        while(rule_nr < n){
+                rule_t *r = &rules[rule_nr];
+                r->len = rand_len();
+                r->prefix = rand32() & mask(r->len);
+                memcpy(r->gw, gw_base, 3);
+                r->gw[3] = 1 + rand() % GW_NR;
+                int dup = 0;
+                for(int i = 0; i < rule_nr && !dup; i++)
+                        dup = rules[i].prefix == r->prefix && rules[i].len == r->len;
+                if(dup)
+                        continue;
+                uint8_t ip[4];
+                to_ip(r->prefix, ip);
+                double t0 = now();
+                int ret = route_add(ip, r->len, r->gw, 0);
+                t += now() - t0;
+                if(ret != 0){
+                        printf("\e[0;31mroute_add failed at %d\n", rule_nr);
+                        exit(1);
+                }
+                rule_nr++;
+        }
+        return t;
+}
+
+static void del_rules(int keep)
+{
+        while(rule_nr > keep){
+                int i = rand() % rule_nr;
+                uint8_t ip[4];
+                to_ip(rules[i].prefix, ip);
+                if(route_del(ip, rules[i].len) != 0){
+                        printf("\e[0;31mroute_del failed\n");
+                        exit(1);
+                }
+                rules[i] = rules[--rule_nr];
+        }
+}
+
+// 只查路由表
+static double bench_lookup()
+{
+        uintptr_t acc = 0;
+        double t0 = now();
+        for(int i = 0; i < ROUNDS; i++)
+                acc += (uintptr_t)route_lookup(addrs[i & (ADDR_NR - 1)]);
+        double t1 = now();
+        sink += acc;
+        return ROUNDS / (t1 - t0) / 1e6;
+}
+
+// 开启转发，把数据报逐个交给ip_in()，经路由、arp、以太网一直走到驱动，统计交给驱动的帧数
+static double bench_forward()
+{
+        static uint8_t in[256][64];
+        for(int i = 0, j = 0; i < 256; j++){
+                uint8_t *dest = addrs[j * 4099 & (ADDR_NR - 1)];
+                if(dest[0] >= 224 || net_if_local(dest))
+                        continue; //不转发组播、广播，本机地址不经转发
+                ip_hdr_t *h = (ip_hdr_t *)in[i];
+                memset(in[i], 0, sizeof(in[i]));
+                h->version = IP_VERSION_4;
+                h->hdr_len = sizeof(ip_hdr_t) / IP_HDR_LEN_PER_BYTE;
+                h->total_len = swap16(sizeof(in[i]));
+                h->ttl = IP_DEFALUT_TTL;
+                h->protocol = NET_PROTOCOL_UDP;
+                memcpy(h->src_ip, src_ip, NET_IP_LEN);
+                memcpy(h->dest_ip, dest, NET_IP_LEN);
+                h->hdr_checksum = csum_fold(csum_partial(h, sizeof(ip_hdr_t), 0));
+                i++;
+        }
+        buf_t buf = {0};
+        int sent = driver_sent;
+        double t0 = now();
+        for(int i = 0; i < ROUNDS; i++){
+                buf_init(&buf, sizeof(in[0]));
+                memcpy(buf.data, in[i & 255], sizeof(in[0]));
+                ip_in(&buf);
+        }
+        double t1 = now();
+        buf_free(&buf);
+        if(driver_sent - sent != ROUNDS){
+                printf("\e[0;31mforward: %d frames sent, expected %d\n", driver_sent - sent, ROUNDS);
+                return 0;
+        }
+        return ROUNDS / (t1 - t0) / 1e6;
+}
+
+int main()
+{
+        int err = 0;
+        srand(1);
+        printf("\e[0;34mTest begin.\n");
+
+        // 正确性：添加、覆盖、删除后都与逐条比较的结果一致
+        add_rules(2000);
+        err += check("add");
+        uint8_t any[4] = {0, 0, 0, 0}, gw[4] = {10, 0, 0, 1};
+        route_add(any, 0, gw, 0);
+        rules[rule_nr++] = (rule_t){0, 0, {10, 0, 0, 1}};
+        err += check("default route");
+        del_rules(1000);
+        err += check("delete");
+        del_rules(0);
+        err += check("delete all");
+        if(route_count() != 0){
+                err++;
+                printf("\e[0;31m%d routes left after deleting all\n", route_count());
+        }
+        if(err){
+                printf("\e[1;31mRoute lookup mismatch, %d errors.\n", err);
+                return 1;
+        }
+        printf("\e[1;32mAll lookups match the reference.\n");
+
+        ip_set_forward(1);
+        if(ethernet_init()){
+                printf("\e[1;31mDriver open failed\n");
+                return 1;
+        }
+        arp_init();
+        ip_init();
+        for(int i = 1; i <= GW_NR; i++){
+                uint8_t gw[4], mac[6] = {0x02, 0, 0, 0, 0, i};
+                memcpy(gw, gw_base, 3);
+                gw[3] = i;
+                arp_update(gw, mac, ARP_VALID);
+        }
+
+        printf("\e[0;34mBenchmark (Mpps):\n\e[0m%8s %12s %14s %14s %14s\n", "routes", "add(us)", "lookup(rand)", "lookup(hit)", "forward");
+        for(int j = 0; j < (int)(sizeof(bench_nr) / sizeof(bench_nr[0])); j++){
+                double add_us = add_rules(bench_nr[j]) * 1e6 / bench_nr[j];
+                for(int i = 0; i < ADDR_NR; i++)
+                        to_ip(rand32(), addrs[i]);
+                double rnd = bench_lookup();
+                for(int i = 0; i < ADDR_NR; i++){
+                        rule_t *r = &rules[rand() % rule_nr];
+                        to_ip(r->prefix | (rand32() & ~mask(r->len)), addrs[i]);
+                }
+                double hit = bench_lookup();
+                double fwd = bench_forward();
+                printf("%8d %12.2f %14.1f %14.1f %14.1f\n", bench_nr[j], add_us, rnd, hit, fwd);
+                del_rules(0);
+        }
+        printf("\e[0;34m(sink %lx)\n", (unsigned long)sink);
+        return 0;
+}
@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "timer.h"
+
+#define WHEEL_SPAN ((1ULL << 24) - 1) //时间轮能直接容纳的最大时长，与timer.c中的TIMER_MAX_DELTA一致
+#define RANDOM_NR 256
+
+extern uint64_t fake_clock_ms;
+
+static int err;
+
+#define CHECK(cond, ...)                                        \
+        do{                                                     \
+                if(!(cond) && err++ < 20){                      \
+                        printf("\e[0;31m" __VA_ARGS__);         \
+                        printf("\n");                           \
+                }                                               \
+        }while(0)
+
+typedef struct probe
+{
+        net_timer_t timer;
+        int fired;           //到期次数
+        uint64_t fired_at;   //最近一次到期时的时钟
+        int rearm;           //到期时重新启动的次数上限
+        int64_t period;      //重新启动的间隔，相对timer_now()
+        struct probe *other; //到期时删除或推迟的另一个定时器，仅在other尚未到期时
+        uint64_t other_to;   //不为0时把other推迟到该时间，否则删除other
+} probe_t;
+
+static void on_fire(net_timer_t *timer, void *arg)
+{
+        probe_t *p = arg;
+        CHECK(!timer_pending(timer), "handler: timer still pending");
+        p->fired++;
+        p->fired_at = timer_now();
+        if(p->other && timer_pending(&p->other->timer)){
+                if(p->other_to)
+                        timer_mod(&p->other->timer, p->other_to);
+                else
+                        timer_del(&p->other->timer);
+        }
+        if(p->rearm > 0){
+                p->rearm--;
+                timer_mod(timer, timer_now() + p->period);
+        }
+}
+
+// 上一个用例失败时可能留下未到期的定时器，先从时间轮中删除再重新设置
+static void probe_init(probe_t *p)
+{
+        timer_del(&p->timer);
+        p->fired = 0;
+        p->fired_at = 0;
+        p->rearm = 0;
+        p->period = 0;
+        p->other = 0;
+        p->other_to = 0;
+        timer_setup(&p->timer, on_fire, p);
+}
+
+static void start(uint64_t now)
+{
+        fake_clock_ms = now;
+        timer_init();
+}
+
+static void run_to(uint64_t now)
+{
+        fake_clock_ms = now;
+        timer_run();
+}
+
+// 按timer_next()的结果推进时钟，检查它不晚于到期时间；没有定时器时返回0
+static int step(uint64_t expires)
+{
+        int next = timer_next();
+        CHECK(next >= 0, "timer_next() = %d with a pending timer", next);
+        if(next < 0)
+                return 0;
+        CHECK(fake_clock_ms + next <= expires, "timer_next() = %d at %llu, later than %llu",
+              next, (unsigned long long)fake_clock_ms, (unsigned long long)expires);
+        run_to(fake_clock_ms + next);
+        return 1;
+}
+
+// 级联边界：到期时间恰好落在各层的边界上
+static void test_cascade()
+{
+        static const uint64_t bases[] = {0, 1, 63, 4095, 1000003, WHEEL_SPAN - 2};
+        static const uint64_t deltas[] = {0, 1, 63, 64, 65, 4095, 4096, 4097, 262143, 262144, 262145,
+                                          WHEEL_SPAN - 1, WHEEL_SPAN, WHEEL_SPAN + 1, WHEEL_SPAN + 5000};
+        static probe_t p;
+        for(int i = 0; i < (int)(sizeof(bases) / sizeof(bases[0])); i++)
+                for(int j = 0; j < (int)(sizeof(deltas) / sizeof(deltas[0])); j++){
+                        uint64_t expires = bases[i] + deltas[j];
+                        //直接跳到到期前一刻与到期时刻
+                        start(bases[i]);
+                        probe_init(&p);
+                        timer_mod(&p.timer, expires);
+                        if(deltas[j]){
+                                run_to(expires - 1);
+                                CHECK(p.fired == 0, "base %llu delta %llu: fired early",
+                                      (unsigned long long)bases[i], (unsigned long long)deltas[j]);
+                        }
+                        run_to(expires);
+                        CHECK(p.fired == 1 && p.fired_at == expires, "base %llu delta %llu: fired %d at %llu",
+                              (unsigned long long)bases[i], (unsigned long long)deltas[j], p.fired, (unsigned long long)p.fired_at);
+                        CHECK(timer_next() == -1, "base %llu delta %llu: timer left after expiry",
+                              (unsigned long long)bases[i], (unsigned long long)deltas[j]);
+                        //按timer_next()推进
+                        start(bases[i]);
+                        probe_init(&p);
+                        timer_mod(&p.timer, expires);
+                        while(p.fired == 0 && fake_clock_ms < expires + 2 && step(expires))
+                                ;
+                        CHECK(p.fired == 1 && p.fired_at == expires, "base %llu delta %llu: stepped, fired %d at %llu",
+                              (unsigned long long)bases[i], (unsigned long long)deltas[j], p.fired, (unsigned long long)p.fired_at);
+                }
+        //超过时间轮范围数倍的定时器多次放回最高层后仍准时到期
+        start(5);
+        probe_init(&p);
+        timer_mod(&p.timer, 5 + 3 * WHEEL_SPAN + 7);
+        run_to(5 + 3 * WHEEL_SPAN + 6);
+        CHECK(p.fired == 0, "3 spans: fired early");
+        run_to(5 + 3 * WHEEL_SPAN + 7);
+        CHECK(p.fired == 1, "3 spans: not fired");
+}
+
+// 在处理函数中重新启动
+static void test_rearm()
+{
+        static const int64_t periods[] = {1, 7, 63, 64, 4096, 300000};
+        static probe_t p;
+        for(int i = 0; i < (int)(sizeof(periods) / sizeof(periods[0])); i++){
+                start(1000);
+                probe_init(&p);
+                p.rearm = 9;
+                p.period = periods[i];
+                timer_mod(&p.timer, 1000 + periods[i]);
+                for(int k = 1; k <= 10; k++){
+                        uint64_t expires = 1000 + k * periods[i];
+                        while(p.fired < k && fake_clock_ms < expires + 2 && step(expires))
+                                ;
+                        CHECK(p.fired == k && p.fired_at == expires, "period %lld: fire %d at %llu, expected %llu",
+                              (long long)periods[i], p.fired, (unsigned long long)p.fired_at, (unsigned long long)expires);
+                }
+                CHECK(timer_next() == -1, "period %lld: timer left", (long long)periods[i]);
+        }
+        //重新启动到当前或更早的时间：下一个时刻才到期，一次timer_run()中不会反复调用
+        for(int64_t period = 0; period >= -5; period -= 5){
+                start(2000);
+                probe_init(&p);
+                p.rearm = 2;
+                p.period = period;
+                timer_mod(&p.timer, 2000);
+                run_to(2000);
+                CHECK(p.fired == 1, "rearm %lld: fired %d times in one run", (long long)period, p.fired);
+                run_to(2001);
+                CHECK(p.fired == 2, "rearm %lld: not fired at the next tick", (long long)period);
+                run_to(2002);
+                CHECK(p.fired == 3 && timer_next() == -1, "rearm %lld: fired %d", (long long)period, p.fired);
+        }
+}
+
+// 同一槽中的定时器已摘到临时链表上时删除或修改其中一个
+static void test_detached()
+{
+        static probe_t a, b, c;
+        //先到期的删除另一个：只有一个到期
+        start(0);
+        probe_init(&a);
+        probe_init(&b);
+        a.other = &b;
+        b.other = &a;
+        timer_mod(&a.timer, 100);
+        timer_mod(&b.timer, 100);
+        run_to(200);
+        CHECK(a.fired + b.fired == 1, "del in detached list: %d fired", a.fired + b.fired);
+        CHECK(timer_next() == -1, "del in detached list: timer left");
+        //先到期的推迟另一个：另一个按新的时间到期
+        start(0);
+        probe_init(&a);
+        probe_init(&b);
+        a.other = &b;
+        b.other = &a;
+        a.other_to = b.other_to = 4200;
+        timer_mod(&a.timer, 100);
+        timer_mod(&b.timer, 100);
+        run_to(4199);
+        CHECK(a.fired + b.fired == 1, "mod in detached list: %d fired before the new time", a.fired + b.fired);
+        run_to(4200);
+        CHECK(a.fired == 1 && b.fired == 1 && (a.fired_at == 4200 || b.fired_at == 4200),
+              "mod in detached list: fired %d/%d at %llu/%llu", a.fired, b.fired,
+              (unsigned long long)a.fired_at, (unsigned long long)b.fired_at);
+        CHECK(timer_next() == -1, "mod in detached list: timer left");
+        //三个定时器在同一槽中，第一个删除排在它后面的，剩下的照常到期
+        start(0);
+        probe_init(&a);
+        probe_init(&b);
+        probe_init(&c);
+        timer_mod(&a.timer, 30);
+        timer_mod(&b.timer, 30);
+        timer_mod(&c.timer, 30);
+        c.other = &b; //最低层的槽中按启动的逆序，c最先到期
+        run_to(30);
+        CHECK(c.fired == 1 && b.fired == 0 && a.fired == 1, "three in a slot: %d/%d/%d", a.fired, b.fired, c.fired);
+        CHECK(timer_next() == -1, "three in a slot: timer left");
+        //高层的定时器在级联前删除
+        start(0);
+        probe_init(&a);
+        timer_mod(&a.timer, 5000);
+        run_to(4095);
+        timer_del(&a.timer);
+        timer_del(&a.timer);
+        run_to(6000);
+        CHECK(a.fired == 0 && timer_next() == -1, "del before cascade: fired %d", a.fired);
+}
+
+// 随机的定时器：按timer_next()推进时每个定时器都恰好在到期时刻被处理
+static void test_random()
+{
+        static probe_t p[RANDOM_NR];
+        static const uint64_t ranges[] = {70, 5000, 300000, 2 * WHEEL_SPAN};
+        uint64_t base = 123456789;
+        start(base);
+        for(int i = 0; i < RANDOM_NR; i++){
+                probe_init(&p[i]);
+                uint64_t range = ranges[i % 4];
+                timer_mod(&p[i].timer, base + 1 + ((uint64_t)rand() << 16 ^ rand()) % range);
+        }
+        //部分定时器改期或删除
+        for(int i = 0; i < RANDOM_NR; i += 7)
+                timer_mod(&p[i].timer, base + 1 + rand() % 10000);
+        for(int i = 3; i < RANDOM_NR; i += 11)
+                timer_del(&p[i].timer);
+        int left = 0;
+        for(int i = 0; i < RANDOM_NR; i++)
+                left += timer_pending(&p[i].timer);
+        int steps = 0;
+        while(left && steps < 1000000){
+                uint64_t first = UINT64_MAX;
+                for(int i = 0; i < RANDOM_NR; i++)
+                        if(timer_pending(&p[i].timer) && p[i].timer.expires < first)
+                                first = p[i].timer.expires;
+                if(!step(first))
+                        break;
+                steps++;
+                for(int i = 0; i < RANDOM_NR; i++)
+                        if(p[i].fired && p[i].fired_at != p[i].timer.expires){
+                                CHECK(0, "random %d: expires %llu, fired at %llu", i,
+                                      (unsigned long long)p[i].timer.expires, (unsigned long long)p[i].fired_at);
+                                p[i].fired_at = p[i].timer.expires;
+                        }
+                left = 0;
+                for(int i = 0; i < RANDOM_NR; i++)
+                        left += timer_pending(&p[i].timer);
+        }
+        for(int i = 0; i < RANDOM_NR; i++)
+                CHECK(p[i].fired == (i % 11 == 3 ? 0 : 1), "random %d: fired %d times", i, p[i].fired);
+        CHECK(timer_next() == -1, "random: timer left");
+}
+
+int main()
+{
+        srand(1);
+        printf("\e[0;34mTest begin.\n");
+        test_cascade();
+        test_rearm();
+        test_detached();
+        test_random();
+        if(err){
+                printf("\e[1;31mTimer test failed, %d errors.\n", err);
+                return 1;
+        }
+        printf("\e[1;32mTimer test passed.\n");
+        return 0;
+}